@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Run the Lox benchmark programs and report their run times as JSON.
+
+Every program in the programs directory is run several times on each given
+interpreter. The output of each run is checked against <program>.out. The
+median and standard deviation of the wall clock times are written as JSON.
+
+Programs which an interpreter rejects with a compile error (exit status 65)
+are reported as unsupported, since clox does not implement the whole language
+yet. Any other failure or wrong output fails the run.
+
+With --baseline, the medians are compared to an earlier JSON report and every
+program which became slower than the threshold is flagged as a regression.
+
+Example, comparing both interpreters to the stored baseline:
+
+  bench/run_bench.py --runs=10 --baseline=bench/baseline.json \\
+      clox=_build/clox/clox cpplox=_build/cpplox/cpplox
+"""
+
+import argparse
+import json
+import math
+import statistics
+import subprocess
+import sys
+import time
+from pathlib import Path
+
+# Exit status of both interpreters for scripts which do not compile.
+EXIT_COMPILE_ERROR = 65
+
+
+def parse_interpreter(text):
+    name, separator, path = text.partition("=")
+    if not separator or not name or not path:
+        raise argparse.ArgumentTypeError(
+            f"expected <name>=<path>, got '{text}'")
+    return name, path
+
+
+def run_once(interpreter, program):
+    """Run the program and return its exit status, output and run time."""
+    start = time.perf_counter()
+    process = subprocess.run([interpreter, str(program)],
+                             stdout=subprocess.PIPE,
+                             stderr=subprocess.STDOUT,
+                             check=False)
+    seconds = time.perf_counter() - start
+    return process.returncode, process.stdout.decode(errors="replace"), seconds
+
+
+def measure(name, interpreter, program, runs, warmup):
+    """Time all runs of one program on one interpreter."""
+    result = {"interpreter": name, "program": program.stem}
+    expected = program.with_suffix(".out").read_text()
+
+    times = []
+    for run in range(warmup + runs):
+        status, output, seconds = run_once(interpreter, program)
+        if status == EXIT_COMPILE_ERROR and run == 0:
+            result["status"] = "unsupported"
+            return result
+        if status != 0 or output != expected:
+            result["status"] = "failed"
+            result["exit_status"] = status
+            result["output"] = output
+            return result
+        if run >= warmup:
+            times.append(seconds)
+
+    result["status"] = "ok"
+    result["median"] = statistics.median(times)
+    result["stddev"] = statistics.stdev(times) if len(times) > 1 else 0.0
+    result["min"] = min(times)
+    result["runs"] = len(times)
+    return result
+
+
+def find_regressions(results, baseline, threshold):
+    """Compare the medians to the baseline.
+
+    A program regressed if its median grew by more than the relative
+    threshold and by more than twice the combined noise of both measurements.
+    """
+    reference = {(r["interpreter"], r["program"]): r
+                 for r in baseline.get("results", []) if r["status"] == "ok"}
+    regressions = []
+    for result in results:
+        old = reference.get((result["interpreter"], result["program"]))
+        if result["status"] != "ok" or old is None:
+            continue
+        ratio = result["median"] / old["median"]
+        result["baseline_median"] = old["median"]
+        result["ratio"] = ratio
+        noise = math.hypot(result["stddev"], old["stddev"])
+        if (ratio > 1 + threshold
+                and result["median"] - old["median"] > 2 * noise):
+            regressions.append({"interpreter": result["interpreter"],
+                                "program": result["program"],
+                                "ratio": ratio})
+    return regressions
+
+
+def print_summary(results, regressions):
+    for result in results:
+        line = f"{result['interpreter']:>8} {result['program']:<20} "
+        if result["status"] == "ok":
+            line += (f"{result['median'] * 1e3:10.2f} ms "
+                     f"± {result['stddev'] * 1e3:7.2f}")
+            if "ratio" in result:
+                line += f"  {result['ratio']:6.2f}x baseline"
+        else:
+            line += result["status"]
+        print(line, file=sys.stderr)
+    for regression in regressions:
+        print(f"REGRESSION: {regression['program']} on "
+              f"{regression['interpreter']} is {regression['ratio']:.2f}x "
+              f"slower than the baseline", file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("interpreters", nargs="+", type=parse_interpreter,
+                        metavar="NAME=PATH",
+                        help="interpreter executables to benchmark")
+    parser.add_argument("--programs", type=Path,
+                        default=Path(__file__).parent / "programs",
+                        help="directory with the .lox programs")
+    parser.add_argument("--runs", type=int, default=5,
+                        help="timed runs per program")
+    parser.add_argument("--warmup", type=int, default=1,
+                        help="untimed runs before the timed ones")
+    parser.add_argument("--baseline", type=Path,
+                        help="earlier JSON report to compare against")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="relative slowdown which counts as regression")
+    parser.add_argument("--output", type=Path,
+                        help="write the JSON report here instead of stdout")
+    args = parser.parse_args()
+    if args.runs < 1 or args.warmup < 0:
+        parser.error("--runs must be positive and --warmup not negative")
+
+    programs = sorted(args.programs.glob("*.lox"))
+    results = [measure(name, path, program, args.runs, args.warmup)
+               for name, path in args.interpreters for program in programs]
+
+    regressions = []
+    if args.baseline:
+        baseline = json.loads(args.baseline.read_text())
+        regressions = find_regressions(results, baseline, args.threshold)
+
+    report = {"runs": args.runs, "warmup": args.warmup, "results": results,
+              "regressions": regressions}
+    text = json.dumps(report, indent=2) + "\n"
+    if args.output:
+        args.output.write_text(text)
+    else:
+        sys.stdout.write(text)
+
+    print_summary(results, regressions)
+    failed = any(r["status"] == "failed" for r in results)
+    return 1 if failed or regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
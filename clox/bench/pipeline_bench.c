@@ -0,0 +1,232 @@
+// Measure the stages of the clox pipeline in isolation: scanning, compiling
+// and running. Every stage processes synthetic expressions of increasing size
+// and the cost per token or executed instruction is reported. If this cost
+// grows with the size of the input, the stage scales superlinearly.
+//
+// Usage: pipeline_bench [--max-terms=<n>] [--repeat=<n>] [--strict]
+
+#include "chunk.h"
+#include "compiler.h"
+#include "scanner.h"
+#include "vm.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MIN_TERMS 1024
+#define SIZE_FACTOR 4
+#define MAX_SIZES 16
+
+// A stage counts as superlinear if its time grows faster than the size of
+// the input to this power.
+#define SUPERLINEAR_EXPONENT 1.2
+
+typedef enum
+{
+  STAGE_SCAN,
+  STAGE_COMPILE,
+  STAGE_RUN,
+  STAGE_COUNT
+} Stage;
+
+static const char *stage_names[STAGE_COUNT] = { "scan", "compile", "run" };
+static const char *stage_units[STAGE_COUNT]
+    = { "ns/token", "ns/token", "ns/instruction" };
+
+/**
+ * An expression statement with a chain of comparisons of @p terms operands.
+ * It needs no constants, so it fits into a single chunk at any size, and
+ * keeps the stack shallow.
+ */
+static char *
+generate_source (int terms, size_t *length)
+{
+  static const char *operands[]
+      = { "!false", "!nil", "(true == !false)", "!(nil == false)" };
+  size_t capacity = (size_t)terms * 24 + 2;
+  char *source = malloc (capacity);
+  if (source == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  size_t used = 0;
+  for (int i = 0; i < terms; ++i)
+    {
+      used += snprintf (source + used, capacity - used, "%s%s",
+                        i > 0 ? " == " : "", operands[i % 4]);
+    }
+  used += snprintf (source + used, capacity - used, ";");
+  *length = used;
+  return source;
+}
+
+static double
+seconds_since (const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec)
+         + (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static long
+count_tokens (const char *source, size_t length)
+{
+  Scanner scanner;
+  init_scanner (&scanner, source, length);
+  long tokens = 0;
+  while (scan_token (&scanner).type != TOKEN_EOF)
+    tokens++;
+  return tokens;
+}
+
+static long
+count_instructions (const Chunk *chunk)
+{
+  long instructions = 0;
+  for (int offset = 0; offset < chunk->count; ++instructions)
+    offset += chunk->code[offset] == OP_CONSTANT ? 2 : 1;
+  return instructions;
+}
+
+/**
+ * Time one run of @p stage on @p source.
+ */
+static double
+time_stage (Stage stage, VM *vm, const char *source, size_t length,
+            const Program *program)
+{
+  struct timespec start;
+  double seconds = 0.0;
+  switch (stage)
+    {
+    case STAGE_SCAN:
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      count_tokens (source, length);
+      seconds = seconds_since (&start);
+      break;
+    case STAGE_COMPILE:
+      {
+        Chunk chunk;
+        init_chunk (&chunk);
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        compile (vm, source, length, &chunk);
+        seconds = seconds_since (&start);
+        free_chunk (&chunk);
+        break;
+      }
+    case STAGE_RUN:
+      {
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        run_program (vm, program);
+        seconds = seconds_since (&start);
+        break;
+      }
+    case STAGE_COUNT:
+      break;
+    }
+  return seconds;
+}
+
+int
+main (int argc, char **argv)
+{
+  long max_terms = 256 * 1024;
+  long repeat = 5;
+  bool strict = false;
+  for (int i = 1; i < argc; ++i)
+    {
+      if (strncmp (argv[i], "--max-terms=", 12) == 0)
+        max_terms = strtol (argv[i] + 12, NULL, 10);
+      else if (strncmp (argv[i], "--repeat=", 9) == 0)
+        repeat = strtol (argv[i] + 9, NULL, 10);
+      else if (strcmp (argv[i], "--strict") == 0)
+        strict = true;
+      else
+        {
+          fprintf (stderr,
+                   "Usage: %s [--max-terms=<n>] [--repeat=<n>] [--strict]\n",
+                   argv[0]);
+          return 64;
+        }
+    }
+  if (max_terms < MIN_TERMS || repeat < 1)
+    {
+      fprintf (stderr, "At least %d terms and one repetition are needed.\n",
+               MIN_TERMS);
+      return 64;
+    }
+
+  VM vm;
+  init_vm (&vm, 0);
+
+  int sizes = 0;
+  long terms[MAX_SIZES];
+  // Nanoseconds per unit for every stage and size.
+  double cost[STAGE_COUNT][MAX_SIZES];
+  bool ok = true;
+
+  printf ("%10s %10s %12s %14s %14s %16s\n", "terms", "tokens",
+          "instructions", "scan ns/token", "compile ns/tok", "run ns/instr");
+  for (long n = MIN_TERMS; n <= max_terms && sizes < MAX_SIZES;
+       n *= SIZE_FACTOR)
+    {
+      size_t length;
+      char *source = generate_source ((int)n, &length);
+      Program *program = compile_program (&vm, source, length);
+      Chunk chunk;
+      init_chunk (&chunk);
+      if (program == NULL || !compile (&vm, source, length, &chunk))
+        {
+          fprintf (stderr, "The generated source does not compile.\n");
+          return 1;
+        }
+      const long units[STAGE_COUNT]
+          = { count_tokens (source, length), count_tokens (source, length),
+              count_instructions (&chunk) };
+      free_chunk (&chunk);
+
+      for (int stage = 0; stage < STAGE_COUNT; ++stage)
+        {
+          double best = 0.0;
+          for (long run = 0; run < repeat; ++run)
+            {
+              double seconds
+                  = time_stage ((Stage)stage, &vm, source, length, program);
+              if (run == 0 || seconds < best)
+                best = seconds;
+            }
+          cost[stage][sizes] = best * 1e9 / (double)units[stage];
+        }
+
+      printf ("%10ld %10ld %12ld %14.2f %14.2f %16.2f\n", n,
+              units[STAGE_SCAN], units[STAGE_RUN], cost[STAGE_SCAN][sizes],
+              cost[STAGE_COMPILE][sizes], cost[STAGE_RUN][sizes]);
+      terms[sizes++] = n;
+
+      free_program (program);
+      reset_vm (&vm);
+      free (source);
+    }
+
+  // Compare the cost per unit of the smallest and the largest input.
+  const double size_ratio = (double)terms[sizes - 1] / (double)terms[0];
+  for (int stage = 0; stage < STAGE_COUNT && sizes > 1; ++stage)
+    {
+      const double growth = cost[stage][sizes - 1] / cost[stage][0];
+      const double exponent = 1.0 + log (growth) / log (size_ratio);
+      const bool superlinear = exponent > SUPERLINEAR_EXPONENT;
+      printf ("%-8s %-15s scaling exponent %.2f%s\n", stage_names[stage],
+              stage_units[stage], exponent,
+              superlinear ? "  SUPERLINEAR" : "");
+      if (superlinear && strict)
+        ok = false;
+    }
+
+  free_vm (&vm);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+// Measure the throughput of the scanner on a large synthetic source. The
+// source is scanned with every instruction set the CPU supports and the
+// results are checked against each other.
+//
+// Usage: scanner_bench [--size=<MiB>] [--repeat=<n>]
+
+#include "scanner.h"
+#include <lox_scan.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct
+{
+  char *data;
+  size_t length;
+  size_t capacity;
+} Buffer;
+
+static void
+append (Buffer *buffer, const char *text, size_t length)
+{
+  if (buffer->length + length > buffer->capacity)
+    {
+      while (buffer->length + length > buffer->capacity)
+        buffer->capacity = buffer->capacity ? 2 * buffer->capacity : 4096;
+      buffer->data = realloc (buffer->data, buffer->capacity);
+      if (buffer->data == NULL)
+        {
+          fprintf (stderr, "Out of memory.\n");
+          exit (1);
+        }
+    }
+  memcpy (buffer->data + buffer->length, text, length);
+  buffer->length += length;
+}
+
+static void
+append_text (Buffer *buffer, const char *text)
+{
+  append (buffer, text, strlen (text));
+}
+
+static uint32_t
+next_random (uint32_t *state)
+{
+  *state = *state * 1664525u + 1013904223u;
+  return *state >> 8;
+}
+
+static void
+append_words (Buffer *buffer, uint32_t *state, int min, int max)
+{
+  static const char *words[]
+      = { "lorem", "ipsum", "dolor", "sit",  "amet", "scanner",
+          "token", "line",  "of",    "the",  "log",  "processing" };
+  int count = min + (int)(next_random (state) % (uint32_t)(max - min + 1));
+  for (int i = 0; i < count; ++i)
+    {
+      const char *word = words[next_random (state) % 12];
+      append_text (buffer, word);
+      append_text (buffer, " ");
+    }
+}
+
+/**
+ * A source which is mostly comments and long string literals, with some
+ * indented expressions in between.
+ */
+static Buffer
+generate_source (size_t size)
+{
+  Buffer buffer = { 0 };
+  uint32_t state = 42;
+  while (buffer.length < size)
+    {
+      switch (next_random (&state) % 4)
+        {
+        case 0:
+          append_text (&buffer, "// ");
+          append_words (&buffer, &state, 8, 20);
+          append_text (&buffer, "\n");
+          break;
+        case 1:
+          append_text (&buffer, "\"");
+          append_words (&buffer, &state, 10, 40);
+          append_text (&buffer, "\n");
+          append_words (&buffer, &state, 0, 20);
+          append_text (&buffer, "\" + \"");
+          append_words (&buffer, &state, 1, 5);
+          append_text (&buffer, "\"\n");
+          break;
+        case 2:
+          append_text (&buffer,
+                       "        \t  (1.5 + 22) * -3 >= 4 == !true\r\n");
+          break;
+        default:
+          append_text (&buffer, "\n      \n  \t    \n");
+          break;
+        }
+    }
+  return buffer;
+}
+
+typedef struct
+{
+  long tokens;
+  long errors;
+  long checksum;
+  int last_line;
+} ScanResult;
+
+static ScanResult
+scan_all (const Buffer *source)
+{
+  ScanResult result = { 0 };
+  Scanner scanner;
+  init_scanner (&scanner, source->data, source->length);
+  for (;;)
+    {
+      Token token = scan_token (&scanner);
+      if (token.type == TOKEN_EOF)
+        {
+          result.last_line = token.line;
+          break;
+        }
+      result.tokens++;
+      if (token.type == TOKEN_ERROR)
+        result.errors++;
+      result.checksum += token.type + token.length + token.line;
+    }
+  return result;
+}
+
+static double
+seconds_since (const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec)
+         + (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static const char *
+level_name (LoxScanLevel level)
+{
+  switch (level)
+    {
+    case LOX_SCAN_SCALAR:
+      return "scalar";
+    case LOX_SCAN_SSE2:
+      return "sse2";
+    case LOX_SCAN_AVX2:
+      return "avx2";
+    }
+  return "unknown";
+}
+
+int
+main (int argc, char **argv)
+{
+  long size_mib = 64;
+  long repeat = 3;
+  for (int i = 1; i < argc; ++i)
+    {
+      if (strncmp (argv[i], "--size=", 7) == 0)
+        size_mib = strtol (argv[i] + 7, NULL, 10);
+      else if (strncmp (argv[i], "--repeat=", 9) == 0)
+        repeat = strtol (argv[i] + 9, NULL, 10);
+      else
+        {
+          fprintf (stderr, "Usage: %s [--size=<MiB>] [--repeat=<n>]\n",
+                   argv[0]);
+          return 64;
+        }
+    }
+  if (size_mib < 1 || repeat < 1)
+    {
+      fprintf (stderr, "Size and repeat must be positive.\n");
+      return 64;
+    }
+
+  Buffer source = generate_source ((size_t)size_mib << 20);
+  double mib = (double)source.length / (1 << 20);
+  printf ("scanning %.1f MiB, best of %ld runs\n", mib, repeat);
+
+  bool ok = true;
+  ScanResult reference = { 0 };
+  const LoxScanLevel supported = lox_scan_supported_level ();
+  for (int level = LOX_SCAN_SCALAR; level <= (int)supported; ++level)
+    {
+      lox_scan_set_level ((LoxScanLevel)level);
+      double best = 0.0;
+      ScanResult result = { 0 };
+      for (long run = 0; run < repeat; ++run)
+        {
+          struct timespec start;
+          clock_gettime (CLOCK_MONOTONIC, &start);
+          result = scan_all (&source);
+          double elapsed = seconds_since (&start);
+          if (run == 0 || elapsed < best)
+            best = elapsed;
+        }
+
+      printf ("%-8s %10.1f MiB/s  %ld tokens, %d lines\n",
+              level_name ((LoxScanLevel)level), mib / best, result.tokens,
+              result.last_line);
+
+      if (level == LOX_SCAN_SCALAR)
+        reference = result;
+      else if (result.tokens != reference.tokens
+               || result.checksum != reference.checksum
+               || result.last_line != reference.last_line)
+        {
+          fprintf (stderr, "%s scanner disagrees with the scalar one.\n",
+                   level_name ((LoxScanLevel)level));
+          ok = false;
+        }
+    }
+
+  if (reference.errors != 0)
+    {
+      fprintf (stderr, "Unexpected error tokens: %ld\n", reference.errors);
+      ok = false;
+    }
+
+  free (source.data);
+  return ok ? 0 : 1;
+}
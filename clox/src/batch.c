@@ -0,0 +1,355 @@
+#include "batch.h"
+#include "vm.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <lox_source.h>
+#include <lox_writer.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct
+{
+  char *path;
+  // Exit status the clox executable would report for this script alone.
+  int status;
+  double milliseconds;
+  // Everything the script wrote to standard output and standard error.
+  char *output;
+  size_t output_length;
+} Script;
+
+typedef struct
+{
+  int count;
+  int capacity;
+  Script *scripts;
+} ScriptList;
+
+/**
+ * The scripts a worker still has to run. Since no new work is created while
+ * the batch runs, this is a range of indices into the script list. The owner
+ * takes scripts from the front, other workers steal from the back.
+ */
+typedef struct
+{
+  pthread_mutex_t lock;
+  int front;
+  int back;
+} WorkQueue;
+
+typedef struct
+{
+  Script *scripts;
+  WorkQueue *queues;
+  int workers;
+  CommandLineOptions options;
+} Batch;
+
+typedef struct
+{
+  Batch *batch;
+  int id;
+  pthread_t thread;
+  bool started;
+} Worker;
+
+static void
+add_script (ScriptList *list, const char *path)
+{
+  if (list->count == list->capacity)
+    {
+      list->capacity = list->capacity ? 2 * list->capacity : 16;
+      list->scripts
+          = realloc (list->scripts, list->capacity * sizeof (Script));
+      if (list->scripts == NULL)
+        {
+          fprintf (stderr, "Out of memory.\n");
+          exit (1);
+        }
+    }
+  Script *script = &list->scripts[list->count++];
+  memset (script, 0, sizeof (Script));
+  script->path = strdup (path);
+}
+
+static int
+compare_names (const void *lhs, const void *rhs)
+{
+  return strcmp (*(char *const *)lhs, *(char *const *)rhs);
+}
+
+static bool
+has_lox_extension (const char *name)
+{
+  size_t length = strlen (name);
+  return length > 4 && strcmp (name + length - 4, ".lox") == 0;
+}
+
+/**
+ * Add all .lox files in @p directory in alphabetical order.
+ */
+static void
+add_directory (ScriptList *list, const char *directory)
+{
+  DIR *dir = opendir (directory);
+  if (dir == NULL)
+    {
+      // Report the error for this path like for an unreadable script.
+      add_script (list, directory);
+      return;
+    }
+
+  int count = 0;
+  int capacity = 0;
+  char **names = NULL;
+  struct dirent *entry;
+  while ((entry = readdir (dir)) != NULL)
+    {
+      if (!has_lox_extension (entry->d_name))
+        continue;
+      if (count == capacity)
+        {
+          capacity = capacity ? 2 * capacity : 16;
+          names = realloc (names, capacity * sizeof (char *));
+          if (names == NULL)
+            {
+              fprintf (stderr, "Out of memory.\n");
+              exit (1);
+            }
+        }
+      names[count++] = strdup (entry->d_name);
+    }
+  closedir (dir);
+
+  qsort (names, count, sizeof (char *), compare_names);
+  for (int i = 0; i < count; ++i)
+    {
+      size_t length = strlen (directory) + strlen (names[i]) + 2;
+      char *path = malloc (length);
+      snprintf (path, length, "%s/%s", directory, names[i]);
+      add_script (list, path);
+      free (path);
+      free (names[i]);
+    }
+  free (names);
+}
+
+static bool
+take_front (WorkQueue *queue, int *index)
+{
+  pthread_mutex_lock (&queue->lock);
+  bool found = queue->front < queue->back;
+  if (found)
+    *index = queue->front++;
+  pthread_mutex_unlock (&queue->lock);
+  return found;
+}
+
+static bool
+take_back (WorkQueue *queue, int *index)
+{
+  pthread_mutex_lock (&queue->lock);
+  bool found = queue->front < queue->back;
+  if (found)
+    *index = --queue->back;
+  pthread_mutex_unlock (&queue->lock);
+  return found;
+}
+
+/**
+ * Find the next script for worker @p id. Its own queue comes first, then the
+ * other queues are searched for work to steal.
+ */
+static bool
+next_script (Batch *batch, int id, int *index)
+{
+  if (take_front (&batch->queues[id], index))
+    return true;
+  for (int i = 1; i < batch->workers; ++i)
+    if (take_back (&batch->queues[(id + i) % batch->workers], index))
+      return true;
+  return false;
+}
+
+static double
+milliseconds_since (const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) * 1e3
+         + (double)(now.tv_nsec - start->tv_nsec) * 1e-6;
+}
+
+static int
+exit_status (InterpretResult result)
+{
+  switch (result)
+    {
+    case INTERPRET_COMPILE_ERROR:
+      return 65;
+    case INTERPRET_RUNTIME_ERROR:
+      return 70;
+    default:
+      return 0;
+    }
+}
+
+/**
+ * Run @p script in a fresh VM. All of its output is captured in memory.
+ */
+static void
+run_script (Script *script, CommandLineOptions options, LoxWriter *writer)
+{
+  struct timespec start;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  FILE *capture = open_memstream (&script->output, &script->output_length);
+  if (capture == NULL)
+    {
+      script->status = 74;
+      return;
+    }
+
+  LoxSource source;
+  if (!lox_source_open (&source, script->path))
+    {
+      fprintf (capture, "Could not read file \"%s\": %s.\n", script->path,
+               strerror (errno));
+      script->status = 74;
+    }
+  else
+    {
+      VM vm;
+      init_vm (&vm, options);
+      lox_writer_init (writer, capture);
+      vm.out = writer;
+      vm.err = capture;
+      script->status
+          = exit_status (interpret (&vm, source.data, source.length));
+      lox_writer_flush (writer);
+      free_vm (&vm);
+      lox_source_close (&source);
+    }
+
+  fclose (capture);
+  script->milliseconds = milliseconds_since (&start);
+}
+
+static void *
+run_worker (void *arg)
+{
+  Worker *worker = arg;
+  Batch *batch = worker->batch;
+  LoxWriter *writer = malloc (sizeof (LoxWriter));
+  if (writer == NULL)
+    return NULL;
+
+  int index;
+  while (next_script (batch, worker->id, &index))
+    run_script (&batch->scripts[index], batch->options, writer);
+
+  free (writer);
+  return NULL;
+}
+
+/**
+ * Run all scripts on @p workers threads. Each worker starts with an equal
+ * share of consecutive scripts.
+ */
+static void
+run_scripts (ScriptList *list, CommandLineOptions options, int workers)
+{
+  Batch batch = { .scripts = list->scripts,
+                  .queues = calloc (workers, sizeof (WorkQueue)),
+                  .workers = workers,
+                  .options = options };
+  Worker *pool = calloc (workers, sizeof (Worker));
+  if (batch.queues == NULL || pool == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+
+  for (int w = 0; w < workers; ++w)
+    {
+      WorkQueue *queue = &batch.queues[w];
+      pthread_mutex_init (&queue->lock, NULL);
+      queue->front = (int)((long)list->count * w / workers);
+      queue->back = (int)((long)list->count * (w + 1) / workers);
+    }
+
+  // The calling thread is the first worker. If a thread cannot be started,
+  // its scripts are stolen by the others.
+  for (int w = 0; w < workers; ++w)
+    {
+      pool[w].batch = &batch;
+      pool[w].id = w;
+      if (w > 0)
+        pool[w].started
+            = pthread_create (&pool[w].thread, NULL, run_worker, &pool[w])
+              == 0;
+    }
+  run_worker (&pool[0]);
+  for (int w = 1; w < workers; ++w)
+    if (pool[w].started)
+      pthread_join (pool[w].thread, NULL);
+
+  for (int w = 0; w < workers; ++w)
+    pthread_mutex_destroy (&batch.queues[w].lock);
+  free (batch.queues);
+  free (pool);
+}
+
+int
+run_batch (char *const *paths, int count, CommandLineOptions options,
+           int jobs)
+{
+  struct timespec start;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  ScriptList list = { 0 };
+  for (int i = 0; i < count; ++i)
+    {
+      struct stat info;
+      if (stat (paths[i], &info) == 0 && S_ISDIR (info.st_mode))
+        add_directory (&list, paths[i]);
+      else
+        add_script (&list, paths[i]);
+    }
+
+  int workers = jobs > 0 ? jobs : (int)sysconf (_SC_NPROCESSORS_ONLN);
+  if (workers > list.count)
+    workers = list.count;
+  if (workers < 1)
+    workers = 1;
+  run_scripts (&list, options, workers);
+
+  LoxWriter *out = lox_stdout ();
+  int failed = 0;
+  for (int i = 0; i < list.count; ++i)
+    {
+      Script *script = &list.scripts[i];
+      lox_writer_printf (out, "== %s ==\n", script->path);
+      if (script->output != NULL)
+        lox_writer_write (out, script->output, script->output_length);
+      lox_writer_printf (out, "== %s: exit %d in %.3f ms ==\n", script->path,
+                         script->status, script->milliseconds);
+      if (script->status != 0)
+        failed++;
+      free (script->output);
+      free (script->path);
+    }
+  lox_writer_printf (out, "== %d scripts, %d failed in %.3f ms ==\n",
+                     list.count, failed, milliseconds_since (&start));
+  lox_writer_flush (out);
+
+  free (list.scripts);
+  return failed == 0 ? 0 : 1;
+}
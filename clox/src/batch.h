@@ -0,0 +1,16 @@
+#pragma once
+
+#include "common.h"
+
+/**
+ * Run many scripts in a single process. Each of the @p count @p paths is a
+ * script or a directory, which stands for all .lox files in it. Every script
+ * runs in its own VM with the given @p options. The scripts are distributed
+ * over @p jobs threads, or one thread per CPU if @p jobs is zero.
+ *
+ * The captured output, exit status and run time of every script are written
+ * to standard output in the order of @p paths. Returns 0 if all scripts
+ * succeeded and 1 otherwise.
+ */
+int run_batch (char *const *paths, int count, CommandLineOptions options,
+               int jobs);
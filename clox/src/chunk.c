@@ -1,6 +1,12 @@
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "value.h"
+#include <string.h>
+
+// Chunks are created by VMs on different threads, so this is only accessed
+// atomically.
+static uint64_t next_chunk_id = 1;
 
 void
 init_chunk (Chunk *chunk)
@@ -10,6 +16,9 @@ init_chunk (Chunk *chunk)
   chunk->code = NULL;
   chunk->lines = NULL;
   init_value_array (&chunk->constants);
+  chunk->objects = NULL;
+  chunk->id = __atomic_fetch_add (&next_chunk_id, 1, __ATOMIC_RELAXED);
+  chunk->shared = false;
 }
 
 void
@@ -35,6 +44,7 @@ free_chunk (Chunk *chunk)
   FREE_ARRAY (uint8_t, chunk->code, chunk->capacity);
   FREE_ARRAY (int, chunk->lines, chunk->capacity);
   free_value_array (&chunk->constants);
+  free_objects (chunk->objects);
   init_chunk (chunk);
 }
 
@@ -44,3 +54,190 @@ add_constant (Chunk *chunk, Value value)
   write_value_array (&chunk->constants, value);
   return chunk->constants.count - 1;
 }
+
+static bool
+is_forward_jump (uint8_t instruction)
+{
+  return instruction != OP_LOOP_LONG;
+}
+
+int
+instruction_size (const Chunk *chunk, int offset)
+{
+  switch (chunk->code[offset])
+    {
+    case OP_CONSTANT:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+    case OP_CALL:
+    case OP_R_NIL:
+    case OP_R_TRUE:
+    case OP_R_FALSE:
+    case OP_R_CLOSE_UPVALUE:
+    case OP_R_PRINT:
+    case OP_R_RETURN:
+      return 2;
+    case OP_GET_GLOBAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE_LONG:
+    case OP_LOOP_LONG:
+    case OP_R_MOVE:
+    case OP_R_CONSTANT:
+    case OP_R_GET_UPVALUE:
+    case OP_R_SET_UPVALUE:
+    case OP_R_NOT:
+    case OP_R_NEGATE:
+    case OP_R_JUMP:
+    case OP_R_LOOP:
+    case OP_R_CALL:
+      return 3;
+    case OP_R_GET_GLOBAL:
+    case OP_R_DEFINE_GLOBAL:
+    case OP_R_SET_GLOBAL:
+    case OP_R_EQUAL:
+    case OP_R_GREATER:
+    case OP_R_LESS:
+    case OP_R_ADD:
+    case OP_R_SUBTRACT:
+    case OP_R_MULTIPLY:
+    case OP_R_DIVIDE:
+    case OP_R_JUMP_IF_FALSE:
+      return 4;
+    case OP_CLOSURE:
+    case OP_R_CLOSURE:
+      {
+        // The constant index is the last operand before the upvalues.
+        int size = chunk->code[offset] == OP_CLOSURE ? 2 : 3;
+        const ObjFunction *function = AS_FUNCTION (
+            chunk->constants.values[chunk->code[offset + size - 1]]);
+        return size + 2 * function->upvalue_count;
+      }
+    default:
+      return 1;
+    }
+}
+
+static int
+read_long_operand (const Chunk *chunk, int jump)
+{
+  return (chunk->code[jump + 1] << 8) | chunk->code[jump + 2];
+}
+
+/**
+ * The offset of the instruction at @p offset after shortening. @p saved[i] is
+ * the number of bytes saved by the jumps before jumps[i].
+ */
+static int
+relocate (int offset, const int *jumps, const int *saved, int count)
+{
+  // Find the first jump at or after offset.
+  int low = 0;
+  int high = count;
+  while (low < high)
+    {
+      int mid = (low + high) / 2;
+      if (jumps[mid] < offset)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+  return offset - saved[low];
+}
+
+void
+shorten_jumps (Chunk *chunk, const int *jumps, int count)
+{
+  if (count == 0)
+    return;
+
+  int *targets = ALLOCATE (int, count);
+  bool *is_short = ALLOCATE (bool, count);
+  int *saved = ALLOCATE (int, count + 1);
+  for (int i = 0; i < count; ++i)
+    {
+      int jump = jumps[i];
+      int operand = read_long_operand (chunk, jump);
+      targets[i] = is_forward_jump (chunk->code[jump]) ? jump + 3 + operand
+                                                       : jump + 3 - operand;
+      is_short[i] = false;
+    }
+
+  // Shortening a jump only brings other jumps closer to their targets. So
+  // repeat until no more jumps can be shortened.
+  for (bool changed = true; changed;)
+    {
+      changed = false;
+      saved[0] = 0;
+      for (int i = 0; i < count; ++i)
+        saved[i + 1] = saved[i] + (is_short[i] ? 1 : 0);
+      for (int i = 0; i < count; ++i)
+        {
+          if (is_short[i])
+            continue;
+          int next = relocate (jumps[i], jumps, saved, count) + 2;
+          int target = relocate (targets[i], jumps, saved, count);
+          // A forward jump moves its target closer once it is short itself.
+          int offset = targets[i] > jumps[i] ? target - 1 - next
+                                             : next - target;
+          if (offset <= UINT8_MAX)
+            {
+              is_short[i] = true;
+              changed = true;
+            }
+        }
+    }
+
+  int new_capacity = chunk->count - saved[count];
+  uint8_t *code = ALLOCATE (uint8_t, new_capacity);
+  int *lines = ALLOCATE (int, new_capacity);
+  int from = 0;
+  int to = 0;
+  for (int i = 0; i <= count; ++i)
+    {
+      // Copy everything up to the next jump unchanged.
+      int end = i < count ? jumps[i] : chunk->count;
+      memcpy (code + to, chunk->code + from, end - from);
+      memcpy (lines + to, chunk->lines + from, (end - from) * sizeof (int));
+      to += end - from;
+      from = end;
+      if (i == count)
+        break;
+
+      uint8_t instruction = chunk->code[from];
+      int size = is_short[i] ? 2 : 3;
+      int target = relocate (targets[i], jumps, saved, count);
+      int offset = is_forward_jump (instruction) ? target - (to + size)
+                                                 : to + size - target;
+      // The short form of every jump precedes its long form.
+      code[to] = is_short[i] ? instruction - 1 : instruction;
+      if (is_short[i])
+        code[to + 1] = (uint8_t)offset;
+      else
+        {
+          code[to + 1] = (offset >> 8) & 0xff;
+          code[to + 2] = offset & 0xff;
+        }
+      for (int b = 0; b < size; ++b)
+        lines[to + b] = chunk->lines[from];
+      to += size;
+      from += 3;
+    }
+
+  FREE_ARRAY (uint8_t, chunk->code, chunk->capacity);
+  FREE_ARRAY (int, chunk->lines, chunk->capacity);
+  chunk->code = code;
+  chunk->lines = lines;
+  chunk->count = new_capacity;
+  chunk->capacity = new_capacity;
+
+  FREE_ARRAY (int, targets, count);
+  FREE_ARRAY (bool, is_short, count);
+  FREE_ARRAY (int, saved, count + 1);
+}
@@ -9,6 +9,19 @@ typedef enum
   OP_NIL,
   OP_TRUE,
   OP_FALSE,
+  OP_POP,
+  // Operand: stack slot of the local variable.
+  OP_GET_LOCAL,
+  OP_SET_LOCAL,
+  // Operand: 16-bit index into the globals of the VM, high byte first.
+  OP_GET_GLOBAL,
+  OP_DEFINE_GLOBAL,
+  OP_SET_GLOBAL,
+  // Operand: index into the upvalues of the running closure.
+  OP_GET_UPVALUE,
+  OP_SET_UPVALUE,
+  // Pop the captured local on top of the stack and close its upvalue.
+  OP_CLOSE_UPVALUE,
   OP_EQUAL,
   OP_GREATER,
   OP_LESS,
@@ -16,9 +29,83 @@ typedef enum
   OP_SUBTRACT,
   OP_MULTIPLY,
   OP_DIVIDE,
+  // Specialized forms which the VM writes over OP_ADD and OP_LESS once it has
+  // seen the types of their operands. They check only these types and turn
+  // back into the generic instruction when the check fails. The compiler
+  // never emits them.
+  OP_ADD_NUM,
+  OP_ADD_STR,
+  OP_LESS_NUM,
   OP_NOT,
   OP_NEGATE,
+  OP_PRINT,
+  // Jumps come in a short form with an 8-bit operand and a long form with a
+  // 16-bit operand, high byte first. The compiler emits the long forms and
+  // shorten_jumps() picks the short ones where the offset fits.
+  // Operand: forward offset from the next instruction.
+  OP_JUMP,
+  OP_JUMP_LONG,
+  // Jump if the value on top of the stack is falsey. It is not popped.
+  OP_JUMP_IF_FALSE,
+  OP_JUMP_IF_FALSE_LONG,
+  // Operand: backward offset from the next instruction.
+  OP_LOOP,
+  OP_LOOP_LONG,
+  // Operand: number of arguments. The callee is below them on the stack.
+  OP_CALL,
+  // Operand: constant index of the function, followed by two bytes for each
+  // upvalue: 1 if it captures a local of the enclosing function and 0 if it
+  // is an upvalue of the enclosing closure, then the slot or index.
+  OP_CLOSURE,
   OP_RETURN,
+  // Register instructions, which replace all of the above if clox is built
+  // with CLOX_REGISTER_VM, see register.h. Registers are the slots of the
+  // frame. Unless noted otherwise, operands are registers and the result
+  // comes first. 16-bit operands are stored high byte first.
+  // Operands: result, source.
+  OP_R_MOVE,
+  // Operands: result, constant index.
+  OP_R_CONSTANT,
+  // Operand: result.
+  OP_R_NIL,
+  OP_R_TRUE,
+  OP_R_FALSE,
+  // Operands: result or source, 16-bit index of the global.
+  OP_R_GET_GLOBAL,
+  OP_R_DEFINE_GLOBAL,
+  OP_R_SET_GLOBAL,
+  // Operands: result or source, index of the upvalue.
+  OP_R_GET_UPVALUE,
+  OP_R_SET_UPVALUE,
+  // Operand: the captured local.
+  OP_R_CLOSE_UPVALUE,
+  // Operands: result, left operand, right operand.
+  OP_R_EQUAL,
+  OP_R_GREATER,
+  OP_R_LESS,
+  OP_R_ADD,
+  OP_R_SUBTRACT,
+  OP_R_MULTIPLY,
+  OP_R_DIVIDE,
+  // Operands: result, operand.
+  OP_R_NOT,
+  OP_R_NEGATE,
+  // Operand: the value.
+  OP_R_PRINT,
+  // Operand: 16-bit forward offset from the next instruction.
+  OP_R_JUMP,
+  // Operands: the condition, 16-bit forward offset.
+  OP_R_JUMP_IF_FALSE,
+  // Operand: 16-bit backward offset from the next instruction.
+  OP_R_LOOP,
+  // Operands: the callee, number of arguments. The arguments are in the
+  // registers after the callee, which receives the result.
+  OP_R_CALL,
+  // Operands: result, constant index of the function, then the upvalues
+  // like for OP_CLOSURE.
+  OP_R_CLOSURE,
+  // Operand: the result. The script ignores it.
+  OP_R_RETURN,
 } OpCode;
 
 typedef struct
@@ -28,11 +115,48 @@ typedef struct
   uint8_t *code;
   int *lines;
   ValueArray constants;
+  // Linked list of the objects referenced by constants. They belong to the
+  // chunk, so it can be run by any VM.
+  Obj *objects;
+  // Unique among all chunks of the process, unlike their addresses which are
+  // reused after a chunk is freed.
+  uint64_t id;
+  // Set for the code of programs, which several VMs may run at the same
+  // time. It is never rewritten, see rewrite_opcode().
+  bool shared;
 } Chunk;
 
 void init_chunk (Chunk *chunk);
 void write_chunk (Chunk *chunk, uint8_t byte, int line);
+/// Free the chunk together with the objects of its constants.
 void free_chunk (Chunk *chunk);
 
+/**
+ * Replace the opcode at @p ip of @p chunk by a specialized or generic form of
+ * the same instruction. All forms have the same operands and results. Shared
+ * chunks keep their generic instructions: other VMs may read them at the same
+ * time, and the dispatch loop reads opcodes with plain loads.
+ */
+static inline void
+rewrite_opcode (const Chunk *chunk, const uint8_t *ip, OpCode opcode)
+{
+  if (!chunk->shared)
+    chunk->code[ip - chunk->code] = (uint8_t)opcode;
+}
+
 /// Add constant and return an index for later retrieval.
 int add_constant (Chunk *chunk, Value value);
+
+/**
+ * The number of bytes of the instruction at @p offset of @p chunk, including
+ * its operands. This is the only place which knows the operand layout of
+ * every instruction.
+ */
+int instruction_size (const Chunk *chunk, int offset);
+
+/**
+ * Replace long jumps by their short form where the offset fits into 8 bits.
+ * @p jumps are the offsets of all jump instructions in @p chunk in ascending
+ * order. All of them must be in the long form and have their final targets.
+ */
+void shorten_jumps (Chunk *chunk, const int *jumps, int count);
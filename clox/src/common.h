@@ -4,6 +4,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#define UINT8_COUNT (UINT8_MAX + 1)
+
 /**
  * Options that can be passed to the command line and modify clox behavior.
  */
@@ -13,8 +15,6 @@ typedef enum
   OPT_TOKENS = 2,
   OPT_DISASSEMBLE = 4,
   OPT_NO_EXECUTION = 8,
+  // Compile hot chunks to machine code where this is supported.
+  OPT_JIT = 16,
 } CommandLineOptions;
-
-bool is_option_set (CommandLineOptions option);
-
-void set_option (CommandLineOptions options);
@@ -1,24 +1,80 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "common.h"
 #include "compiler.h"
 #include "object.h"
+#include "register.h"
 #include "scanner.h"
 #include "value.h"
 
 #include "debug.h"
+#include "memory.h"
+
+#include <lox_number.h>
+#include <lox_writer.h>
 
 #define DEBUG_PRINT_TOKENS
 
 typedef struct
 {
+  Token name;
+  // Nesting depth of the declaring block. -1 until the initializer has been
+  // compiled.
+  int depth;
+  // Whether a closure captures the variable, so its upvalue must be closed
+  // when it goes out of scope.
+  bool is_captured;
+} Local;
+
+typedef struct
+{
+  // Stack slot of the local or index of the upvalue in the enclosing
+  // function.
+  uint8_t index;
+  bool is_local;
+} Upvalue;
+
+/**
+ * The state of compiling one function or the script. The local variables in
+ * scope are kept in the order of the stack slots they occupy at run time.
+ */
+typedef struct Compiler
+{
+  struct Compiler *enclosing;
+  // The function being compiled, NULL for the script.
+  ObjFunction *function;
+  Local locals[UINT8_COUNT];
+  int local_count;
+  Upvalue upvalues[UINT8_COUNT];
+  // Zero at the top level, where variables are global.
+  int scope_depth;
+  // Offsets of all jump instructions in ascending order. They are emitted in
+  // their long form and shortened once the chunk is complete.
+  int *jumps;
+  int jump_count;
+  int jump_capacity;
+} Compiler;
+
+/**
+ * All state of a single compilation. Nothing is shared between parsers, so
+ * several sources may be compiled at the same time.
+ */
+typedef struct
+{
+  Scanner scanner;
   Token current;
   Token previous;
   bool had_error;
   bool panic_mode;
+  // The chunk receiving the bytecode of the script.
+  Chunk *chunk;
+  Compiler *compiler;
+  // Provides the options and receives all output.
+  VM *vm;
 } Parser;
 
 typedef enum
@@ -36,7 +92,7 @@ typedef enum
   PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn) ();
+typedef void (*ParseFn) (Parser *parser, bool can_assign);
 
 typedef struct
 {
@@ -45,33 +101,26 @@ typedef struct
   Precedence precedence;
 } ParseRule;
 
-Parser parser;
-Chunk *compiling_chunk;
-
 static Chunk *
-current_chunk ()
-{
-  return compiling_chunk;
-}
-
-void
-init_parser ()
+current_chunk (Parser *parser)
 {
-  parser.had_error = false;
-  parser.panic_mode = false;
+  ObjFunction *function = parser->compiler->function;
+  return function != NULL ? &function->chunk : parser->chunk;
 }
 
 static void
-error_at (Token *token, const char *message)
+error_at (Parser *parser, Token *token, const char *message)
 {
-  if (parser.panic_mode)
+  if (parser->panic_mode)
     return;
-  parser.panic_mode = true;
-  fprintf (stderr, "[line %d] Error", token->line);
+  parser->panic_mode = true;
+  // Keep the order of regular output and error messages.
+  lox_writer_flush (parser->vm->out);
+  fprintf (parser->vm->err, "[line %d] Error", token->line);
 
   if (token->type == TOKEN_EOF)
     {
-      fprintf (stderr, " at end");
+      fprintf (parser->vm->err, " at end");
     }
   else if (token->type == TOKEN_ERROR)
     {
@@ -79,135 +128,277 @@ error_at (Token *token, const char *message)
     }
   else
     {
-      fprintf (stderr, " at '%.*s'", token->length, token->start);
+      fprintf (parser->vm->err, " at '%.*s'", token->length, token->start);
     }
 
-  fprintf (stderr, ": %s\n", message);
-  parser.had_error = true;
+  fprintf (parser->vm->err, ": %s\n", message);
+  parser->had_error = true;
 }
 
 static void
-error (const char *message)
+error (Parser *parser, const char *message)
 {
-  error_at (&parser.previous, message);
+  error_at (parser, &parser->previous, message);
 }
 
 static void
-error_at_current (const char *message)
+error_at_current (Parser *parser, const char *message)
 {
-  error_at (&parser.current, message);
+  error_at (parser, &parser->current, message);
 }
 
 static void
-advance ()
+advance (Parser *parser)
 {
-  parser.previous = parser.current;
+  parser->previous = parser->current;
   for (;;)
     {
-      parser.current = scan_token ();
-      if (parser.current.type != TOKEN_ERROR)
+      parser->current = scan_token (&parser->scanner);
+      if (parser->current.type != TOKEN_ERROR)
         break;
-      error_at_current (parser.current.start);
+      error_at_current (parser, parser->current.start);
     }
 }
 
 static void
-consume (TokenType type, const char *message)
+consume (Parser *parser, TokenType type, const char *message)
 {
-  if (parser.current.type == type)
+  if (parser->current.type == type)
     {
-      advance ();
+      advance (parser);
       return;
     }
-  error_at_current (message);
+  error_at_current (parser, message);
+}
+
+static bool
+check (Parser *parser, TokenType type)
+{
+  return parser->current.type == type;
+}
+
+static bool
+match (Parser *parser, TokenType type)
+{
+  if (!check (parser, type))
+    return false;
+  advance (parser);
+  return true;
+}
+
+static void
+emit_byte (Parser *parser, uint8_t byte)
+{
+  write_chunk (current_chunk (parser), byte, parser->previous.line);
+}
+
+static void
+emit_bytes (Parser *parser, uint8_t byte1, uint8_t byte2)
+{
+  emit_byte (parser, byte1);
+  emit_byte (parser, byte2);
+}
+
+static void
+emit_short (Parser *parser, uint8_t instruction, uint16_t operand)
+{
+  emit_byte (parser, instruction);
+  emit_bytes (parser, (operand >> 8) & 0xff, operand & 0xff);
+}
+
+static void
+add_jump (Parser *parser, int offset)
+{
+  Compiler *compiler = parser->compiler;
+  if (compiler->jump_capacity < compiler->jump_count + 1)
+    {
+      int old_capacity = compiler->jump_capacity;
+      compiler->jump_capacity = GROW_CAPACITY (old_capacity);
+      compiler->jumps = GROW_ARRAY (int, compiler->jumps, old_capacity,
+                                    compiler->jump_capacity);
+    }
+  compiler->jumps[compiler->jump_count++] = offset;
+}
+
+/**
+ * Emit a forward jump with a placeholder offset. Returns the offset of the
+ * instruction for patch_jump().
+ */
+static int
+emit_jump (Parser *parser, uint8_t instruction)
+{
+  int offset = current_chunk (parser)->count;
+  add_jump (parser, offset);
+  emit_short (parser, instruction, 0xffff);
+  return offset;
 }
 
+/**
+ * Let the jump at @p offset continue at the next instruction emitted.
+ */
 static void
-emit_byte (uint8_t byte)
+patch_jump (Parser *parser, int offset)
 {
-  write_chunk (current_chunk (), byte, parser.previous.line);
+  Chunk *chunk = current_chunk (parser);
+  int jump = chunk->count - offset - 3;
+  if (jump > UINT16_MAX)
+    error (parser, "Too much code to jump over.");
+  chunk->code[offset + 1] = (jump >> 8) & 0xff;
+  chunk->code[offset + 2] = jump & 0xff;
 }
 
 static void
-emit_bytes (uint8_t byte1, uint8_t byte2)
+emit_loop (Parser *parser, int loop_start)
 {
-  emit_byte (byte1);
-  emit_byte (byte2);
+  add_jump (parser, current_chunk (parser)->count);
+  int offset = current_chunk (parser)->count + 3 - loop_start;
+  if (offset > UINT16_MAX)
+    error (parser, "Loop body too large.");
+  emit_short (parser, OP_LOOP_LONG, (uint16_t)offset);
 }
 
 static void
-emit_return ()
+emit_return (Parser *parser)
 {
-  emit_byte (OP_RETURN);
+  // Functions return nil without a return statement. The script returns
+  // nothing.
+  if (parser->compiler->function != NULL)
+    emit_byte (parser, OP_NIL);
+  emit_byte (parser, OP_RETURN);
 }
 
 static uint8_t
-make_constant (Value value)
+make_constant (Parser *parser, Value value)
 {
-  int constant = add_constant (current_chunk (), value);
+  int constant = add_constant (current_chunk (parser), value);
   if (constant > UINT8_MAX)
     {
-      error ("Too many constants in one chunk.");
+      error (parser, "Too many constants in one chunk.");
       return 0;
     }
   return (uint8_t)constant;
 }
 
 static void
-emit_constant (Value value)
+emit_constant (Parser *parser, Value value)
 {
   // Store the index into the constant array of the current chunk.
-  emit_bytes (OP_CONSTANT, make_constant (value));
+  emit_bytes (parser, OP_CONSTANT, make_constant (parser, value));
+}
+
+/**
+ * Finish the current function and return to the enclosing one. Returns the
+ * function, which is NULL for the script.
+ */
+static ObjFunction *
+end_compiler (Parser *parser)
+{
+  emit_return (parser);
+  Compiler *compiler = parser->compiler;
+  // Unpatched jumps are left behind by syntax errors.
+  if (!parser->had_error)
+    shorten_jumps (current_chunk (parser), compiler->jumps,
+                   compiler->jump_count);
+  FREE_ARRAY (int, compiler->jumps, compiler->jump_capacity);
+
+  ObjFunction *function = compiler->function;
+#ifdef CLOX_REGISTER_VM
+  if (!parser->had_error)
+    {
+      const char *message = translate_to_registers (
+          current_chunk (parser), function != NULL ? function->arity + 1 : 0);
+      if (message != NULL)
+        error (parser, message);
+    }
+#endif
+  if ((parser->vm->options & OPT_DISASSEMBLE) && !parser->had_error)
+    {
+      if (function != NULL)
+        disassemble_chunk (parser->vm->out, &function->chunk,
+                           function->name->chars);
+      else
+        disassemble_chunk (parser->vm->out, parser->chunk, "code");
+    }
+
+  parser->compiler = compiler->enclosing;
+  return function;
 }
 
+/**
+ * Start compiling a function named by the previous token, or the script if
+ * @p is_function is false.
+ */
 static void
-end_compiler ()
+init_compiler (Parser *parser, Compiler *compiler, bool is_function)
 {
-  emit_return ();
+  compiler->enclosing = parser->compiler;
+  compiler->function = NULL;
+  compiler->local_count = 0;
+  compiler->scope_depth = 0;
+  compiler->jumps = NULL;
+  compiler->jump_count = 0;
+  compiler->jump_capacity = 0;
+  if (is_function)
+    {
+      // The function is a constant of the enclosing chunk and owned by it.
+      compiler->function
+          = new_function (&current_chunk (parser)->objects,
+                          parser->previous.start, parser->previous.length);
+      // The first slot holds the callee and has no name.
+      Local *local = &compiler->locals[compiler->local_count++];
+      local->depth = 0;
+      local->is_captured = false;
+      local->name.start = "";
+      local->name.length = 0;
+    }
+  parser->compiler = compiler;
 }
 
-static void expression ();
-static ParseRule *get_rule (TokenType type);
-static void parse_precedence (Precedence precedence);
+static void expression (Parser *parser);
+static void statement (Parser *parser);
+static void declaration (Parser *parser);
+static const ParseRule *get_rule (TokenType type);
+static void parse_precedence (Parser *parser, Precedence precedence);
 
 static void
-binary ()
+binary (Parser *parser, bool can_assign)
 {
-  TokenType operator_type = parser.previous.type;
-  ParseRule *rule = get_rule (operator_type);
-  parse_precedence ((Precedence)(rule->precedence + 1));
+  (void)can_assign;
+  TokenType operator_type = parser->previous.type;
+  const ParseRule *rule = get_rule (operator_type);
+  parse_precedence (parser, (Precedence)(rule->precedence + 1));
 
   switch (operator_type)
     {
     case TOKEN_PLUS:
-      emit_byte (OP_ADD);
+      emit_byte (parser, OP_ADD);
       break;
     case TOKEN_MINUS:
-      emit_byte (OP_SUBTRACT);
+      emit_byte (parser, OP_SUBTRACT);
       break;
     case TOKEN_STAR:
-      emit_byte (OP_MULTIPLY);
+      emit_byte (parser, OP_MULTIPLY);
       break;
     case TOKEN_SLASH:
-      emit_byte (OP_DIVIDE);
+      emit_byte (parser, OP_DIVIDE);
       break;
     case TOKEN_BANG_EQUAL:
-      emit_bytes (OP_EQUAL, OP_NOT);
+      emit_bytes (parser, OP_EQUAL, OP_NOT);
       break;
     case TOKEN_EQUAL_EQUAL:
-      emit_byte (OP_EQUAL);
+      emit_byte (parser, OP_EQUAL);
       break;
     case TOKEN_GREATER:
-      emit_byte (OP_GREATER);
+      emit_byte (parser, OP_GREATER);
       break;
     case TOKEN_GREATER_EQUAL:
-      emit_bytes (OP_LESS, OP_NOT);
+      emit_bytes (parser, OP_LESS, OP_NOT);
       break;
     case TOKEN_LESS:
-      emit_byte (OP_LESS);
+      emit_byte (parser, OP_LESS);
       break;
     case TOKEN_LESS_EQUAL:
-      emit_bytes (OP_GREATER, OP_NOT);
+      emit_bytes (parser, OP_GREATER, OP_NOT);
       break;
     default:
       assert (false);
@@ -216,18 +407,19 @@ binary ()
 }
 
 static void
-literal ()
+literal (Parser *parser, bool can_assign)
 {
-  switch (parser.previous.type)
+  (void)can_assign;
+  switch (parser->previous.type)
     {
     case TOKEN_FALSE:
-      emit_byte (OP_FALSE);
+      emit_byte (parser, OP_FALSE);
       break;
     case TOKEN_TRUE:
-      emit_byte (OP_TRUE);
+      emit_byte (parser, OP_TRUE);
       break;
     case TOKEN_NIL:
-      emit_byte (OP_NIL);
+      emit_byte (parser, OP_NIL);
       break;
     default:
       // unreachable
@@ -236,42 +428,576 @@ literal ()
 }
 
 static void
-number ()
+number (Parser *parser, bool can_assign)
+{
+  (void)can_assign;
+  double value
+      = lox_parse_number (parser->previous.start, parser->previous.length);
+  emit_constant (parser, NUMBER_VAL (value));
+}
+
+static void
+string (Parser *parser, bool can_assign)
+{
+  (void)can_assign;
+  ObjString *constant = copy_string (&current_chunk (parser)->objects,
+                                     parser->previous.start + 1,
+                                     parser->previous.length - 2);
+  emit_constant (parser, OBJ_VAL (constant));
+}
+
+static void
+and_ (Parser *parser, bool can_assign)
 {
-  double value = strtod (parser.previous.start, NULL);
-  emit_constant (NUMBER_VAL (value));
+  (void)can_assign;
+  // The left operand is the result if it is falsey.
+  int end_jump = emit_jump (parser, OP_JUMP_IF_FALSE_LONG);
+  emit_byte (parser, OP_POP);
+  parse_precedence (parser, PREC_AND);
+  patch_jump (parser, end_jump);
 }
 
 static void
-string ()
+or_ (Parser *parser, bool can_assign)
+{
+  (void)can_assign;
+  // The left operand is the result if it is truthy.
+  int else_jump = emit_jump (parser, OP_JUMP_IF_FALSE_LONG);
+  int end_jump = emit_jump (parser, OP_JUMP_LONG);
+  patch_jump (parser, else_jump);
+  emit_byte (parser, OP_POP);
+  parse_precedence (parser, PREC_OR);
+  patch_jump (parser, end_jump);
+}
+
+static bool
+identifiers_equal (const Token *lhs, const Token *rhs)
 {
-  emit_constant (OBJ_VAL (
-      copy_string (parser.previous.start + 1, parser.previous.length - 2)));
+  return lhs->length == rhs->length
+         && memcmp (lhs->start, rhs->start, lhs->length) == 0;
+}
+
+/**
+ * The stack slot of the local variable @p name of @p compiler or -1 if it is
+ * not a local there.
+ */
+static int
+resolve_local (Parser *parser, const Compiler *compiler, const Token *name)
+{
+  for (int i = compiler->local_count - 1; i >= 0; i--)
+    {
+      const Local *local = &compiler->locals[i];
+      if (identifiers_equal (name, &local->name))
+        {
+          if (local->depth == -1)
+            error (parser,
+                   "Can't read local variable in its own initializer.");
+          return i;
+        }
+    }
+  return -1;
+}
+
+static int
+add_upvalue (Parser *parser, Compiler *compiler, uint8_t index, bool is_local)
+{
+  int upvalue_count = compiler->function->upvalue_count;
+  for (int i = 0; i < upvalue_count; i++)
+    {
+      const Upvalue *upvalue = &compiler->upvalues[i];
+      if (upvalue->index == index && upvalue->is_local == is_local)
+        return i;
+    }
+
+  if (upvalue_count == UINT8_COUNT)
+    {
+      error (parser, "Too many closure variables in function.");
+      return 0;
+    }
+  compiler->upvalues[upvalue_count].is_local = is_local;
+  compiler->upvalues[upvalue_count].index = index;
+  return compiler->function->upvalue_count++;
+}
+
+/**
+ * The index of the upvalue of @p compiler which captures @p name from an
+ * enclosing function, or -1 if @p name is global.
+ */
+static int
+resolve_upvalue (Parser *parser, Compiler *compiler, const Token *name)
+{
+  if (compiler->enclosing == NULL)
+    return -1;
+
+  int local = resolve_local (parser, compiler->enclosing, name);
+  if (local != -1)
+    {
+      compiler->enclosing->locals[local].is_captured = true;
+      return add_upvalue (parser, compiler, (uint8_t)local, true);
+    }
+
+  int upvalue = resolve_upvalue (parser, compiler->enclosing, name);
+  if (upvalue != -1)
+    return add_upvalue (parser, compiler, (uint8_t)upvalue, false);
+
+  return -1;
+}
+
+/**
+ * The index of the global variable @p name on the VM. Globals are resolved at
+ * compile time, so the VM never looks up names.
+ */
+static uint16_t
+global_index (Parser *parser, const Token *name)
+{
+  int index = declare_global (parser->vm, name->start, name->length);
+  if (index > UINT16_MAX)
+    {
+      error (parser, "Too many global variables.");
+      return 0;
+    }
+  return (uint16_t)index;
+}
+
+static void
+named_variable (Parser *parser, Token name, bool can_assign)
+{
+  int slot = resolve_local (parser, parser->compiler, &name);
+  int upvalue = slot == -1 ? resolve_upvalue (parser, parser->compiler, &name)
+                           : -1;
+  bool assign = can_assign && match (parser, TOKEN_EQUAL);
+  if (assign)
+    expression (parser);
+
+  if (slot != -1)
+    emit_bytes (parser, assign ? OP_SET_LOCAL : OP_GET_LOCAL, (uint8_t)slot);
+  else if (upvalue != -1)
+    emit_bytes (parser, assign ? OP_SET_UPVALUE : OP_GET_UPVALUE,
+                (uint8_t)upvalue);
+  else
+    emit_short (parser, assign ? OP_SET_GLOBAL : OP_GET_GLOBAL,
+                global_index (parser, &name));
+}
+
+static void
+variable (Parser *parser, bool can_assign)
+{
+  named_variable (parser, parser->previous, can_assign);
 }
 
 // The actual workhorse of this module.
 // Implements Pratt's expression parser.
 static void
-expression ()
+expression (Parser *parser)
+{
+  parse_precedence (parser, PREC_ASSIGNMENT);
+}
+
+static void
+begin_scope (Parser *parser)
+{
+  parser->compiler->scope_depth++;
+}
+
+static void
+end_scope (Parser *parser)
+{
+  Compiler *compiler = parser->compiler;
+  compiler->scope_depth--;
+  while (compiler->local_count > 0
+         && compiler->locals[compiler->local_count - 1].depth
+                > compiler->scope_depth)
+    {
+      if (compiler->locals[compiler->local_count - 1].is_captured)
+        emit_byte (parser, OP_CLOSE_UPVALUE);
+      else
+        emit_byte (parser, OP_POP);
+      compiler->local_count--;
+    }
+}
+
+static void
+block (Parser *parser)
+{
+  while (!check (parser, TOKEN_RIGHT_BRACE) && !check (parser, TOKEN_EOF))
+    declaration (parser);
+  consume (parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+}
+
+static void
+add_local (Parser *parser, Token name)
+{
+  Compiler *compiler = parser->compiler;
+  if (compiler->local_count == UINT8_COUNT)
+    {
+      error (parser, "Too many local variables in function.");
+      return;
+    }
+  Local *local = &compiler->locals[compiler->local_count++];
+  local->name = name;
+  local->depth = -1;
+  local->is_captured = false;
+}
+
+/**
+ * Add the local variable named by the previous token to the current scope.
+ * Globals are not declared, they are resolved by name.
+ */
+static void
+declare_variable (Parser *parser)
 {
-  parse_precedence (PREC_ASSIGNMENT);
+  Compiler *compiler = parser->compiler;
+  if (compiler->scope_depth == 0)
+    return;
+
+  const Token *name = &parser->previous;
+  for (int i = compiler->local_count - 1; i >= 0; i--)
+    {
+      const Local *local = &compiler->locals[i];
+      if (local->depth != -1 && local->depth < compiler->scope_depth)
+        break;
+      if (identifiers_equal (name, &local->name))
+        error (parser, "Already a variable with this name in this scope.");
+    }
+  add_local (parser, *name);
+}
+
+/**
+ * Parse the name of a variable declaration. Returns the index of a global
+ * and 0 for locals.
+ */
+static uint16_t
+parse_variable (Parser *parser, const char *message)
+{
+  consume (parser, TOKEN_IDENTIFIER, message);
+  declare_variable (parser);
+  if (parser->compiler->scope_depth > 0)
+    return 0;
+  return global_index (parser, &parser->previous);
+}
+
+/**
+ * Allow the most recent local variable to be used.
+ */
+static void
+mark_initialized (Parser *parser)
+{
+  Compiler *compiler = parser->compiler;
+  if (compiler->scope_depth == 0)
+    return;
+  compiler->locals[compiler->local_count - 1].depth = compiler->scope_depth;
+}
+
+static void
+define_variable (Parser *parser, uint16_t global)
+{
+  // The value on the stack becomes the local variable.
+  if (parser->compiler->scope_depth > 0)
+    {
+      mark_initialized (parser);
+      return;
+    }
+  emit_short (parser, OP_DEFINE_GLOBAL, global);
+}
+
+static uint8_t
+argument_list (Parser *parser)
+{
+  uint8_t arg_count = 0;
+  if (!check (parser, TOKEN_RIGHT_PAREN))
+    {
+      do
+        {
+          expression (parser);
+          if (arg_count == UINT8_MAX)
+            error (parser, "Can't have more than 255 arguments.");
+          else
+            arg_count++;
+        }
+      while (match (parser, TOKEN_COMMA));
+    }
+  consume (parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+  return arg_count;
+}
+
+static void
+call (Parser *parser, bool can_assign)
+{
+  (void)can_assign;
+  uint8_t arg_count = argument_list (parser);
+  emit_bytes (parser, OP_CALL, arg_count);
 }
 
+/**
+ * Compile the parameters and body of a function named by the previous token.
+ * The function is left on the stack.
+ */
 static void
-unary ()
+function (Parser *parser)
 {
-  TokenType operator_type = parser.previous.type;
+  Compiler compiler;
+  init_compiler (parser, &compiler, true);
+  begin_scope (parser);
+
+  consume (parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+  if (!check (parser, TOKEN_RIGHT_PAREN))
+    {
+      do
+        {
+          compiler.function->arity++;
+          if (compiler.function->arity > UINT8_MAX)
+            error_at_current (parser, "Can't have more than 255 parameters.");
+          uint16_t constant
+              = parse_variable (parser, "Expect parameter name.");
+          define_variable (parser, constant);
+        }
+      while (match (parser, TOKEN_COMMA));
+    }
+  consume (parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+  consume (parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+  block (parser);
+
+  // The scope is not ended: the locals are discarded with the frame.
+  ObjFunction *function = end_compiler (parser);
+  if (function->upvalue_count == 0)
+    {
+      // Without upvalues, the function is called directly. No closure needs
+      // to be allocated at run time.
+      emit_constant (parser, OBJ_VAL (function));
+      return;
+    }
+
+  emit_bytes (parser, OP_CLOSURE, make_constant (parser, OBJ_VAL (function)));
+  for (int i = 0; i < function->upvalue_count; i++)
+    emit_bytes (parser, compiler.upvalues[i].is_local ? 1 : 0,
+                compiler.upvalues[i].index);
+}
+
+static void
+fun_declaration (Parser *parser)
+{
+  uint16_t global = parse_variable (parser, "Expect function name.");
+  // A local function may refer to itself.
+  mark_initialized (parser);
+  function (parser);
+  define_variable (parser, global);
+}
+
+static void
+var_declaration (Parser *parser)
+{
+  uint16_t global = parse_variable (parser, "Expect variable name.");
+  if (match (parser, TOKEN_EQUAL))
+    expression (parser);
+  else
+    emit_byte (parser, OP_NIL);
+  consume (parser, TOKEN_SEMICOLON,
+           "Expect ';' after variable declaration.");
+  define_variable (parser, global);
+}
+
+static void
+expression_statement (Parser *parser)
+{
+  expression (parser);
+  consume (parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
+  emit_byte (parser, OP_POP);
+}
+
+static void
+if_statement (Parser *parser)
+{
+  consume (parser, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+  expression (parser);
+  consume (parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+  int then_jump = emit_jump (parser, OP_JUMP_IF_FALSE_LONG);
+  emit_byte (parser, OP_POP);
+  statement (parser);
+  int else_jump = emit_jump (parser, OP_JUMP_LONG);
+
+  patch_jump (parser, then_jump);
+  emit_byte (parser, OP_POP);
+  if (match (parser, TOKEN_ELSE))
+    statement (parser);
+  patch_jump (parser, else_jump);
+}
+
+static void
+while_statement (Parser *parser)
+{
+  int loop_start = current_chunk (parser)->count;
+  consume (parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+  expression (parser);
+  consume (parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+  int exit_jump = emit_jump (parser, OP_JUMP_IF_FALSE_LONG);
+  emit_byte (parser, OP_POP);
+  statement (parser);
+  emit_loop (parser, loop_start);
+
+  patch_jump (parser, exit_jump);
+  emit_byte (parser, OP_POP);
+}
+
+static void
+for_statement (Parser *parser)
+{
+  // The loop variable is local to the loop.
+  begin_scope (parser);
+  consume (parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+  if (match (parser, TOKEN_SEMICOLON))
+    {
+      // No initializer.
+    }
+  else if (match (parser, TOKEN_VAR))
+    var_declaration (parser);
+  else
+    expression_statement (parser);
+
+  int loop_start = current_chunk (parser)->count;
+  int exit_jump = -1;
+  if (!match (parser, TOKEN_SEMICOLON))
+    {
+      expression (parser);
+      consume (parser, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+      exit_jump = emit_jump (parser, OP_JUMP_IF_FALSE_LONG);
+      emit_byte (parser, OP_POP);
+    }
+
+  if (!match (parser, TOKEN_RIGHT_PAREN))
+    {
+      // The increment follows the condition in the source but runs after the
+      // body, so the body jumps back to it.
+      int body_jump = emit_jump (parser, OP_JUMP_LONG);
+      int increment_start = current_chunk (parser)->count;
+      expression (parser);
+      emit_byte (parser, OP_POP);
+      consume (parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+      emit_loop (parser, loop_start);
+      loop_start = increment_start;
+      patch_jump (parser, body_jump);
+    }
+
+  statement (parser);
+  emit_loop (parser, loop_start);
+
+  if (exit_jump != -1)
+    {
+      patch_jump (parser, exit_jump);
+      emit_byte (parser, OP_POP);
+    }
+  end_scope (parser);
+}
+
+static void
+return_statement (Parser *parser)
+{
+  if (parser->compiler->function == NULL)
+    error (parser, "Can't return from top-level code.");
+
+  if (match (parser, TOKEN_SEMICOLON))
+    {
+      emit_return (parser);
+      return;
+    }
+  expression (parser);
+  consume (parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
+  emit_byte (parser, OP_RETURN);
+}
+
+static void
+print_statement (Parser *parser)
+{
+  expression (parser);
+  consume (parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+  emit_byte (parser, OP_PRINT);
+}
+
+/**
+ * Skip tokens until a statement boundary after an error, so the following
+ * statements are checked without cascading errors.
+ */
+static void
+synchronize (Parser *parser)
+{
+  parser->panic_mode = false;
+  while (parser->current.type != TOKEN_EOF)
+    {
+      if (parser->previous.type == TOKEN_SEMICOLON)
+        return;
+      switch (parser->current.type)
+        {
+        case TOKEN_CLASS:
+        case TOKEN_FUN:
+        case TOKEN_VAR:
+        case TOKEN_FOR:
+        case TOKEN_IF:
+        case TOKEN_WHILE:
+        case TOKEN_PRINT:
+        case TOKEN_RETURN:
+          return;
+        default:
+          break;
+        }
+      advance (parser);
+    }
+}
+
+static void
+declaration (Parser *parser)
+{
+  if (match (parser, TOKEN_FUN))
+    fun_declaration (parser);
+  else if (match (parser, TOKEN_VAR))
+    var_declaration (parser);
+  else
+    statement (parser);
+
+  if (parser->panic_mode)
+    synchronize (parser);
+}
+
+static void
+statement (Parser *parser)
+{
+  if (match (parser, TOKEN_PRINT))
+    print_statement (parser);
+  else if (match (parser, TOKEN_IF))
+    if_statement (parser);
+  else if (match (parser, TOKEN_WHILE))
+    while_statement (parser);
+  else if (match (parser, TOKEN_FOR))
+    for_statement (parser);
+  else if (match (parser, TOKEN_RETURN))
+    return_statement (parser);
+  else if (match (parser, TOKEN_LEFT_BRACE))
+    {
+      begin_scope (parser);
+      block (parser);
+      end_scope (parser);
+    }
+  else
+    expression_statement (parser);
+}
+
+static void
+unary (Parser *parser, bool can_assign)
+{
+  (void)can_assign;
+  TokenType operator_type = parser->previous.type;
 
   // compile the operand
-  parse_precedence (PREC_UNARY);
+  parse_precedence (parser, PREC_UNARY);
 
   switch (operator_type)
     {
     case TOKEN_MINUS:
-      emit_byte (OP_NEGATE);
+      emit_byte (parser, OP_NEGATE);
       break;
     case TOKEN_BANG:
-      emit_byte (OP_NOT);
+      emit_byte (parser, OP_NOT);
       break;
     default:
       assert (false);
@@ -280,14 +1006,15 @@ unary ()
 }
 
 static void
-grouping ()
+grouping (Parser *parser, bool can_assign)
 {
-  expression ();
-  consume (TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+  (void)can_assign;
+  expression (parser);
+  consume (parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-ParseRule rules[] = {
-  [TOKEN_LEFT_PAREN] = { grouping, NULL, PREC_NONE },
+static const ParseRule rules[] = {
+  [TOKEN_LEFT_PAREN] = { grouping, call, PREC_CALL },
   [TOKEN_RIGHT_PAREN] = { NULL, NULL, PREC_NONE },
   [TOKEN_LEFT_BRACE] = { NULL, NULL, PREC_NONE },
   [TOKEN_RIGHT_BRACE] = { NULL, NULL, PREC_NONE },
@@ -306,10 +1033,10 @@ ParseRule rules[] = {
   [TOKEN_GREATER_EQUAL] = { NULL, binary, PREC_COMPARISON },
   [TOKEN_LESS] = { NULL, binary, PREC_COMPARISON },
   [TOKEN_LESS_EQUAL] = { NULL, binary, PREC_COMPARISON },
-  [TOKEN_IDENTIFIER] = { NULL, NULL, PREC_NONE },
+  [TOKEN_IDENTIFIER] = { variable, NULL, PREC_NONE },
   [TOKEN_STRING] = { string, NULL, PREC_NONE },
   [TOKEN_NUMBER] = { number, NULL, PREC_NONE },
-  [TOKEN_AND] = { NULL, NULL, PREC_NONE },
+  [TOKEN_AND] = { NULL, and_, PREC_AND },
   [TOKEN_CLASS] = { NULL, NULL, PREC_NONE },
   [TOKEN_ELSE] = { NULL, NULL, PREC_NONE },
   [TOKEN_FALSE] = { literal, NULL, PREC_NONE },
@@ -317,7 +1044,7 @@ ParseRule rules[] = {
   [TOKEN_FUN] = { NULL, NULL, PREC_NONE },
   [TOKEN_IF] = { NULL, NULL, PREC_NONE },
   [TOKEN_NIL] = { literal, NULL, PREC_NONE },
-  [TOKEN_OR] = { NULL, NULL, PREC_NONE },
+  [TOKEN_OR] = { NULL, or_, PREC_OR },
   [TOKEN_PRINT] = { NULL, NULL, PREC_NONE },
   [TOKEN_RETURN] = { NULL, NULL, PREC_NONE },
   [TOKEN_SUPER] = { NULL, NULL, PREC_NONE },
@@ -330,64 +1057,69 @@ ParseRule rules[] = {
 };
 
 static void
-parse_precedence (Precedence precedence)
+parse_precedence (Parser *parser, Precedence precedence)
 {
-  advance ();
-  ParseFn prefix_rule = get_rule (parser.previous.type)->prefix;
+  advance (parser);
+  ParseFn prefix_rule = get_rule (parser->previous.type)->prefix;
   if (prefix_rule == NULL)
     {
-      error ("Expect expression.");
+      error (parser, "Expect expression.");
       return;
     }
 
-  prefix_rule ();
+  // Only a variable at the start of an expression of the lowest precedence
+  // may be assigned to, e.g. not the b in a + b = c.
+  bool can_assign = precedence <= PREC_ASSIGNMENT;
+  prefix_rule (parser, can_assign);
 
-  while (precedence <= get_rule (parser.current.type)->precedence)
+  while (precedence <= get_rule (parser->current.type)->precedence)
     {
-      advance ();
-      ParseFn infix_rule = get_rule (parser.previous.type)->infix;
-      infix_rule ();
+      advance (parser);
+      ParseFn infix_rule = get_rule (parser->previous.type)->infix;
+      infix_rule (parser, can_assign);
     }
+
+  if (can_assign && match (parser, TOKEN_EQUAL))
+    error (parser, "Invalid assignment target.");
 }
 
-static ParseRule *
+static const ParseRule *
 get_rule (TokenType type)
 {
   return &rules[type];
 }
 
 bool
-compile (const char *source, Chunk *chunk)
+compile (VM *vm, const char *source, size_t length, Chunk *chunk)
 {
-  if (is_option_set (OPT_TOKENS))
+  if (vm->options & OPT_TOKENS)
     {
-      printf ("== tokens ==\n");
-      init_scanner (source);
+      lox_writer_puts (vm->out, "== tokens ==\n");
+      Scanner scanner;
+      init_scanner (&scanner, source, length);
       Token token;
-      while ((token = scan_token ()).type != TOKEN_EOF)
+      while ((token = scan_token (&scanner)).type != TOKEN_EOF)
         {
-          printf ("[%s %.*s] ", token_type_to_string (token.type),
-                  token.length, token.start);
+          lox_writer_printf (vm->out, "[%s %.*s] ",
+                             token_type_to_string (token.type), token.length,
+                             token.start);
         }
-      printf ("\n");
+      lox_writer_putc (vm->out, '\n');
     }
 
-  compiling_chunk = chunk;
-
-  init_scanner (source);
-  init_parser ();
+  Parser parser = { .had_error = false,
+                    .panic_mode = false,
+                    .chunk = chunk,
+                    .compiler = NULL,
+                    .vm = vm };
+  init_scanner (&parser.scanner, source, length);
+  Compiler compiler;
+  init_compiler (&parser, &compiler, false);
 
-  // Compiler for a single expression.
-  advance ();
-  expression ();
-  consume (TOKEN_EOF, "Expect end of expression.");
-  end_compiler ();
-
-  if (is_option_set (OPT_DISASSEMBLE))
-    {
-      if (!parser.had_error)
-        disassemble_chunk (current_chunk (), "code");
-    }
+  advance (&parser);
+  while (!match (&parser, TOKEN_EOF))
+    declaration (&parser);
+  end_compiler (&parser);
 
   return !parser.had_error;
 }
@@ -1,5 +1,10 @@
 #pragma once
 
 #include "chunk.h"
+#include "vm.h"
 
-bool compile (const char *source, Chunk *chunk);
+/**
+ * Compile @p length characters at @p source into @p chunk. The options of
+ * @p vm apply and all output goes to @p vm.
+ */
+bool compile (VM *vm, const char *source, size_t length, Chunk *chunk);
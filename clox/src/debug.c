@@ -1,83 +1,372 @@
 #include "debug.h"
 #include "chunk.h"
+#include "object.h"
 #include "value.h"
 
-#include <stdio.h>
+#include <lox_writer.h>
 
-static int
-simple_instruction (const char *name, int offset)
+static void
+simple_instruction (LoxWriter *out, const char *name)
 {
-  printf ("%s\n", name);
-  return offset + 1;
+  lox_writer_printf (out, "%s\n", name);
 }
 
-static int
-constant_instruction (const char *name, Chunk *chunk, int offset)
+static void
+constant_instruction (LoxWriter *out, const char *name,
+                      const Chunk *chunk, int offset)
 {
   uint8_t constant_index = chunk->code[offset + 1];
-  printf ("%-16s %4d '", name, constant_index);
-  print_value (chunk->constants.values[constant_index]);
-  printf ("'\n");
-  return offset + 2;
+  lox_writer_printf (out, "%-16s %4d '", name, constant_index);
+  print_value (out, chunk->constants.values[constant_index]);
+  lox_writer_puts (out, "'\n");
+}
+
+static void
+byte_instruction (LoxWriter *out, const char *name, const Chunk *chunk,
+                  int offset)
+{
+  uint8_t slot = chunk->code[offset + 1];
+  lox_writer_printf (out, "%-16s %4d\n", name, slot);
+}
+
+static void
+short_instruction (LoxWriter *out, const char *name, const Chunk *chunk,
+                   int offset)
+{
+  uint16_t operand
+      = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+  lox_writer_printf (out, "%-16s %4d\n", name, operand);
+}
+
+/**
+ * Print a jump with its offset and target. @p sign is 1 for forward and -1
+ * for backward jumps.
+ */
+static void
+jump_instruction (LoxWriter *out, const char *name, int sign, bool is_long,
+                  const Chunk *chunk, int offset)
+{
+  int jump = chunk->code[offset + 1];
+  int size = 2;
+  if (is_long)
+    {
+      jump = (jump << 8) | chunk->code[offset + 2];
+      size = 3;
+    }
+  lox_writer_printf (out, "%-16s %4d -> %d\n", name, jump,
+                     offset + size + sign * jump);
+}
+
+static void
+closure_instruction (LoxWriter *out, const Chunk *chunk, int offset)
+{
+  constant_instruction (out, "OP_CLOSURE", chunk, offset);
+  const ObjFunction *function
+      = AS_FUNCTION (chunk->constants.values[chunk->code[offset + 1]]);
+  offset += 2;
+  for (int i = 0; i < function->upvalue_count; i++)
+    {
+      int is_local = chunk->code[offset];
+      int index = chunk->code[offset + 1];
+      lox_writer_printf (out, "%04d    |                     %s %d\n", offset,
+                         is_local ? "local" : "upvalue", index);
+      offset += 2;
+    }
+}
+
+/**
+ * Print an instruction with @p count register or byte operands.
+ */
+static void
+register_instruction (LoxWriter *out, const char *name, int count,
+                      const Chunk *chunk, int offset)
+{
+  lox_writer_printf (out, "%-16s", name);
+  for (int i = 1; i <= count; ++i)
+    lox_writer_printf (out, " %4d", chunk->code[offset + i]);
+  lox_writer_putc (out, '\n');
+}
+
+static void
+register_constant_instruction (LoxWriter *out, const char *name,
+                               const Chunk *chunk, int offset)
+{
+  uint8_t constant_index = chunk->code[offset + 2];
+  lox_writer_printf (out, "%-16s %4d %4d '", name, chunk->code[offset + 1],
+                     constant_index);
+  print_value (out, chunk->constants.values[constant_index]);
+  lox_writer_puts (out, "'\n");
+}
+
+static void
+register_short_instruction (LoxWriter *out, const char *name,
+                            const Chunk *chunk, int offset)
+{
+  uint16_t operand
+      = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+  lox_writer_printf (out, "%-16s %4d %4d\n", name, chunk->code[offset + 1],
+                     operand);
+}
+
+/**
+ * Print a register jump, which has a 16-bit offset after @p registers
+ * register operands.
+ */
+static void
+register_jump_instruction (LoxWriter *out, const char *name, int sign,
+                           int registers, const Chunk *chunk, int offset)
+{
+  lox_writer_printf (out, "%-16s", name);
+  for (int i = 1; i <= registers; ++i)
+    lox_writer_printf (out, " %4d", chunk->code[offset + i]);
+  const uint8_t *operand = chunk->code + offset + 1 + registers;
+  int jump = (operand[0] << 8) | operand[1];
+  int size = 3 + registers;
+  lox_writer_printf (out, " %4d -> %d\n", jump, offset + size + sign * jump);
+}
+
+static void
+register_closure_instruction (LoxWriter *out, const Chunk *chunk, int offset)
+{
+  register_constant_instruction (out, "OP_R_CLOSURE", chunk, offset);
+  const ObjFunction *function
+      = AS_FUNCTION (chunk->constants.values[chunk->code[offset + 2]]);
+  offset += 3;
+  for (int i = 0; i < function->upvalue_count; i++)
+    {
+      int is_local = chunk->code[offset];
+      int index = chunk->code[offset + 1];
+      lox_writer_printf (out, "%04d    |                          %s %d\n",
+                         offset, is_local ? "local" : "upvalue", index);
+      offset += 2;
+    }
 }
 
 void
-disassemble_chunk (Chunk *chunk, const char *name)
+disassemble_chunk (LoxWriter *out, const Chunk *chunk, const char *name)
 {
-  printf ("== %s ==\n", name);
+  lox_writer_printf (out, "== %s ==\n", name);
 
   for (int offset = 0; offset < chunk->count;)
     {
-      offset = disassemble_instruction (chunk, offset);
+      offset = disassemble_instruction (out, chunk, offset);
     }
 }
 
 int
-disassemble_instruction (Chunk *chunk, int offset)
+disassemble_instruction (LoxWriter *out, const Chunk *chunk, int offset)
 {
   // address
-  printf ("%04d ", offset);
+  lox_writer_printf (out, "%04d ", offset);
 
   // source line number
   if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1])
-    printf ("   | ");
+    lox_writer_puts (out, "   | ");
   else
-    printf ("%4d ", chunk->lines[offset]);
+    lox_writer_printf (out, "%4d ", chunk->lines[offset]);
 
   // actual instruction
   uint8_t instruction = chunk->code[offset];
   switch (instruction)
     {
     case OP_CONSTANT:
-      return constant_instruction ("OP_CONSTANT", chunk, offset);
+      constant_instruction (out, "OP_CONSTANT", chunk, offset);
+      break;
     case OP_NIL:
-      return simple_instruction ("OP_NIL", offset);
+      simple_instruction (out, "OP_NIL");
+      break;
     case OP_TRUE:
-      return simple_instruction ("OP_TRUE", offset);
+      simple_instruction (out, "OP_TRUE");
+      break;
     case OP_FALSE:
-      return simple_instruction ("OP_FALSE", offset);
+      simple_instruction (out, "OP_FALSE");
+      break;
+    case OP_POP:
+      simple_instruction (out, "OP_POP");
+      break;
+    case OP_GET_LOCAL:
+      byte_instruction (out, "OP_GET_LOCAL", chunk, offset);
+      break;
+    case OP_SET_LOCAL:
+      byte_instruction (out, "OP_SET_LOCAL", chunk, offset);
+      break;
+    case OP_GET_GLOBAL:
+      short_instruction (out, "OP_GET_GLOBAL", chunk, offset);
+      break;
+    case OP_DEFINE_GLOBAL:
+      short_instruction (out, "OP_DEFINE_GLOBAL", chunk, offset);
+      break;
+    case OP_SET_GLOBAL:
+      short_instruction (out, "OP_SET_GLOBAL", chunk, offset);
+      break;
+    case OP_GET_UPVALUE:
+      byte_instruction (out, "OP_GET_UPVALUE", chunk, offset);
+      break;
+    case OP_SET_UPVALUE:
+      byte_instruction (out, "OP_SET_UPVALUE", chunk, offset);
+      break;
+    case OP_CLOSE_UPVALUE:
+      simple_instruction (out, "OP_CLOSE_UPVALUE");
+      break;
     case OP_EQUAL:
-      return simple_instruction ("OP_EQUAL", offset);
+      simple_instruction (out, "OP_EQUAL");
+      break;
     case OP_GREATER:
-      return simple_instruction ("OP_GREATER", offset);
+      simple_instruction (out, "OP_GREATER");
+      break;
     case OP_LESS:
-      return simple_instruction ("OP_LESS", offset);
+      simple_instruction (out, "OP_LESS");
+      break;
     case OP_ADD:
-      return simple_instruction ("OP_ADD", offset);
+      simple_instruction (out, "OP_ADD");
+      break;
     case OP_SUBTRACT:
-      return simple_instruction ("OP_SUBTRACT", offset);
+      simple_instruction (out, "OP_SUBTRACT");
+      break;
     case OP_MULTIPLY:
-      return simple_instruction ("OP_MULTIPLY", offset);
+      simple_instruction (out, "OP_MULTIPLY");
+      break;
     case OP_DIVIDE:
-      return simple_instruction ("OP_DIVIDE", offset);
+      simple_instruction (out, "OP_DIVIDE");
+      break;
+    case OP_ADD_NUM:
+      simple_instruction (out, "OP_ADD_NUM");
+      break;
+    case OP_ADD_STR:
+      simple_instruction (out, "OP_ADD_STR");
+      break;
+    case OP_LESS_NUM:
+      simple_instruction (out, "OP_LESS_NUM");
+      break;
     case OP_NOT:
-      return simple_instruction ("OP_NOT", offset);
+      simple_instruction (out, "OP_NOT");
+      break;
     case OP_NEGATE:
-      return simple_instruction ("OP_NEGATE", offset);
+      simple_instruction (out, "OP_NEGATE");
+      break;
+    case OP_PRINT:
+      simple_instruction (out, "OP_PRINT");
+      break;
+    case OP_JUMP:
+      jump_instruction (out, "OP_JUMP", 1, false, chunk, offset);
+      break;
+    case OP_JUMP_LONG:
+      jump_instruction (out, "OP_JUMP_LONG", 1, true, chunk, offset);
+      break;
+    case OP_JUMP_IF_FALSE:
+      jump_instruction (out, "OP_JUMP_IF_FALSE", 1, false, chunk,
+                               offset);
+      break;
+    case OP_JUMP_IF_FALSE_LONG:
+      jump_instruction (out, "OP_JUMP_IF_FALSE_LONG", 1, true, chunk,
+                               offset);
+      break;
+    case OP_LOOP:
+      jump_instruction (out, "OP_LOOP", -1, false, chunk, offset);
+      break;
+    case OP_LOOP_LONG:
+      jump_instruction (out, "OP_LOOP_LONG", -1, true, chunk, offset);
+      break;
+    case OP_CALL:
+      byte_instruction (out, "OP_CALL", chunk, offset);
+      break;
+    case OP_CLOSURE:
+      closure_instruction (out, chunk, offset);
+      break;
     case OP_RETURN:
-      return simple_instruction ("OP_RETURN", offset);
+      simple_instruction (out, "OP_RETURN");
+      break;
+    case OP_R_MOVE:
+      register_instruction (out, "OP_R_MOVE", 2, chunk, offset);
+      break;
+    case OP_R_CONSTANT:
+      register_constant_instruction (out, "OP_R_CONSTANT", chunk,
+                                            offset);
+      break;
+    case OP_R_NIL:
+      register_instruction (out, "OP_R_NIL", 1, chunk, offset);
+      break;
+    case OP_R_TRUE:
+      register_instruction (out, "OP_R_TRUE", 1, chunk, offset);
+      break;
+    case OP_R_FALSE:
+      register_instruction (out, "OP_R_FALSE", 1, chunk, offset);
+      break;
+    case OP_R_GET_GLOBAL:
+      register_short_instruction (out, "OP_R_GET_GLOBAL", chunk,
+                                         offset);
+      break;
+    case OP_R_DEFINE_GLOBAL:
+      register_short_instruction (out, "OP_R_DEFINE_GLOBAL", chunk,
+                                         offset);
+      break;
+    case OP_R_SET_GLOBAL:
+      register_short_instruction (out, "OP_R_SET_GLOBAL", chunk,
+                                         offset);
+      break;
+    case OP_R_GET_UPVALUE:
+      register_instruction (out, "OP_R_GET_UPVALUE", 2, chunk, offset);
+      break;
+    case OP_R_SET_UPVALUE:
+      register_instruction (out, "OP_R_SET_UPVALUE", 2, chunk, offset);
+      break;
+    case OP_R_CLOSE_UPVALUE:
+      register_instruction (out, "OP_R_CLOSE_UPVALUE", 1, chunk,
+                                   offset);
+      break;
+    case OP_R_EQUAL:
+      register_instruction (out, "OP_R_EQUAL", 3, chunk, offset);
+      break;
+    case OP_R_GREATER:
+      register_instruction (out, "OP_R_GREATER", 3, chunk, offset);
+      break;
+    case OP_R_LESS:
+      register_instruction (out, "OP_R_LESS", 3, chunk, offset);
+      break;
+    case OP_R_ADD:
+      register_instruction (out, "OP_R_ADD", 3, chunk, offset);
+      break;
+    case OP_R_SUBTRACT:
+      register_instruction (out, "OP_R_SUBTRACT", 3, chunk, offset);
+      break;
+    case OP_R_MULTIPLY:
+      register_instruction (out, "OP_R_MULTIPLY", 3, chunk, offset);
+      break;
+    case OP_R_DIVIDE:
+      register_instruction (out, "OP_R_DIVIDE", 3, chunk, offset);
+      break;
+    case OP_R_NOT:
+      register_instruction (out, "OP_R_NOT", 2, chunk, offset);
+      break;
+    case OP_R_NEGATE:
+      register_instruction (out, "OP_R_NEGATE", 2, chunk, offset);
+      break;
+    case OP_R_PRINT:
+      register_instruction (out, "OP_R_PRINT", 1, chunk, offset);
+      break;
+    case OP_R_JUMP:
+      register_jump_instruction (out, "OP_R_JUMP", 1, 0, chunk, offset);
+      break;
+    case OP_R_JUMP_IF_FALSE:
+      register_jump_instruction (out, "OP_R_JUMP_IF_FALSE", 1, 1, chunk,
+                                        offset);
+      break;
+    case OP_R_LOOP:
+      register_jump_instruction (out, "OP_R_LOOP", -1, 0, chunk,
+                                        offset);
+      break;
+    case OP_R_CALL:
+      register_instruction (out, "OP_R_CALL", 2, chunk, offset);
+      break;
+    case OP_R_CLOSURE:
+      register_closure_instruction (out, chunk, offset);
+      break;
+    case OP_R_RETURN:
+      register_instruction (out, "OP_R_RETURN", 1, chunk, offset);
+      break;
     default:
-      printf ("Unknown opcode %d\n", instruction);
-      return offset + 1;
+      lox_writer_printf (out, "Unknown opcode %d\n", instruction);
+      break;
     }
+  return offset + instruction_size (chunk, offset);
 }
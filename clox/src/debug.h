@@ -2,5 +2,8 @@
 
 #include "chunk.h"
 
-void disassemble_chunk (Chunk *chunk, const char *name);
-int disassemble_instruction (Chunk *chunk, int offset);
+#include <lox_writer.h>
+
+void disassemble_chunk (LoxWriter *out, const Chunk *chunk,
+                        const char *name);
+int disassemble_instruction (LoxWriter *out, const Chunk *chunk, int offset);
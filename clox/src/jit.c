@@ -0,0 +1,1038 @@
+// Baseline JIT compiler for x86-64 Linux. Every bytecode instruction of a hot
+// chunk is replaced by a template of machine code, so the instructions are no
+// longer decoded and dispatched one by one. Jumps become native jumps.
+// Templates for locals, globals, constants and arithmetic on numbers work on
+// the stack directly, the others call a small handler.
+//
+// The machine code keeps its state in the VM like the interpreter does, only
+// the top of the stack lives in a register until it leaves. It may be entered
+// at any instruction and leaves to the interpreter before any instruction. It
+// leaves for calls, returns and closures, and whenever a template finds
+// operands it does not handle, e.g. strings or wrong types. The interpreter
+// then runs the instruction and reports errors.
+
+#include "jit.h"
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+
+#include <lox_writer.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Templates copy values as a whole with one 16-byte move.
+_Static_assert (sizeof (Value) == 16, "Values must fit into an SSE register");
+
+/**
+ * Run machine code from @p target until it leaves. @p slots are the slots of
+ * the running frame. Returns the instruction at which the interpreter
+ * continues.
+ */
+typedef const uint8_t *(*JitEntry) (VM *vm, const uint8_t *target,
+                                    Value *slots);
+
+/**
+ * Executable memory shared by the machine code of several chunks, since most
+ * chunks need far less than a page. Chunks larger than an arena get one of
+ * their own.
+ */
+typedef struct CodeArena
+{
+  struct CodeArena *next;
+  uint8_t *memory;
+  size_t size;
+  size_t used;
+  // The number of chunks with code in this arena. It is unmapped at zero.
+  int chunks;
+} CodeArena;
+
+#define ARENA_SIZE (64 * 1024)
+// Keeps the code of every chunk aligned for the instruction fetch.
+#define CODE_ALIGNMENT 16
+
+typedef struct
+{
+  // Executable memory in arena. The entry code comes first.
+  CodeArena *arena;
+  uint8_t *memory;
+  size_t size;
+  // The offset into memory of the machine code for every bytecode offset.
+  // Only offsets at the start of instructions are valid.
+  uint32_t *native_offsets;
+  int bytecode_count;
+} JitCode;
+
+typedef struct
+{
+  // Chunk::id, zero for empty slots.
+  uint64_t chunk_id;
+  int entries;
+  bool failed;
+  JitCode *code;
+} JitSlot;
+
+/**
+ * Maps chunks to their machine code. Chunks are shared by VMs, so this lives
+ * in the VM and not in the chunk.
+ */
+struct JitState
+{
+  int count;
+  int capacity;
+  JitSlot *slots;
+  // The first arena is the one new code goes to.
+  CodeArena *arenas;
+};
+
+// Handlers do the work of the instructions without a template of their own.
+// They see the VM exactly as the interpreter would.
+
+static inline void
+push (VM *vm, Value value)
+{
+  *(vm->stack_top++) = value;
+}
+
+static inline Value
+pop (VM *vm)
+{
+  return *(--(vm->stack_top));
+}
+
+static inline CallFrame *
+current_frame (VM *vm)
+{
+  return &vm->frames[vm->frame_count - 1];
+}
+
+static void
+op_get_upvalue (VM *vm, uint32_t index)
+{
+  push (vm, *current_frame (vm)->closure->upvalues[index]->location);
+}
+
+static void
+op_set_upvalue (VM *vm, uint32_t index)
+{
+  *current_frame (vm)->closure->upvalues[index]->location = vm->stack_top[-1];
+}
+
+static void
+op_equal (VM *vm)
+{
+  Value rhs = pop (vm);
+  Value lhs = pop (vm);
+  push (vm, BOOL_VAL (values_equal (lhs, rhs)));
+}
+
+static void
+op_not (VM *vm)
+{
+  Value value = pop (vm);
+  bool falsey = IS_NIL (value) || (IS_BOOL (value) && !AS_BOOL (value));
+  push (vm, BOOL_VAL (falsey));
+}
+
+static void
+op_print (VM *vm)
+{
+  print_value (vm->out, pop (vm));
+  lox_writer_putc (vm->out, '\n');
+}
+
+// Registers of the machine code. The VM lives in rbx, the top of the stack
+// in r12 and the slots of the frame in r13. They are callee-saved, so
+// handlers keep them intact.
+typedef enum
+{
+  RAX = 0,
+  RBX = 3,
+  R12 = 12,
+  R13 = 13,
+} Register;
+
+#define VM_REGISTER RBX
+#define STACK_REGISTER R12
+#define SLOTS_REGISTER R13
+
+// Numbers are computed in xmm0, values are copied through it.
+#define XMM0 0
+
+typedef enum
+{
+  CC_EQUAL = 0x4,
+  CC_NOT_EQUAL = 0x5,
+} Condition;
+
+/**
+ * A rel32 operand at @p position, which must jump to the machine code of
+ * @p target.
+ */
+typedef struct
+{
+  size_t position;
+  int target;
+  // Bytecode targets are looked up in the native offsets, exits in the exit
+  // offsets.
+  bool is_exit;
+} Fixup;
+
+typedef struct
+{
+  uint8_t *code;
+  size_t count;
+  size_t capacity;
+  Fixup *fixups;
+  int fixup_count;
+  int fixup_capacity;
+  // Bytecode offsets at which guards leave to the interpreter.
+  int *exits;
+  int exit_count;
+  int exit_capacity;
+} Assembler;
+
+static void
+emit_bytes (Assembler *assembler, const void *bytes, size_t count)
+{
+  if (assembler->capacity < assembler->count + count)
+    {
+      size_t old_capacity = assembler->capacity;
+      while (assembler->capacity < assembler->count + count)
+        assembler->capacity = GROW_CAPACITY (assembler->capacity);
+      assembler->code = GROW_ARRAY (uint8_t, assembler->code, old_capacity,
+                                    assembler->capacity);
+    }
+  memcpy (assembler->code + assembler->count, bytes, count);
+  assembler->count += count;
+}
+
+static void
+emit_byte (Assembler *assembler, uint8_t byte)
+{
+  emit_bytes (assembler, &byte, 1);
+}
+
+static void
+emit_u32 (Assembler *assembler, uint32_t value)
+{
+  emit_bytes (assembler, &value, sizeof (value));
+}
+
+static void
+emit_u64 (Assembler *assembler, uint64_t value)
+{
+  emit_bytes (assembler, &value, sizeof (value));
+}
+
+/**
+ * An instruction with the register @p reg and the memory operand at @p base
+ * + @p displacement. The @p prefix is emitted before the REX prefix unless it
+ * is zero.
+ */
+static void
+emit_memory_op (Assembler *assembler, uint8_t prefix, bool wide,
+                const char *opcode, int reg, Register base,
+                int32_t displacement)
+{
+  if (prefix != 0)
+    emit_byte (assembler, prefix);
+  uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0)
+                | ((base & 8) ? 0x01 : 0);
+  if (rex != 0x40)
+    emit_byte (assembler, rex);
+  emit_bytes (assembler, opcode, strlen (opcode));
+
+  // r13 needs a displacement and r12 a SIB byte.
+  int mode = 2;
+  if (displacement == 0 && (base & 7) != 5)
+    mode = 0;
+  else if (displacement >= INT8_MIN && displacement <= INT8_MAX)
+    mode = 1;
+  emit_byte (assembler, (uint8_t)(mode << 6 | (reg & 7) << 3 | (base & 7)));
+  if ((base & 7) == 4)
+    emit_byte (assembler, 0x24);
+  if (mode == 1)
+    emit_byte (assembler, (uint8_t)(int8_t)displacement);
+  else if (mode == 2)
+    emit_u32 (assembler, (uint32_t)displacement);
+}
+
+/**
+ * Emit a rel32 placeholder which is resolved once all code is emitted.
+ */
+static void
+emit_fixup (Assembler *assembler, int target, bool is_exit)
+{
+  if (assembler->fixup_capacity < assembler->fixup_count + 1)
+    {
+      int old_capacity = assembler->fixup_capacity;
+      assembler->fixup_capacity = GROW_CAPACITY (old_capacity);
+      assembler->fixups = GROW_ARRAY (Fixup, assembler->fixups, old_capacity,
+                                      assembler->fixup_capacity);
+    }
+  assembler->fixups[assembler->fixup_count++]
+      = (Fixup){ assembler->count, target, is_exit };
+  emit_u32 (assembler, 0);
+}
+
+/**
+ * Jump to the instruction at @p target.
+ */
+static void
+emit_jump (Assembler *assembler, int target)
+{
+  emit_byte (assembler, 0xe9);
+  emit_fixup (assembler, target, false);
+}
+
+static void
+emit_jump_if (Assembler *assembler, Condition condition, int target)
+{
+  emit_byte (assembler, 0x0f);
+  emit_byte (assembler, 0x80 | condition);
+  emit_fixup (assembler, target, false);
+}
+
+/**
+ * Leave to the interpreter before the instruction at @p offset if
+ * @p condition holds.
+ */
+static void
+emit_guard (Assembler *assembler, Condition condition, int offset)
+{
+  if (assembler->exit_capacity < assembler->exit_count + 1)
+    {
+      int old_capacity = assembler->exit_capacity;
+      assembler->exit_capacity = GROW_CAPACITY (old_capacity);
+      assembler->exits = GROW_ARRAY (int, assembler->exits, old_capacity,
+                                     assembler->exit_capacity);
+    }
+  emit_byte (assembler, 0x0f);
+  emit_byte (assembler, 0x80 | condition);
+  emit_fixup (assembler, assembler->exit_count, true);
+  assembler->exits[assembler->exit_count++] = offset;
+}
+
+static void
+emit_load_stack_top (Assembler *assembler)
+{
+  // mov r12, [rbx + stack_top]
+  emit_memory_op (assembler, 0, true, "\x8b", STACK_REGISTER, VM_REGISTER,
+                  offsetof (VM, stack_top));
+}
+
+static void
+emit_store_stack_top (Assembler *assembler)
+{
+  // mov [rbx + stack_top], r12
+  emit_memory_op (assembler, 0, true, "\x89", STACK_REGISTER, VM_REGISTER,
+                  offsetof (VM, stack_top));
+}
+
+static void
+emit_load_rax (Assembler *assembler, uint64_t value)
+{
+  // mov rax, imm64
+  emit_bytes (assembler, "\x48\xb8", 2);
+  emit_u64 (assembler, value);
+}
+
+/**
+ * Move the top of the stack by @p count values.
+ */
+static void
+emit_adjust_stack (Assembler *assembler, int count)
+{
+  int32_t bytes = count * (int32_t)sizeof (Value);
+  // add r12, imm32 or sub r12, imm32
+  emit_bytes (assembler, bytes > 0 ? "\x49\x81\xc4" : "\x49\x81\xec", 3);
+  emit_u32 (assembler, (uint32_t)(bytes > 0 ? bytes : -bytes));
+}
+
+/**
+ * The displacement from the top of the stack of the value @p distance values
+ * below it.
+ */
+static int32_t
+stack_offset (int distance)
+{
+  return -(distance + 1) * (int32_t)sizeof (Value);
+}
+
+static void
+emit_load_value (Assembler *assembler, Register base, int32_t displacement)
+{
+  // movdqu xmm0, [base + displacement]
+  emit_memory_op (assembler, 0xf3, false, "\x0f\x6f", XMM0, base,
+                  displacement);
+}
+
+static void
+emit_store_value (Assembler *assembler, Register base, int32_t displacement)
+{
+  // movdqu [base + displacement], xmm0
+  emit_memory_op (assembler, 0xf3, false, "\x0f\x7f", XMM0, base,
+                  displacement);
+}
+
+/**
+ * Push the value at @p base + @p displacement.
+ */
+static void
+emit_push_value (Assembler *assembler, Register base, int32_t displacement)
+{
+  emit_load_value (assembler, base, displacement);
+  emit_store_value (assembler, STACK_REGISTER, 0);
+  emit_adjust_stack (assembler, 1);
+}
+
+/**
+ * Set the type of the value at @p base + @p displacement.
+ */
+static void
+emit_store_type (Assembler *assembler, Register base, int32_t displacement,
+                 ValueType type)
+{
+  // mov dword [base + displacement], imm32
+  emit_memory_op (assembler, 0, false, "\xc7", 0, base,
+                  displacement + (int32_t)offsetof (Value, type));
+  emit_u32 (assembler, type);
+}
+
+static void
+emit_push_literal (Assembler *assembler, ValueType type, uint32_t payload)
+{
+  emit_store_type (assembler, STACK_REGISTER, 0, type);
+  // mov qword [r12 + as], imm32
+  emit_memory_op (assembler, 0, true, "\xc7", 0, STACK_REGISTER,
+                  offsetof (Value, as));
+  emit_u32 (assembler, payload);
+  emit_adjust_stack (assembler, 1);
+}
+
+/**
+ * Compare the type of the value @p distance values below the top of the
+ * stack to @p type.
+ */
+static void
+emit_compare_type (Assembler *assembler, int distance, ValueType type)
+{
+  // cmp dword [r12 + offset], imm8
+  emit_memory_op (assembler, 0, false, "\x83", 7, STACK_REGISTER,
+                  stack_offset (distance) + (int32_t)offsetof (Value, type));
+  emit_byte (assembler, (uint8_t)type);
+}
+
+/**
+ * Leave before the instruction at @p offset unless the two values on top of
+ * the stack are numbers.
+ */
+static void
+emit_number_guards (Assembler *assembler, int offset)
+{
+  emit_compare_type (assembler, 0, VAL_NUMBER);
+  emit_guard (assembler, CC_NOT_EQUAL, offset);
+  emit_compare_type (assembler, 1, VAL_NUMBER);
+  emit_guard (assembler, CC_NOT_EQUAL, offset);
+}
+
+/**
+ * An SSE instruction on xmm0 and the payload of the value @p distance values
+ * below the top of the stack.
+ */
+static void
+emit_number_op (Assembler *assembler, uint8_t prefix, const char *opcode,
+                int distance)
+{
+  emit_memory_op (assembler, prefix, false, opcode, XMM0, STACK_REGISTER,
+                  stack_offset (distance) + (int32_t)offsetof (Value, as));
+}
+
+#define MOVSD_LOAD "\x0f\x10"
+#define MOVSD_STORE "\x0f\x11"
+
+/**
+ * Replace the two numbers on top of the stack by the result of the SSE
+ * instruction @p opcode.
+ */
+static void
+emit_arithmetic (Assembler *assembler, const char *opcode, int offset)
+{
+  emit_number_guards (assembler, offset);
+  emit_number_op (assembler, 0xf2, MOVSD_LOAD, 1);
+  emit_number_op (assembler, 0xf2, opcode, 0);
+  emit_number_op (assembler, 0xf2, MOVSD_STORE, 1);
+  emit_adjust_stack (assembler, -1);
+}
+
+/**
+ * Replace the two numbers on top of the stack by whether the one
+ * @p greater_distance values below the top is greater than the other one.
+ * Comparisons with NaN are false.
+ */
+static void
+emit_comparison (Assembler *assembler, int greater_distance, int offset)
+{
+  emit_number_guards (assembler, offset);
+  emit_number_op (assembler, 0xf2, MOVSD_LOAD, greater_distance);
+  // ucomisd xmm0, other
+  emit_number_op (assembler, 0x66, "\x0f\x2e", 1 - greater_distance);
+  // seta al; movzx eax, al
+  emit_bytes (assembler, "\x0f\x97\xc0\x0f\xb6\xc0", 6);
+  emit_store_type (assembler, STACK_REGISTER, stack_offset (1), VAL_BOOL);
+  // mov [r12 + as], rax
+  emit_memory_op (assembler, 0, true, "\x89", RAX, STACK_REGISTER,
+                  stack_offset (1) + (int32_t)offsetof (Value, as));
+  emit_adjust_stack (assembler, -1);
+}
+
+/**
+ * Load VM::globals into rax. Returns the displacement of @p member of global
+ * @p index.
+ */
+static int32_t
+emit_load_globals (Assembler *assembler, int index, int32_t member)
+{
+  // mov rax, [rbx + globals]
+  emit_memory_op (assembler, 0, true, "\x8b", RAX, VM_REGISTER,
+                  offsetof (VM, globals));
+  return index * (int32_t)sizeof (Global) + member;
+}
+
+/**
+ * Leave before the instruction at @p offset if global @p index is not
+ * defined. Leaves VM::globals in rax.
+ */
+static void
+emit_defined_guard (Assembler *assembler, int index, int offset)
+{
+  int32_t defined
+      = emit_load_globals (assembler, index, offsetof (Global, defined));
+  // cmp byte [rax + defined], 0
+  emit_memory_op (assembler, 0, false, "\x80", 7, RAX, defined);
+  emit_byte (assembler, 0);
+  emit_guard (assembler, CC_EQUAL, offset);
+}
+
+/**
+ * Call @p handler with the VM and, if @p has_operand, @p operand.
+ */
+static void
+emit_call (Assembler *assembler, void (*handler) (void), bool has_operand,
+           uint32_t operand)
+{
+  emit_store_stack_top (assembler);
+  // mov rdi, rbx
+  emit_bytes (assembler, "\x48\x89\xdf", 3);
+  if (has_operand)
+    {
+      // mov esi, imm32
+      emit_byte (assembler, 0xbe);
+      emit_u32 (assembler, operand);
+    }
+  emit_load_rax (assembler, (uint64_t)(uintptr_t)handler);
+  // call rax
+  emit_bytes (assembler, "\xff\xd0", 2);
+  emit_load_stack_top (assembler);
+}
+
+#define HANDLER(function) ((void (*) (void))(function))
+
+/**
+ * Store the top of the stack and leave to the interpreter, which continues
+ * at @p ip.
+ */
+static void
+emit_exit (Assembler *assembler, const uint8_t *ip)
+{
+  emit_store_stack_top (assembler);
+  emit_load_rax (assembler, (uint64_t)(uintptr_t)ip);
+  // pop r13; pop r12; pop rbx; ret
+  emit_bytes (assembler, "\x41\x5d\x41\x5c\x5b\xc3", 6);
+}
+
+static void
+emit_entry (Assembler *assembler)
+{
+  // push rbx; push r12; push r13; mov rbx, rdi; mov r13, rdx
+  emit_bytes (assembler, "\x53\x41\x54\x41\x55\x48\x89\xfb\x49\x89\xd5", 11);
+  emit_load_stack_top (assembler);
+  // jmp rsi
+  emit_bytes (assembler, "\xff\xe6", 2);
+}
+
+static int
+jump_target (const Chunk *chunk, int offset)
+{
+  uint8_t instruction = chunk->code[offset];
+  int size = instruction_size (chunk, offset);
+  const uint8_t *operand = chunk->code + offset + 1;
+  int jump = size == 2 ? operand[0] : (operand[0] << 8) | operand[1];
+  bool backward = instruction == OP_LOOP || instruction == OP_LOOP_LONG;
+  return offset + size + (backward ? -jump : jump);
+}
+
+/**
+ * Jump to the instruction at @p target if the value on top of the stack is
+ * nil or false.
+ */
+static void
+emit_jump_if_false (Assembler *assembler, int target)
+{
+  emit_compare_type (assembler, 0, VAL_NIL);
+  emit_jump_if (assembler, CC_EQUAL, target);
+  emit_compare_type (assembler, 0, VAL_BOOL);
+  // jne over the test of the payload
+  emit_bytes (assembler, "\x75\x00", 2);
+  size_t skip = assembler->count;
+  // cmp byte [r12 + as], 0
+  emit_memory_op (assembler, 0, false, "\x80", 7, STACK_REGISTER,
+                  stack_offset (0) + (int32_t)offsetof (Value, as));
+  emit_byte (assembler, 0);
+  emit_jump_if (assembler, CC_EQUAL, target);
+  assembler->code[skip - 1] = (uint8_t)(assembler->count - skip);
+}
+
+/**
+ * Emit the template of the instruction at @p offset.
+ */
+static void
+emit_instruction (Assembler *assembler, const Chunk *chunk, int offset)
+{
+  const uint8_t *code = chunk->code + offset;
+  // The operand of instructions on globals.
+  int global = 0;
+  if (instruction_size (chunk, offset) == 3)
+    global = code[1] << 8 | code[2];
+
+  switch (code[0])
+    {
+    case OP_CONSTANT:
+      emit_load_rax (assembler,
+                     (uint64_t)(uintptr_t)&chunk->constants.values[code[1]]);
+      emit_push_value (assembler, RAX, 0);
+      break;
+    case OP_NIL:
+      emit_push_literal (assembler, VAL_NIL, 0);
+      break;
+    case OP_TRUE:
+      emit_push_literal (assembler, VAL_BOOL, 1);
+      break;
+    case OP_FALSE:
+      emit_push_literal (assembler, VAL_BOOL, 0);
+      break;
+    case OP_POP:
+      emit_adjust_stack (assembler, -1);
+      break;
+    case OP_GET_LOCAL:
+      emit_push_value (assembler, SLOTS_REGISTER,
+                       code[1] * (int32_t)sizeof (Value));
+      break;
+    case OP_SET_LOCAL:
+      emit_load_value (assembler, STACK_REGISTER, stack_offset (0));
+      emit_store_value (assembler, SLOTS_REGISTER,
+                        code[1] * (int32_t)sizeof (Value));
+      break;
+    case OP_GET_GLOBAL:
+      emit_defined_guard (assembler, global, offset);
+      emit_push_value (assembler, RAX,
+                       global * (int32_t)sizeof (Global)
+                           + (int32_t)offsetof (Global, value));
+      break;
+    case OP_DEFINE_GLOBAL:
+      {
+        int32_t value
+            = emit_load_globals (assembler, global, offsetof (Global, value));
+        emit_load_value (assembler, STACK_REGISTER, stack_offset (0));
+        emit_store_value (assembler, RAX, value);
+        // mov byte [rax + defined], 1
+        emit_memory_op (assembler, 0, false, "\xc6", 0, RAX,
+                        global * (int32_t)sizeof (Global)
+                            + (int32_t)offsetof (Global, defined));
+        emit_byte (assembler, 1);
+        emit_adjust_stack (assembler, -1);
+        break;
+      }
+    case OP_SET_GLOBAL:
+      emit_defined_guard (assembler, global, offset);
+      emit_load_value (assembler, STACK_REGISTER, stack_offset (0));
+      emit_store_value (assembler, RAX,
+                        global * (int32_t)sizeof (Global)
+                            + (int32_t)offsetof (Global, value));
+      break;
+    case OP_GET_UPVALUE:
+      emit_call (assembler, HANDLER (op_get_upvalue), true, code[1]);
+      break;
+    case OP_SET_UPVALUE:
+      emit_call (assembler, HANDLER (op_set_upvalue), true, code[1]);
+      break;
+    case OP_EQUAL:
+      emit_call (assembler, HANDLER (op_equal), false, 0);
+      break;
+    case OP_GREATER:
+      emit_comparison (assembler, 1, offset);
+      break;
+    case OP_LESS:
+    case OP_LESS_NUM:
+      emit_comparison (assembler, 0, offset);
+      break;
+    // Strings are added by the interpreter.
+    case OP_ADD:
+    case OP_ADD_NUM:
+      emit_arithmetic (assembler, "\x0f\x58", offset);
+      break;
+    case OP_SUBTRACT:
+      emit_arithmetic (assembler, "\x0f\x5c", offset);
+      break;
+    case OP_MULTIPLY:
+      emit_arithmetic (assembler, "\x0f\x59", offset);
+      break;
+    case OP_DIVIDE:
+      emit_arithmetic (assembler, "\x0f\x5e", offset);
+      break;
+    case OP_NOT:
+      emit_call (assembler, HANDLER (op_not), false, 0);
+      break;
+    case OP_PRINT:
+      emit_call (assembler, HANDLER (op_print), false, 0);
+      break;
+    case OP_JUMP:
+    case OP_JUMP_LONG:
+    case OP_LOOP:
+    case OP_LOOP_LONG:
+      emit_jump (assembler, jump_target (chunk, offset));
+      break;
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_LONG:
+      emit_jump_if_false (assembler, jump_target (chunk, offset));
+      break;
+    default:
+      // Calls, returns, closures and string additions change frames or
+      // allocate. Negation and closing upvalues are rare in hot code.
+      emit_exit (assembler, code);
+      break;
+    }
+}
+
+#undef HANDLER
+
+static CodeArena *
+new_arena (size_t size)
+{
+  void *memory = mmap (NULL, size, PROT_READ | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+    return NULL;
+  CodeArena *arena = ALLOCATE (CodeArena, 1);
+  arena->next = NULL;
+  arena->memory = memory;
+  arena->size = size;
+  arena->used = 0;
+  arena->chunks = 0;
+  return arena;
+}
+
+/**
+ * Copy the code of @p assembler into executable memory of @p jit. Returns
+ * NULL on failure.
+ */
+static uint8_t *
+make_executable (JitState *jit, const Assembler *assembler,
+                 CodeArena **arena_out)
+{
+  size_t size = (assembler->count + CODE_ALIGNMENT - 1)
+                & ~(size_t)(CODE_ALIGNMENT - 1);
+  CodeArena *arena = jit->arenas;
+  if (arena == NULL || arena->size - arena->used < size)
+    {
+      size_t page_size = (size_t)sysconf (_SC_PAGESIZE);
+      size_t arena_size = size > ARENA_SIZE ? size : ARENA_SIZE;
+      arena = new_arena ((arena_size + page_size - 1) & ~(page_size - 1));
+      if (arena == NULL)
+        return NULL;
+      // Large code fills its arena, so the current one stays in front.
+      if (jit->arenas != NULL && size > ARENA_SIZE)
+        {
+          arena->next = jit->arenas->next;
+          jit->arenas->next = arena;
+        }
+      else
+        {
+          arena->next = jit->arenas;
+          jit->arenas = arena;
+        }
+    }
+
+  // The memory is never writable and executable at the same time. No machine
+  // code of this VM runs while it compiles, so the arena may be writable for
+  // a moment.
+  uint8_t *memory = arena->memory + arena->used;
+  if (mprotect (arena->memory, arena->size, PROT_READ | PROT_WRITE) != 0)
+    return NULL;
+  memcpy (memory, assembler->code, assembler->count);
+  if (mprotect (arena->memory, arena->size, PROT_READ | PROT_EXEC) != 0)
+    return NULL;
+  arena->used += size;
+  arena->chunks++;
+  *arena_out = arena;
+  return memory;
+}
+
+/**
+ * Translate every instruction of @p chunk into its template.
+ */
+static JitCode *
+compile_chunk (JitState *jit, const Chunk *chunk)
+{
+  Assembler assembler = { 0 };
+  uint32_t *native_offsets = ALLOCATE (uint32_t, chunk->count + 1);
+
+  emit_entry (&assembler);
+  for (int offset = 0; offset < chunk->count;
+       offset += instruction_size (chunk, offset))
+    {
+      native_offsets[offset] = (uint32_t)assembler.count;
+      emit_instruction (&assembler, chunk, offset);
+    }
+  native_offsets[chunk->count] = (uint32_t)assembler.count;
+  emit_exit (&assembler, chunk->code + chunk->count);
+
+  // The exits of the guards come after the main code.
+  uint32_t *exit_offsets = ALLOCATE (uint32_t, assembler.exit_count);
+  for (int i = 0; i < assembler.exit_count; ++i)
+    {
+      exit_offsets[i] = (uint32_t)assembler.count;
+      emit_exit (&assembler, chunk->code + assembler.exits[i]);
+    }
+
+  for (int i = 0; i < assembler.fixup_count; ++i)
+    {
+      const Fixup *fixup = &assembler.fixups[i];
+      uint32_t target = fixup->is_exit ? exit_offsets[fixup->target]
+                                       : native_offsets[fixup->target];
+      int32_t relative = (int32_t)target - (int32_t)(fixup->position + 4);
+      memcpy (assembler.code + fixup->position, &relative, sizeof (relative));
+    }
+
+  CodeArena *arena = NULL;
+  uint8_t *memory = make_executable (jit, &assembler, &arena);
+  JitCode *code = NULL;
+  if (memory != NULL)
+    {
+      code = ALLOCATE (JitCode, 1);
+      code->arena = arena;
+      code->memory = memory;
+      code->size = assembler.count;
+      code->native_offsets = native_offsets;
+      code->bytecode_count = chunk->count;
+    }
+  else
+    FREE_ARRAY (uint32_t, native_offsets, chunk->count + 1);
+
+  FREE_ARRAY (uint32_t, exit_offsets, assembler.exit_count);
+  FREE_ARRAY (int, assembler.exits, assembler.exit_capacity);
+  FREE_ARRAY (Fixup, assembler.fixups, assembler.fixup_capacity);
+  FREE_ARRAY (uint8_t, assembler.code, assembler.capacity);
+  return code;
+}
+
+static void
+free_code (JitState *jit, JitCode *code)
+{
+  CodeArena *arena = code->arena;
+  if (--arena->chunks == 0)
+    {
+      CodeArena **link = &jit->arenas;
+      while (*link != arena)
+        link = &(*link)->next;
+      *link = arena->next;
+      munmap (arena->memory, arena->size);
+      FREE (CodeArena, arena);
+    }
+  FREE_ARRAY (uint32_t, code->native_offsets, code->bytecode_count + 1);
+  FREE (JitCode, code);
+}
+
+JitState *
+jit_new (void)
+{
+  JitState *jit = ALLOCATE (JitState, 1);
+  jit->count = 0;
+  jit->capacity = 0;
+  jit->slots = NULL;
+  jit->arenas = NULL;
+  return jit;
+}
+
+void
+jit_free (JitState *jit)
+{
+  if (jit == NULL)
+    return;
+  for (int i = 0; i < jit->capacity; ++i)
+    if (jit->slots[i].code != NULL)
+      free_code (jit, jit->slots[i].code);
+  // Only arenas in which no code could be placed are left.
+  while (jit->arenas != NULL)
+    {
+      CodeArena *next = jit->arenas->next;
+      munmap (jit->arenas->memory, jit->arenas->size);
+      FREE (CodeArena, jit->arenas);
+      jit->arenas = next;
+    }
+  FREE_ARRAY (JitSlot, jit->slots, jit->capacity);
+  FREE (JitState, jit);
+}
+
+static JitSlot *
+find_slot (JitSlot *slots, int capacity, uint64_t chunk_id)
+{
+  // Chunk ids are consecutive, so they are spread well without hashing.
+  uint64_t index = chunk_id & (capacity - 1);
+  for (;;)
+    {
+      JitSlot *slot = &slots[index];
+      if (slot->chunk_id == chunk_id || slot->chunk_id == 0)
+        return slot;
+      index = (index + 1) & (capacity - 1);
+    }
+}
+
+static JitSlot *
+get_slot (JitState *jit, uint64_t chunk_id)
+{
+  if (jit->count + 1 > jit->capacity * 3 / 4)
+    {
+      int capacity = GROW_CAPACITY (jit->capacity);
+      JitSlot *slots = ALLOCATE (JitSlot, capacity);
+      memset (slots, 0, capacity * sizeof (JitSlot));
+      for (int i = 0; i < jit->capacity; ++i)
+        if (jit->slots[i].chunk_id != 0)
+          *find_slot (slots, capacity, jit->slots[i].chunk_id)
+              = jit->slots[i];
+      FREE_ARRAY (JitSlot, jit->slots, jit->capacity);
+      jit->slots = slots;
+      jit->capacity = capacity;
+    }
+
+  JitSlot *slot = find_slot (jit->slots, jit->capacity, chunk_id);
+  if (slot->chunk_id == 0)
+    {
+      slot->chunk_id = chunk_id;
+      jit->count++;
+    }
+  return slot;
+}
+
+/**
+ * Empty @p slot. Later slots which were pushed past it move back, so that
+ * find_slot() still reaches them.
+ */
+static void
+remove_slot (JitState *jit, JitSlot *slot)
+{
+  uint64_t mask = jit->capacity - 1;
+  uint64_t hole = slot - jit->slots;
+  for (uint64_t index = (hole + 1) & mask; jit->slots[index].chunk_id != 0;
+       index = (index + 1) & mask)
+    {
+      uint64_t home = jit->slots[index].chunk_id & mask;
+      if (((index - home) & mask) >= ((index - hole) & mask))
+        {
+          jit->slots[hole] = jit->slots[index];
+          hole = index;
+        }
+    }
+  memset (&jit->slots[hole], 0, sizeof (JitSlot));
+  jit->count--;
+}
+
+void
+jit_forget (JitState *jit, const Chunk *chunk)
+{
+  if (jit == NULL || jit->capacity == 0)
+    return;
+  JitSlot *slot = find_slot (jit->slots, jit->capacity, chunk->id);
+  if (slot->chunk_id == 0)
+    return;
+  if (slot->code != NULL)
+    free_code (jit, slot->code);
+  remove_slot (jit, slot);
+}
+
+int
+jit_code_count (const JitState *jit)
+{
+  int count = 0;
+  if (jit != NULL)
+    for (int i = 0; i < jit->capacity; ++i)
+      if (jit->slots[i].code != NULL)
+        count++;
+  return count;
+}
+
+const uint8_t *
+jit_enter (VM *vm, const Chunk *chunk, const uint8_t *ip)
+{
+  JitSlot *slot = get_slot (vm->jit, chunk->id);
+  if (slot->code == NULL)
+    {
+      if (slot->failed || ++slot->entries < JIT_HOT_THRESHOLD)
+        return ip;
+      slot->code = compile_chunk (vm->jit, chunk);
+      if (slot->code == NULL)
+        {
+          slot->failed = true;
+          return ip;
+        }
+    }
+  const JitCode *code = slot->code;
+  JitEntry entry = (JitEntry)(void *)code->memory;
+  return entry (vm, code->memory + code->native_offsets[ip - chunk->code],
+                current_frame (vm)->slots);
+}
+
+#else
+
+JitState *
+jit_new (void)
+{
+  return NULL;
+}
+
+void
+jit_free (JitState *jit)
+{
+  (void)jit;
+}
+
+void
+jit_forget (JitState *jit, const Chunk *chunk)
+{
+  (void)jit;
+  (void)chunk;
+}
+
+int
+jit_code_count (const JitState *jit)
+{
+  (void)jit;
+  return 0;
+}
+
+const uint8_t *
+jit_enter (VM *vm, const Chunk *chunk, const uint8_t *ip)
+{
+  (void)vm;
+  (void)chunk;
+  return ip;
+}
+
+#endif
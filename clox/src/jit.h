@@ -0,0 +1,42 @@
+#pragma once
+
+#include "chunk.h"
+#include "vm.h"
+
+/**
+ * A chunk counts as hot and is compiled to machine code once it has been
+ * entered this many times. Entries are calls, returns into the chunk and
+ * loop iterations.
+ */
+#define JIT_HOT_THRESHOLD 8
+
+/**
+ * Create the JIT compiler of a VM. Returns NULL if machine code cannot be
+ * generated on this platform, in which case everything is interpreted.
+ */
+JitState *jit_new (void);
+
+/**
+ * Free @p jit together with all machine code it generated.
+ */
+void jit_free (JitState *jit);
+
+/**
+ * Free the machine code of @p chunk and forget how often it was entered. Must
+ * be called before a chunk which may have run on the VM of @p jit is freed.
+ * Chunk ids are never reused, so forgetting is only about memory.
+ */
+void jit_forget (JitState *jit, const Chunk *chunk);
+
+/**
+ * Returns the number of chunks @p jit holds machine code for.
+ */
+int jit_code_count (const JitState *jit);
+
+/**
+ * Called whenever the VM enters @p chunk at @p ip. Once the chunk is hot, the
+ * machine code of the chunk runs from @p ip until it reaches an instruction
+ * which it leaves to the interpreter. Returns the instruction at which the
+ * interpreter continues.
+ */
+const uint8_t *jit_enter (VM *vm, const Chunk *chunk, const uint8_t *ip);
@@ -1,20 +1,41 @@
+#include "batch.h"
 #include "common.h"
+#include "memory.h"
 #include "vm.h"
+#include <errno.h>
 #include <getopt.h>
+#include <lox_source.h>
+#include <lox_writer.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 VM vm;
 
+// Run all scripts given on the command line with run_batch().
+static bool batch_mode = false;
+// Number of threads for batch mode. Zero means one per CPU.
+static int batch_jobs = 0;
+// Print the statistics of the object pools when clox exits.
+static bool pool_stats = false;
+
 static void
 print_help ()
 {
   printf ("Usage: clox [options] [path]\n");
+  printf ("       clox --batch [options] [path...]\n");
+  printf ("Use \"-\" as path to read the script from standard input.\n");
   printf ("Options:\n");
   printf ("  --tokens\t\tPrint tokens\n");
   printf ("  --disassemble\t\tDisassemble bytecode\n");
   printf ("  --trace_execution\tTrace execution\n");
   printf ("  -n, --no_execution\tDo not execute code\n");
+  printf ("  --jit\t\t\tCompile hot code to machine code (x86-64 Linux)\n");
+  printf ("  --no-jit\t\tOnly interpret bytecode (default)\n");
+  printf ("  --batch\t\tRun each script or .lox file in the given\n"
+          "\t\t\tdirectories and report their output and status\n");
+  printf ("  -j, --jobs=<n>\t\tNumber of threads for --batch\n");
+  printf ("  --pool_stats\t\tPrint object pool statistics on exit\n");
   printf ("  -h, --help\t\tPrint this help message\n");
 }
 
@@ -26,11 +47,15 @@ parse_options (int argc, char **argv, int *parsed_argc)
           { "disassemble", no_argument, 0, OPT_DISASSEMBLE },
           { "trace_execution", no_argument, 0, OPT_TRACE_EXECUTION },
           { "no_execution", no_argument, 0, OPT_NO_EXECUTION },
+          { "jit", no_argument, 0, OPT_JIT },
+          { "no-jit", no_argument, 0, 'J' },
+          { "batch", no_argument, 0, 'b' },
+          { "jobs", required_argument, 0, 'j' },
+          { "pool_stats", no_argument, 0, 'p' },
           { "help", no_argument, 0, 'h' },
           { 0, 0, 0, 0 } };
   int longind, opt;
-  *parsed_argc = 0;
-  const char *optstring = "hn";
+  const char *optstring = "hnj:";
   CommandLineOptions options = 0;
   while ((opt = getopt_long (argc, argv, optstring, longopts, &longind)) != -1)
     {
@@ -44,72 +69,82 @@ parse_options (int argc, char **argv, int *parsed_argc)
           print_help ();
           exit (1);
         }
+      // The last of --jit and --no-jit wins.
+      if (opt == 'J')
+        {
+          options &= ~OPT_JIT;
+          continue;
+        }
+      if (opt == 'b')
+        {
+          batch_mode = true;
+          continue;
+        }
+      if (opt == 'p')
+        {
+          pool_stats = true;
+          continue;
+        }
+      if (opt == 'j')
+        {
+          batch_jobs = atoi (optarg);
+          continue;
+        }
       if (opt == 'n')
         {
           opt = OPT_NO_EXECUTION;
         }
 
       options |= opt;
-      *parsed_argc += 1;
     }
+  // Non-option arguments have been moved to the end of argv.
+  *parsed_argc = optind - 1;
   return options;
 }
 
+/**
+ * Print the statistics of the object pools if asked to. Called while the
+ * objects of the VM are still alive, so they show up as blocks in use.
+ */
+static void
+report_pools (void)
+{
+  if (pool_stats)
+    print_pool_statistics (stderr);
+}
+
 static void
 repl ()
 {
   char line[1024];
   for (;;)
     {
-      printf ("> ");
+      lox_writer_puts (vm.out, "> ");
+      // Show the prompt and all output of the previous line.
+      lox_writer_flush (vm.out);
       if (!fgets (line, sizeof (line), stdin))
         {
-          printf ("\n");
+          lox_writer_putc (vm.out, '\n');
           break;
         }
-      interpret (&vm, line);
+      interpret (&vm, line, strlen (line));
     }
 }
 
-static char *
-read_file (const char *path)
+static void
+run_file (const char *file)
 {
-  FILE *file = fopen (path, "rb");
-  if (file == NULL)
+  LoxSource source;
+  if (!lox_source_open (&source, file))
     {
-      fprintf (stderr, "Could not open file \"%s\".\n", path);
+      fprintf (stderr, "Could not read file \"%s\": %s.\n", file,
+               strerror (errno));
       exit (74);
     }
-
-  fseek (file, 0L, SEEK_END);
-  size_t fileSize = ftell (file);
-  rewind (file);
-
-  char *buffer = (char *)malloc (fileSize + 1);
-  if (buffer == NULL)
-    {
-      fprintf (stderr, "Not enough memory to read \"%s\".\n", path);
-      exit (74);
-    }
-
-  size_t bytesRead = fread (buffer, sizeof (char), fileSize, file);
-  if (bytesRead < fileSize)
-    {
-      fprintf (stderr, "Could not read file \"%s\".\n", path);
-      exit (74);
-    }
-  buffer[bytesRead] = '\0';
-
-  fclose (file);
-  return buffer;
-}
-
-static void
-run_file (const char *file)
-{
-  char *source = read_file (file);
-  InterpretResult result = interpret (&vm, source);
-  free (source);
+  InterpretResult result = interpret (&vm, source.data, source.length);
+  lox_source_close (&source);
+  if (result != INTERPRET_OK)
+    report_pools ();
   if (result == INTERPRET_COMPILE_ERROR)
     exit (65);
   if (result == INTERPRET_RUNTIME_ERROR)
@@ -121,11 +156,25 @@ main (int argc, char **argv)
 {
   int parsed_argc;
   CommandLineOptions options = parse_options (argc, argv, &parsed_argc);
-  set_option (options);
-
-  init_vm (&vm);
 
   int remaining_argc = argc - parsed_argc;
+  if (batch_mode)
+    {
+      if (remaining_argc < 2)
+        {
+          fprintf (stderr, "Usage: clox --batch [options] [path...]\n");
+          exit (64);
+        }
+      // The VMs of the workers are gone by now, but the slabs show how much
+      // memory the pools needed.
+      int status = run_batch (argv + parsed_argc + 1, remaining_argc - 1,
+                              options, batch_jobs);
+      report_pools ();
+      return status;
+    }
+
+  init_vm (&vm, options);
+
   if (remaining_argc == 1)
     repl ();
   else if (remaining_argc == 2)
@@ -136,6 +185,7 @@ main (int argc, char **argv)
       exit (64);
     }
 
+  report_pools ();
   free_vm (&vm);
   return 0;
 }
@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include <stdlib.h>
 
 #include "memory.h"
@@ -16,3 +17,250 @@ reallocate (void *data, size_t old_size, size_t new_size)
     exit (1);
   return result;
 }
+
+// Blocks are carved out of slabs, which are never returned to the system.
+#define SLAB_SIZE (16 * 1024)
+
+typedef struct FreeBlock
+{
+  struct FreeBlock *next;
+} FreeBlock;
+
+/**
+ * The header of a slab. The blocks of one size class follow it.
+ */
+typedef struct Slab
+{
+  struct Slab *next;
+  // Keeps the blocks aligned to POOL_GRANULARITY.
+  size_t padding;
+} Slab;
+
+typedef struct Pool
+{
+  // All pools, also those of finished threads.
+  struct Pool *next;
+  // Whether a thread allocates from this pool. Pools of finished threads are
+  // taken over by new threads.
+  bool in_use;
+  Slab *slabs;
+  FreeBlock *free_blocks[POOL_CLASS_COUNT];
+  // The part of the newest slab of each class which no block has used yet.
+  char *fresh[POOL_CLASS_COUNT];
+  char *fresh_end[POOL_CLASS_COUNT];
+  // Blocks allocated on one thread may be freed on another, so only the sums
+  // over all pools are meaningful. Only the thread owning the pool changes
+  // the counters with add_count(), pool_statistics() reads them on any
+  // thread with read_count().
+  long slab_count[POOL_CLASS_COUNT];
+  long blocks_in_use[POOL_CLASS_COUNT];
+  long free_count[POOL_CLASS_COUNT];
+  long requested_bytes;
+  long large_allocations;
+  long large_bytes;
+} Pool;
+
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static Pool *pools = NULL;
+// Tells when a thread finishes, so its pool can be taken over.
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static __thread Pool *thread_pool = NULL;
+
+static void
+release_pool (void *data)
+{
+  Pool *pool = data;
+  pthread_mutex_lock (&pools_lock);
+  pool->in_use = false;
+  pthread_mutex_unlock (&pools_lock);
+}
+
+static void
+create_pool_key (void)
+{
+  pthread_key_create (&pool_key, release_pool);
+}
+
+static Pool *
+acquire_pool (void)
+{
+  pthread_once (&pool_key_once, create_pool_key);
+  pthread_mutex_lock (&pools_lock);
+  Pool *pool = pools;
+  while (pool != NULL && pool->in_use)
+    pool = pool->next;
+  if (pool == NULL)
+    {
+      pool = calloc (1, sizeof (Pool));
+      if (pool == NULL)
+        exit (1);
+      pool->next = pools;
+      pools = pool;
+    }
+  pool->in_use = true;
+  pthread_mutex_unlock (&pools_lock);
+
+  pthread_setspecific (pool_key, pool);
+  thread_pool = pool;
+  return pool;
+}
+
+static inline void
+add_count (long *counter, long delta)
+{
+  __atomic_store_n (counter, *counter + delta, __ATOMIC_RELAXED);
+}
+
+static inline long
+read_count (const long *counter)
+{
+  return __atomic_load_n (counter, __ATOMIC_RELAXED);
+}
+
+static void
+add_slab (Pool *pool, int size_class)
+{
+  Slab *slab = malloc (SLAB_SIZE);
+  if (slab == NULL)
+    exit (1);
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  add_count (&pool->slab_count[size_class], 1);
+  pool->fresh[size_class] = (char *)(slab + 1);
+  pool->fresh_end[size_class] = (char *)slab + SLAB_SIZE;
+}
+
+void *
+pool_allocate (size_t size)
+{
+  Pool *pool = thread_pool != NULL ? thread_pool : acquire_pool ();
+  if (size > POOL_MAX_SIZE)
+    {
+      add_count (&pool->large_allocations, 1);
+      add_count (&pool->large_bytes, (long)size);
+      return reallocate (NULL, 0, size);
+    }
+
+  int size_class = size == 0 ? 0 : (int)((size - 1) / POOL_GRANULARITY);
+  add_count (&pool->blocks_in_use[size_class], 1);
+  add_count (&pool->requested_bytes, (long)size);
+  FreeBlock *block = pool->free_blocks[size_class];
+  if (block != NULL)
+    {
+      pool->free_blocks[size_class] = block->next;
+      add_count (&pool->free_count[size_class], -1);
+      return block;
+    }
+
+  size_t block_size = (size_t)(size_class + 1) * POOL_GRANULARITY;
+  if ((size_t)(pool->fresh_end[size_class] - pool->fresh[size_class])
+      < block_size)
+    add_slab (pool, size_class);
+  void *result = pool->fresh[size_class];
+  pool->fresh[size_class] += block_size;
+  return result;
+}
+
+void
+pool_free (void *block, size_t size)
+{
+  if (block == NULL)
+    return;
+  Pool *pool = thread_pool != NULL ? thread_pool : acquire_pool ();
+  if (size > POOL_MAX_SIZE)
+    {
+      add_count (&pool->large_allocations, -1);
+      add_count (&pool->large_bytes, -(long)size);
+      reallocate (block, size, 0);
+      return;
+    }
+
+  int size_class = size == 0 ? 0 : (int)((size - 1) / POOL_GRANULARITY);
+  add_count (&pool->blocks_in_use[size_class], -1);
+  add_count (&pool->requested_bytes, -(long)size);
+  FreeBlock *free_block = block;
+  free_block->next = pool->free_blocks[size_class];
+  pool->free_blocks[size_class] = free_block;
+  add_count (&pool->free_count[size_class], 1);
+}
+
+PoolStatistics
+pool_statistics (void)
+{
+  PoolStatistics statistics = { 0 };
+  long slab_counts[POOL_CLASS_COUNT] = { 0 };
+  long blocks_in_use[POOL_CLASS_COUNT] = { 0 };
+  long free_counts[POOL_CLASS_COUNT] = { 0 };
+  long requested_bytes = 0;
+  long large_allocations = 0;
+  long large_bytes = 0;
+
+  pthread_mutex_lock (&pools_lock);
+  for (const Pool *pool = pools; pool != NULL; pool = pool->next)
+    {
+      for (int i = 0; i < POOL_CLASS_COUNT; ++i)
+        {
+          slab_counts[i] += read_count (&pool->slab_count[i]);
+          blocks_in_use[i] += read_count (&pool->blocks_in_use[i]);
+          free_counts[i] += read_count (&pool->free_count[i]);
+        }
+      requested_bytes += read_count (&pool->requested_bytes);
+      large_allocations += read_count (&pool->large_allocations);
+      large_bytes += read_count (&pool->large_bytes);
+    }
+  pthread_mutex_unlock (&pools_lock);
+
+  for (int i = 0; i < POOL_CLASS_COUNT; ++i)
+    {
+      PoolClassStatistics *class_statistics = &statistics.classes[i];
+      class_statistics->block_size = (size_t)(i + 1) * POOL_GRANULARITY;
+      class_statistics->slab_bytes = (size_t)slab_counts[i] * SLAB_SIZE;
+      class_statistics->blocks_in_use = (size_t)blocks_in_use[i];
+      class_statistics->free_blocks = (size_t)free_counts[i];
+      statistics.slab_bytes += class_statistics->slab_bytes;
+      statistics.block_bytes
+          += class_statistics->blocks_in_use * class_statistics->block_size;
+    }
+  statistics.requested_bytes = (size_t)requested_bytes;
+  statistics.free_bytes = statistics.slab_bytes - statistics.block_bytes;
+  statistics.large_allocations = (size_t)large_allocations;
+  statistics.large_bytes = (size_t)large_bytes;
+  return statistics;
+}
+
+static double
+percent (size_t part, size_t whole)
+{
+  return whole == 0 ? 0 : 100.0 * (double)part / (double)whole;
+}
+
+void
+print_pool_statistics (FILE *out)
+{
+  PoolStatistics statistics = pool_statistics ();
+  fprintf (out, "== pools ==\n");
+  fprintf (out, "%10s %10s %10s %10s\n", "block size", "slab bytes",
+           "in use", "free");
+  for (int i = 0; i < POOL_CLASS_COUNT; ++i)
+    {
+      const PoolClassStatistics *class_statistics = &statistics.classes[i];
+      if (class_statistics->slab_bytes == 0)
+        continue;
+      fprintf (out, "%10zu %10zu %10zu %10zu\n", class_statistics->block_size,
+               class_statistics->slab_bytes, class_statistics->blocks_in_use,
+               class_statistics->free_blocks);
+    }
+  fprintf (out, "slabs: %zu bytes, %zu in blocks in use (%.1f%%)\n",
+           statistics.slab_bytes, statistics.block_bytes,
+           percent (statistics.block_bytes, statistics.slab_bytes));
+  fprintf (out, "rounding to size classes: %zu bytes (%.1f%% of blocks)\n",
+           statistics.block_bytes - statistics.requested_bytes,
+           percent (statistics.block_bytes - statistics.requested_bytes,
+                    statistics.block_bytes));
+  fprintf (out, "free or never used: %zu bytes (%.1f%% of slabs)\n",
+           statistics.free_bytes,
+           percent (statistics.free_bytes, statistics.slab_bytes));
+  fprintf (out, "large allocations: %zu with %zu bytes\n",
+           statistics.large_allocations, statistics.large_bytes);
+}
@@ -2,6 +2,8 @@
 
 #include "common.h"
 
+#include <stdio.h>
+
 #define ALLOCATE(type, count)                                                 \
   (type *)reallocate (NULL, 0, sizeof (type) * (count))
 
@@ -21,3 +23,64 @@
  * zero, indicating a deletion of the buffer.
  */
 void *reallocate (void *data, size_t old_size, size_t new_size);
+
+/**
+ * Objects are allocated from pools with a free list for each size class.
+ * Sizes are rounded up to a multiple of POOL_GRANULARITY, and larger
+ * allocations than POOL_MAX_SIZE bytes go to reallocate(). Every thread has
+ * its own pool, so allocation takes no lock. Blocks may be freed on any
+ * thread and then serve the next allocations of that thread.
+ */
+#define POOL_GRANULARITY 16
+#define POOL_MAX_SIZE 256
+#define POOL_CLASS_COUNT (POOL_MAX_SIZE / POOL_GRANULARITY)
+
+/**
+ * A block of at least @p size bytes, aligned to POOL_GRANULARITY bytes.
+ */
+void *pool_allocate (size_t size);
+
+/**
+ * Return @p block, which was allocated with @p size bytes.
+ */
+void pool_free (void *block, size_t size);
+
+typedef struct
+{
+  size_t block_size;
+  // Memory taken from the system for blocks of this size.
+  size_t slab_bytes;
+  size_t blocks_in_use;
+  // Freed blocks waiting to be reused.
+  size_t free_blocks;
+} PoolClassStatistics;
+
+/**
+ * The pools of all threads together.
+ */
+typedef struct
+{
+  PoolClassStatistics classes[POOL_CLASS_COUNT];
+  size_t slab_bytes;
+  // The bytes requested for blocks in use. Their block sizes add up to
+  // block_bytes, the difference is lost to rounding up to size classes.
+  size_t requested_bytes;
+  size_t block_bytes;
+  // Bytes in freed blocks and in slabs which no block has used yet.
+  size_t free_bytes;
+  // Allocations too large for the pools.
+  size_t large_allocations;
+  size_t large_bytes;
+} PoolStatistics;
+
+/**
+ * Sum up the statistics of all pools. It may be called on any thread at any
+ * time, but the result is only exact while no other thread allocates or
+ * frees.
+ */
+PoolStatistics pool_statistics (void);
+
+/**
+ * Print pool_statistics() with the fragmentation of the pools to @p out.
+ */
+void print_pool_statistics (FILE *out);
@@ -2,29 +2,83 @@
 #include "memory.h"
 #include "string.h"
 #include "value.h"
-#include <stdio.h>
+#include <lox_writer.h>
 
-Obj *allocated_objs;
+#define FREE_OBJ(type, pointer) pool_free ((pointer), sizeof (type))
+
+/**
+ * Concatenations of at least this many characters are ropes, shorter ones
+ * are copied right away.
+ */
+#define ROPE_MIN_LENGTH 128
+
+/**
+ * A concatenation whose characters are only copied once they are read.
+ * Copying both operands on every `+` would make building a string in a loop
+ * quadratic in time and, as nothing is freed before the VM, in memory.
+ */
+typedef struct
+{
+  ObjString string;
+  const ObjString *lhs;
+  const ObjString *rhs;
+} ObjRope;
+
+/**
+ * Where a string copied from characters stores them.
+ */
+static char *
+inline_chars (ObjString *string)
+{
+  return (char *)(string + 1);
+}
 
 static void
 free_object (Obj *object)
 {
   switch (object->type)
     {
+    case OBJ_CLOSURE:
+      {
+        ObjClosure *closure = (ObjClosure *)object;
+        pool_free (closure, sizeof (ObjClosure)
+                                + closure->upvalue_count
+                                      * sizeof (ObjUpvalue *));
+        break;
+      }
+    case OBJ_FUNCTION:
+      {
+        ObjFunction *function = (ObjFunction *)object;
+        // Also frees the name, which is one of the objects of the chunk.
+        free_chunk (&function->chunk);
+        FREE_OBJ (ObjFunction, function);
+        break;
+      }
+    case OBJ_NATIVE:
+      FREE_OBJ (ObjNative, object);
+      break;
     case OBJ_STRING:
       {
         ObjString *string = (ObjString *)object;
+        if (string->chars == inline_chars (string))
+          {
+            pool_free (string, sizeof (ObjString) + string->length + 1);
+            break;
+          }
         FREE_ARRAY (char, string->chars, string->length + 1);
-        FREE (ObjString, string);
+        FREE_OBJ (ObjRope, string);
         break;
       }
+    case OBJ_UPVALUE:
+      FREE_OBJ (ObjUpvalue, object);
+      break;
     }
 }
 
 void
 free_objects (Obj *obj_list)
 {
-  Obj *object = allocated_objs;
+  Obj *object = obj_list;
   while (object != NULL)
     {
       Obj *next = object->next;
@@ -34,54 +88,201 @@ free_objects (Obj *obj_list)
 }
 
 static Obj *
-allocate_obj (size_t size, ObjType obj_type)
+allocate_obj (Obj **objects, size_t size, ObjType obj_type)
 {
   // Note that this is potentially larger than Obj to accomodate the concrete
   // implementation
-  Obj *object = (Obj *)reallocate (NULL, 0, size);
+  Obj *object = (Obj *)pool_allocate (size);
   object->type = obj_type;
 
   // Store the allocated object so we can free it.
-  object->next = allocated_objs;
-  allocated_objs = object;
+  object->next = *objects;
+  *objects = object;
 
   return object;
 }
 
-#define ALLOCATE_OBJ(type, obj_type)                                          \
-  (type *)allocate_obj (sizeof (type), (obj_type))
+#define ALLOCATE_OBJ(objects, type, obj_type)                                 \
+  (type *)allocate_obj ((objects), sizeof (type), (obj_type))
+
+uint32_t
+hash_string (const char *chars, int length)
+{
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < length; i++)
+    {
+      hash ^= (uint8_t)chars[i];
+      hash *= 16777619;
+    }
+  return hash;
+}
 
+/**
+ * A string of @p length characters, which the caller fills in. The null
+ * terminator is already set.
+ */
 static ObjString *
-wrap_in_string_obj (char *chars, int length)
+allocate_string (Obj **objects, int length)
 {
-  ObjString *string = ALLOCATE_OBJ (ObjString, OBJ_STRING);
+  ObjString *string = (ObjString *)allocate_obj (
+      objects, sizeof (ObjString) + length + 1, OBJ_STRING);
   string->length = length;
-  string->chars = chars;
+  string->chars = inline_chars (string);
+  string->chars[length] = '\0';
   return string;
 }
 
 ObjString *
-copy_string (const char *chars, int length)
+copy_string (Obj **objects, const char *chars, int length)
 {
-  char *heap_chars = ALLOCATE (char, length + 1);
-  memcpy (heap_chars, chars, length);
-  heap_chars[length] = '\0';
-  return wrap_in_string_obj (heap_chars, length);
+  ObjString *string = allocate_string (objects, length);
+  memcpy (string->chars, chars, length);
+  string->hash = hash_string (string->chars, length);
+  return string;
 }
 
 ObjString *
-view_string (char *chars, int length)
+concatenate_strings (Obj **objects, const ObjString *lhs,
+                     const ObjString *rhs)
+{
+  int length = lhs->length + rhs->length;
+  if (length >= ROPE_MIN_LENGTH)
+    {
+      ObjRope *rope = ALLOCATE_OBJ (objects, ObjRope, OBJ_STRING);
+      rope->string.length = length;
+      rope->string.hash = 0;
+      rope->string.chars = NULL;
+      rope->lhs = lhs;
+      rope->rhs = rhs;
+      return &rope->string;
+    }
+
+  // Both operands are shorter than a rope, so their characters are known.
+  ObjString *string = allocate_string (objects, length);
+  memcpy (string->chars, lhs->chars, lhs->length);
+  memcpy (string->chars + lhs->length, rhs->chars, rhs->length);
+  string->hash = hash_string (string->chars, length);
+  return string;
+}
+
+char *
+string_chars (ObjString *string)
+{
+  if (string->chars != NULL)
+    return string->chars;
+
+  char *chars = ALLOCATE (char, string->length + 1);
+  chars[string->length] = '\0';
+
+  // Copy the parts from the end. Strings built in a loop nest on the left,
+  // and only left operands wait for their turn, so few of them pile up.
+  const ObjString **pending = NULL;
+  int pending_count = 0;
+  int pending_capacity = 0;
+  char *end = chars + string->length;
+  const ObjString *part = string;
+  for (;;)
+    {
+      if (part->chars == NULL)
+        {
+          const ObjRope *rope = (const ObjRope *)part;
+          if (pending_count == pending_capacity)
+            {
+              int old_capacity = pending_capacity;
+              pending_capacity = GROW_CAPACITY (old_capacity);
+              pending = GROW_ARRAY (const ObjString *, pending, old_capacity,
+                                    pending_capacity);
+            }
+          pending[pending_count++] = rope->lhs;
+          part = rope->rhs;
+          continue;
+        }
+
+      end -= part->length;
+      memcpy (end, part->chars, part->length);
+      if (pending_count == 0)
+        break;
+      part = pending[--pending_count];
+    }
+  FREE_ARRAY (const ObjString *, pending, pending_capacity);
+
+  string->chars = chars;
+  string->hash = hash_string (chars, string->length);
+  return chars;
+}
+
+ObjFunction *
+new_function (Obj **objects, const char *name, int length)
+{
+  ObjFunction *function = ALLOCATE_OBJ (objects, ObjFunction, OBJ_FUNCTION);
+  function->arity = 0;
+  function->upvalue_count = 0;
+  init_chunk (&function->chunk);
+  function->name = copy_string (&function->chunk.objects, name, length);
+  return function;
+}
+
+ObjNative *
+new_native (Obj **objects, NativeFn function, int arity)
+{
+  ObjNative *native = ALLOCATE_OBJ (objects, ObjNative, OBJ_NATIVE);
+  native->function = function;
+  native->arity = arity;
+  return native;
+}
+
+ObjClosure *
+new_closure (Obj **objects, ObjFunction *function)
 {
-  return wrap_in_string_obj (chars, length);
+  ObjClosure *closure = (ObjClosure *)allocate_obj (
+      objects,
+      sizeof (ObjClosure) + function->upvalue_count * sizeof (ObjUpvalue *),
+      OBJ_CLOSURE);
+  closure->function = function;
+  closure->upvalue_count = function->upvalue_count;
+  for (int i = 0; i < function->upvalue_count; i++)
+    closure->upvalues[i] = NULL;
+  return closure;
+}
+
+ObjUpvalue *
+new_upvalue (Obj **objects, Value *slot)
+{
+  ObjUpvalue *upvalue = ALLOCATE_OBJ (objects, ObjUpvalue, OBJ_UPVALUE);
+  upvalue->location = slot;
+  upvalue->closed = NIL_VAL;
+  upvalue->next_open = NULL;
+  return upvalue;
+}
+
+static void
+print_function (LoxWriter *out, const ObjFunction *function)
+{
+  lox_writer_printf (out, "<fn %s>", function->name->chars);
 }
 
 void
-print_object (Value value)
+print_object (LoxWriter *out, Value value)
 {
   switch (OBJ_TYPE (value))
     {
-    case OBJ_STRING:
-      printf ("%s", AS_CSTRING (value));
+    case OBJ_CLOSURE:
+      print_function (out, AS_CLOSURE (value)->function);
       break;
+    case OBJ_FUNCTION:
+      print_function (out, AS_FUNCTION (value));
+      break;
+    case OBJ_NATIVE:
+      lox_writer_puts (out, "<native fn>");
+      break;
+    case OBJ_UPVALUE:
+      lox_writer_puts (out, "upvalue");
+      break;
+    case OBJ_STRING:
+      {
+        ObjString *string = AS_STRING (value);
+        lox_writer_write (out, string_chars (string), string->length);
+        break;
+      }
     }
 }
@@ -1,11 +1,18 @@
 #pragma once
 
+#include "chunk.h"
 #include "common.h"
 #include "value.h"
 
+#include <lox_writer.h>
+
 typedef enum
 {
+  OBJ_CLOSURE,
+  OBJ_FUNCTION,
+  OBJ_NATIVE,
   OBJ_STRING,
+  OBJ_UPVALUE,
 } ObjType;
 
 struct Obj
@@ -15,28 +22,86 @@ struct Obj
   struct Obj *next;
 };
 
-// Linked list of all allocated objects.
-extern Obj *allocated_objs;
-
 // Free all objects in the linked list.
 void free_objects (Obj *obj_list);
 
 #define OBJ_TYPE(value) (AS_OBJ (value)->type)
 
+#define IS_CLOSURE(value) (is_obj_type (value, OBJ_CLOSURE))
+#define IS_FUNCTION(value) (is_obj_type (value, OBJ_FUNCTION))
+#define IS_NATIVE(value) (is_obj_type (value, OBJ_NATIVE))
 #define IS_STRING(value) (is_obj_type (value, OBJ_STRING))
 
+#define AS_CLOSURE(value) ((ObjClosure *)AS_OBJ (value))
+#define AS_FUNCTION(value) ((ObjFunction *)AS_OBJ (value))
+#define AS_NATIVE(value) ((ObjNative *)AS_OBJ (value))
 #define AS_STRING(value) ((ObjString *)AS_OBJ (value))
-#define AS_CSTRING(value) (AS_STRING (value)->chars)
+#define AS_CSTRING(value) (string_chars (AS_STRING (value)))
 
 typedef struct
 {
   Obj obj;
   // length not including the null-terminator
   int length;
-  // null-terminated C string
+  // hash_string() of chars, computed once they are known
+  uint32_t hash;
+  // null-terminated C string. Strings copied from characters store them in
+  // the same allocation. Long concatenations leave them NULL until they are
+  // read with string_chars().
   char *chars;
 } ObjString;
 
+/**
+ * A compiled function. It belongs to the chunk of the enclosing code and is
+ * not modified at run time.
+ */
+typedef struct
+{
+  Obj obj;
+  int arity;
+  // Number of variables captured from enclosing functions. Functions without
+  // upvalues are called directly instead of through a closure.
+  int upvalue_count;
+  Chunk chunk;
+  ObjString *name;
+} ObjFunction;
+
+typedef Value (*NativeFn) (int arg_count, const Value *args);
+
+typedef struct
+{
+  Obj obj;
+  NativeFn function;
+  int arity;
+} ObjNative;
+
+/**
+ * A variable captured by a closure. While the variable is in scope, it stays
+ * in its stack slot and the upvalue is open. Once the variable goes out of
+ * scope, its value moves into the upvalue.
+ */
+typedef struct ObjUpvalue
+{
+  Obj obj;
+  // The stack slot while open, the closed field afterwards.
+  Value *location;
+  Value closed;
+  // The open upvalues of a VM, sorted by their stack slots from the top.
+  struct ObjUpvalue *next_open;
+} ObjUpvalue;
+
+/**
+ * A function together with the variables it captured. The upvalues are
+ * stored in the same allocation.
+ */
+typedef struct
+{
+  Obj obj;
+  ObjFunction *function;
+  int upvalue_count;
+  ObjUpvalue *upvalues[];
+} ObjClosure;
+
 static inline bool
 is_obj_type (Value value, ObjType obj_type)
 {
@@ -44,13 +109,43 @@ is_obj_type (Value value, ObjType obj_type)
 }
 
 /**
- * Copies the string into a new null-terminated string.
+ * FNV-1a hash of @p length characters at @p chars.
  */
-ObjString *copy_string (const char *chars, int length);
+uint32_t hash_string (const char *chars, int length);
 
 /**
- * Uses the existing chars w/o copying and wraps them into a string value.
+ * Copies the string into a new null-terminated string. The new object is
+ * prepended to the linked list @p objects.
  */
-ObjString *view_string (char *chars, int length);
+ObjString *copy_string (Obj **objects, const char *chars, int length);
+
+/**
+ * The string @p lhs followed by @p rhs. The new object is prepended to the
+ * linked list @p objects. Long results only keep the operands, so that
+ * building a string piece by piece takes linear time.
+ */
+ObjString *concatenate_strings (Obj **objects, const ObjString *lhs,
+                                const ObjString *rhs);
+
+/**
+ * The null-terminated characters of @p string. The first call on a
+ * concatenation copies the characters of its operands.
+ */
+char *string_chars (ObjString *string);
+
+/**
+ * A function without code, named by @p length characters at @p name. Like
+ * all compile-time objects, it is prepended to @p objects.
+ */
+ObjFunction *new_function (Obj **objects, const char *name, int length);
+
+ObjNative *new_native (Obj **objects, NativeFn function, int arity);
+
+/**
+ * A closure of @p function with all upvalues set to NULL.
+ */
+ObjClosure *new_closure (Obj **objects, ObjFunction *function);
+
+ObjUpvalue *new_upvalue (Obj **objects, Value *slot);
 
-void print_object (Value value);
+void print_object (LoxWriter *out, Value value);
@@ -0,0 +1,517 @@
+#include "register.h"
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+
+/**
+ * Where the value at a position of the stack is. Locals and constants are
+ * only copied into the register of their position when needed.
+ */
+typedef enum
+{
+  // In the register of the position.
+  ENTRY_REGISTER,
+  // A copy of the local in register Entry::index.
+  ENTRY_LOCAL,
+  // The constant Entry::index.
+  ENTRY_CONSTANT,
+} EntryKind;
+
+typedef struct
+{
+  EntryKind kind;
+  uint8_t index;
+} Entry;
+
+/**
+ * A jump of the register code whose 16-bit operand at @p position must reach
+ * the stack instruction at @p target.
+ */
+typedef struct
+{
+  int position;
+  int target;
+} Patch;
+
+typedef struct
+{
+  // The register code.
+  Chunk out;
+  // The stack as it is when the current stack instruction runs.
+  Entry stack[UINT8_COUNT];
+  int depth;
+  // Line of the current stack instruction.
+  int line;
+  // Offset of the result operand of the last emitted instruction, or -1 if
+  // the next instruction may not write its result elsewhere.
+  int last_result;
+  const char *error;
+  Patch *patches;
+  int patch_count;
+  int patch_capacity;
+} Translator;
+
+static void
+emit_byte (Translator *translator, uint8_t byte)
+{
+  write_chunk (&translator->out, byte, translator->line);
+}
+
+static void
+emit_bytes (Translator *translator, uint8_t byte1, uint8_t byte2)
+{
+  emit_byte (translator, byte1);
+  emit_byte (translator, byte2);
+}
+
+/**
+ * Emit @p instruction with the @p result register as first operand.
+ */
+static void
+emit_result (Translator *translator, OpCode instruction, int result)
+{
+  emit_byte (translator, instruction);
+  translator->last_result = translator->out.count;
+  emit_byte (translator, (uint8_t)result);
+}
+
+/**
+ * Emit the 16-bit operand of a jump to the stack instruction at @p target.
+ */
+static void
+emit_jump_operand (Translator *translator, int target)
+{
+  if (translator->patch_capacity < translator->patch_count + 1)
+    {
+      int old_capacity = translator->patch_capacity;
+      translator->patch_capacity = GROW_CAPACITY (old_capacity);
+      translator->patches
+          = GROW_ARRAY (Patch, translator->patches, old_capacity,
+                        translator->patch_capacity);
+    }
+  translator->patches[translator->patch_count++]
+      = (Patch){ translator->out.count, target };
+  emit_bytes (translator, 0, 0);
+}
+
+/**
+ * Push a value which is in the register of its position. Returns the
+ * register.
+ */
+static int
+push_register (Translator *translator)
+{
+  if (translator->depth == UINT8_COUNT)
+    {
+      translator->error = "Too many registers needed in one function.";
+      return 0;
+    }
+  int position = translator->depth++;
+  translator->stack[position] = (Entry){ ENTRY_REGISTER, 0 };
+  return position;
+}
+
+static void
+push_entry (Translator *translator, EntryKind kind, uint8_t index)
+{
+  int position = push_register (translator);
+  translator->stack[position] = (Entry){ kind, index };
+}
+
+/**
+ * Copy the value at @p position into the register of the position.
+ */
+static void
+materialize (Translator *translator, int position)
+{
+  Entry *entry = &translator->stack[position];
+  switch (entry->kind)
+    {
+    case ENTRY_REGISTER:
+      return;
+    case ENTRY_LOCAL:
+      emit_byte (translator, OP_R_MOVE);
+      break;
+    case ENTRY_CONSTANT:
+      emit_byte (translator, OP_R_CONSTANT);
+      break;
+    }
+  emit_bytes (translator, (uint8_t)position, entry->index);
+  entry->kind = ENTRY_REGISTER;
+}
+
+/**
+ * The register which holds the value at @p position.
+ */
+static uint8_t
+source (Translator *translator, int position)
+{
+  Entry *entry = &translator->stack[position];
+  if (entry->kind == ENTRY_LOCAL)
+    return entry->index;
+  materialize (translator, position);
+  return (uint8_t)position;
+}
+
+/**
+ * Copy all values into the registers of their positions. Control flow joins
+ * only in this state.
+ */
+static void
+flush (Translator *translator)
+{
+  for (int position = 0; position < translator->depth; ++position)
+    materialize (translator, position);
+}
+
+/**
+ * Whether a position other than @p except holds a copy of @p local.
+ */
+static bool
+is_copied (const Translator *translator, int local, int except)
+{
+  for (int position = 0; position < translator->depth; ++position)
+    {
+      const Entry *entry = &translator->stack[position];
+      if (position != except && entry->kind == ENTRY_LOCAL
+          && entry->index == local)
+        return true;
+    }
+  return false;
+}
+
+/**
+ * Assign the value on top of the stack to @p local. @p previous_result is
+ * the result operand of the previous instruction or -1.
+ */
+static void
+set_local (Translator *translator, int local, int previous_result)
+{
+  int top = translator->depth - 1;
+  if (previous_result >= 0 && translator->out.code[previous_result] == top
+      && translator->stack[top].kind == ENTRY_REGISTER
+      && !is_copied (translator, local, top))
+    {
+      // The previous instruction computes the value directly into the local.
+      translator->out.code[previous_result] = (uint8_t)local;
+      translator->stack[top] = (Entry){ ENTRY_LOCAL, (uint8_t)local };
+    }
+  else
+    {
+      // Copies of the old value must not see the new one.
+      for (int position = 0; position < top; ++position)
+        {
+          const Entry *entry = &translator->stack[position];
+          if (entry->kind == ENTRY_LOCAL && entry->index == local)
+            materialize (translator, position);
+        }
+      uint8_t value = source (translator, top);
+      if (value != local)
+        {
+          emit_bytes (translator, OP_R_MOVE, (uint8_t)local);
+          emit_byte (translator, value);
+        }
+    }
+  translator->stack[local].kind = ENTRY_REGISTER;
+}
+
+/**
+ * Replace the two values on top of the stack by the result of
+ * @p instruction.
+ */
+static void
+binary (Translator *translator, OpCode instruction)
+{
+  int top = translator->depth - 1;
+  uint8_t rhs = source (translator, top);
+  uint8_t lhs = source (translator, top - 1);
+  translator->depth--;
+  translator->stack[top - 1].kind = ENTRY_REGISTER;
+  emit_result (translator, instruction, top - 1);
+  emit_bytes (translator, lhs, rhs);
+}
+
+static void
+unary (Translator *translator, OpCode instruction)
+{
+  int top = translator->depth - 1;
+  uint8_t operand = source (translator, top);
+  translator->stack[top].kind = ENTRY_REGISTER;
+  emit_result (translator, instruction, top);
+  emit_byte (translator, operand);
+}
+
+/**
+ * Emit @p instruction with the value on top of the stack and the 16-bit
+ * @p operand. The value is popped if @p pop is true.
+ */
+static void
+emit_with_short (Translator *translator, OpCode instruction, bool pop,
+                 const uint8_t *operand)
+{
+  uint8_t value = source (translator, translator->depth - 1);
+  emit_bytes (translator, instruction, value);
+  emit_bytes (translator, operand[0], operand[1]);
+  if (pop)
+    translator->depth--;
+}
+
+/**
+ * The target of the jump at @p offset, or -1 if it is no jump.
+ */
+static int
+jump_target (const Chunk *chunk, int offset)
+{
+  const uint8_t *code = chunk->code + offset;
+  switch (code[0])
+    {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+      return offset + 2 + code[1];
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE_LONG:
+      return offset + 3 + (code[1] << 8 | code[2]);
+    case OP_LOOP:
+      return offset + 2 - code[1];
+    case OP_LOOP_LONG:
+      return offset + 3 - (code[1] << 8 | code[2]);
+    default:
+      return -1;
+    }
+}
+
+/**
+ * Translate the stack instruction at @p offset of @p chunk.
+ * @p previous_result is the result operand of the previous register
+ * instruction if the stack instruction may write it elsewhere, or -1.
+ * @p depths receives the stack depth at the targets of jumps.
+ */
+static void
+translate_instruction (Translator *translator, const Chunk *chunk,
+                       int offset, int previous_result, int *depths,
+                       bool is_script)
+{
+  const uint8_t *code = chunk->code + offset;
+  int top = translator->depth - 1;
+  switch (code[0])
+    {
+    case OP_CONSTANT:
+      push_entry (translator, ENTRY_CONSTANT, code[1]);
+      break;
+    case OP_NIL:
+      emit_result (translator, OP_R_NIL, push_register (translator));
+      break;
+    case OP_TRUE:
+      emit_result (translator, OP_R_TRUE, push_register (translator));
+      break;
+    case OP_FALSE:
+      emit_result (translator, OP_R_FALSE, push_register (translator));
+      break;
+    case OP_POP:
+      translator->depth--;
+      break;
+    case OP_GET_LOCAL:
+      materialize (translator, code[1]);
+      push_entry (translator, ENTRY_LOCAL, code[1]);
+      break;
+    case OP_SET_LOCAL:
+      set_local (translator, code[1], previous_result);
+      break;
+    case OP_GET_GLOBAL:
+      emit_result (translator, OP_R_GET_GLOBAL, push_register (translator));
+      emit_bytes (translator, code[1], code[2]);
+      break;
+    case OP_DEFINE_GLOBAL:
+      emit_with_short (translator, OP_R_DEFINE_GLOBAL, true, code + 1);
+      break;
+    case OP_SET_GLOBAL:
+      emit_with_short (translator, OP_R_SET_GLOBAL, false, code + 1);
+      break;
+    case OP_GET_UPVALUE:
+      emit_result (translator, OP_R_GET_UPVALUE, push_register (translator));
+      emit_byte (translator, code[1]);
+      break;
+    case OP_SET_UPVALUE:
+      emit_bytes (translator, OP_R_SET_UPVALUE, source (translator, top));
+      emit_byte (translator, code[1]);
+      break;
+    case OP_CLOSE_UPVALUE:
+      // Upvalues are closed from the register of the local on.
+      materialize (translator, top);
+      emit_bytes (translator, OP_R_CLOSE_UPVALUE, (uint8_t)top);
+      translator->depth--;
+      break;
+    case OP_EQUAL:
+      binary (translator, OP_R_EQUAL);
+      break;
+    case OP_GREATER:
+      binary (translator, OP_R_GREATER);
+      break;
+    case OP_LESS:
+      binary (translator, OP_R_LESS);
+      break;
+    case OP_ADD:
+      binary (translator, OP_R_ADD);
+      break;
+    case OP_SUBTRACT:
+      binary (translator, OP_R_SUBTRACT);
+      break;
+    case OP_MULTIPLY:
+      binary (translator, OP_R_MULTIPLY);
+      break;
+    case OP_DIVIDE:
+      binary (translator, OP_R_DIVIDE);
+      break;
+    case OP_NOT:
+      unary (translator, OP_R_NOT);
+      break;
+    case OP_NEGATE:
+      unary (translator, OP_R_NEGATE);
+      break;
+    case OP_PRINT:
+      emit_bytes (translator, OP_R_PRINT, source (translator, top));
+      translator->depth--;
+      break;
+    case OP_JUMP:
+    case OP_JUMP_LONG:
+    case OP_LOOP:
+    case OP_LOOP_LONG:
+      {
+        int target = jump_target (chunk, offset);
+        flush (translator);
+        depths[target] = translator->depth;
+        emit_byte (translator, target > offset ? OP_R_JUMP : OP_R_LOOP);
+        emit_jump_operand (translator, target);
+        break;
+      }
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_LONG:
+      {
+        int target = jump_target (chunk, offset);
+        flush (translator);
+        depths[target] = translator->depth;
+        emit_bytes (translator, OP_R_JUMP_IF_FALSE, (uint8_t)top);
+        emit_jump_operand (translator, target);
+        break;
+      }
+    case OP_CALL:
+      {
+        // The callee may change captured locals, so they are not copied
+        // lazily across calls.
+        flush (translator);
+        int callee = translator->depth - code[1] - 1;
+        emit_bytes (translator, OP_R_CALL, (uint8_t)callee);
+        emit_byte (translator, code[1]);
+        translator->depth = callee + 1;
+        break;
+      }
+    case OP_CLOSURE:
+      {
+        // Captured locals must be in their registers.
+        flush (translator);
+        emit_result (translator, OP_R_CLOSURE, push_register (translator));
+        int size = instruction_size (chunk, offset);
+        for (int i = 1; i < size; ++i)
+          emit_byte (translator, code[i]);
+        break;
+      }
+    case OP_RETURN:
+      if (is_script)
+        emit_bytes (translator, OP_R_RETURN, 0);
+      else
+        {
+          emit_bytes (translator, OP_R_RETURN, source (translator, top));
+          translator->depth--;
+        }
+      break;
+    default:
+      translator->error = "Unexpected instruction for registers.";
+      break;
+    }
+}
+
+const char *
+translate_to_registers (Chunk *chunk, int slots)
+{
+  Translator translator;
+  init_chunk (&translator.out);
+  translator.depth = 0;
+  translator.line = 0;
+  translator.last_result = -1;
+  translator.error = NULL;
+  translator.patches = NULL;
+  translator.patch_count = 0;
+  translator.patch_capacity = 0;
+  for (int i = 0; i < slots; ++i)
+    push_register (&translator);
+
+  // The offset of each stack instruction in the register code and the
+  // stack depth at each jump target.
+  int *offsets = ALLOCATE (int, chunk->count + 1);
+  int *depths = ALLOCATE (int, chunk->count + 1);
+  bool *is_target = ALLOCATE (bool, chunk->count + 1);
+  for (int offset = 0; offset <= chunk->count; ++offset)
+    {
+      depths[offset] = -1;
+      is_target[offset] = false;
+    }
+  for (int offset = 0; offset < chunk->count;
+       offset += instruction_size (chunk, offset))
+    {
+      int target = jump_target (chunk, offset);
+      if (target >= 0)
+        is_target[target] = true;
+    }
+
+  for (int offset = 0; offset <= chunk->count && translator.error == NULL;
+       offset += instruction_size (chunk, offset))
+    {
+      int previous_result = translator.last_result;
+      translator.last_result = -1;
+      if (is_target[offset])
+        {
+          // Control flow joins here, so no instruction may be retargeted
+          // across it. Code after an unconditional jump is only reached
+          // through jumps, which recorded their depth.
+          flush (&translator);
+          if (depths[offset] >= 0)
+            translator.depth = depths[offset];
+          for (int position = 0; position < translator.depth; ++position)
+            translator.stack[position].kind = ENTRY_REGISTER;
+          previous_result = -1;
+        }
+      offsets[offset] = translator.out.count;
+      if (offset == chunk->count)
+        break;
+      translator.line = chunk->lines[offset];
+      translate_instruction (&translator, chunk, offset, previous_result,
+                             depths, slots == 0);
+    }
+
+  for (int i = 0; i < translator.patch_count && translator.error == NULL; ++i)
+    {
+      const Patch *patch = &translator.patches[i];
+      int jump = offsets[patch->target] - (patch->position + 2);
+      if (jump < 0)
+        jump = -jump;
+      if (jump > UINT16_MAX)
+        translator.error = "Too much code to jump over.";
+      translator.out.code[patch->position] = (jump >> 8) & 0xff;
+      translator.out.code[patch->position + 1] = jump & 0xff;
+    }
+
+  FREE_ARRAY (bool, is_target, chunk->count + 1);
+  FREE_ARRAY (int, depths, chunk->count + 1);
+  FREE_ARRAY (int, offsets, chunk->count + 1);
+  FREE_ARRAY (Patch, translator.patches, translator.patch_capacity);
+
+  // Only the code is replaced, the constants stay.
+  FREE_ARRAY (uint8_t, chunk->code, chunk->capacity);
+  FREE_ARRAY (int, chunk->lines, chunk->capacity);
+  chunk->code = translator.out.code;
+  chunk->lines = translator.out.lines;
+  chunk->count = translator.out.count;
+  chunk->capacity = translator.out.capacity;
+  return translator.error;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "chunk.h"
+
+/**
+ * Replace the stack code of @p chunk by register code. A function starts
+ * with @p slots slots in use: the callee and its parameters, or none for the
+ * script. Returns NULL on success or the error message if the chunk cannot
+ * be expressed in register code.
+ *
+ * Registers are the slots of the frame, so every local keeps the register
+ * of its slot and temporaries use the register at their depth on the stack.
+ * Reads of locals and constants do not copy them into a register before an
+ * instruction uses them, which saves most pushes, pops and moves.
+ */
+const char *translate_to_registers (Chunk *chunk, int slots);
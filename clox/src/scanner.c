@@ -1,107 +1,100 @@
 #include "scanner.h"
+#include <lox_scan.h>
 #include <stdbool.h>
 #include <string.h>
 
-typedef struct
-{
-  const char *start;
-  const char *current;
-  int line;
-} Scanner;
-
-Scanner scanner;
-
 void
-init_scanner (const char *source)
+init_scanner (Scanner *scanner, const char *source, size_t length)
 {
-  scanner.start = source;
-  scanner.current = source;
-  scanner.line = 1;
+  scanner->start = source;
+  scanner->current = source;
+  scanner->end = source + length;
+  scanner->line = 1;
 }
 
 static bool
-is_at_end ()
+is_at_end (Scanner *scanner)
 {
-  return *scanner.current == '\0';
+  return scanner->current >= scanner->end;
 }
 
 static Token
-make_token (TokenType type)
+make_token (Scanner *scanner, TokenType type)
 {
   Token t = { .type = type,
-              .start = scanner.start,
-              .length = scanner.current - scanner.start,
-              .line = scanner.line };
+              .start = scanner->start,
+              .length = scanner->current - scanner->start,
+              .line = scanner->line };
   return t;
 }
 
 static Token
-error_token (const char *err_msg)
+error_token (Scanner *scanner, const char *err_msg)
 {
   Token err = { .type = TOKEN_ERROR,
                 .start = err_msg,
                 .length = (int)strlen (err_msg),
-                .line = scanner.line };
+                .line = scanner->line };
   return err;
 }
 
 static char
-advance ()
+advance (Scanner *scanner)
 {
-  return *(scanner.current++);
+  return *(scanner->current++);
 }
 
 static bool
-match (char expected)
+match (Scanner *scanner, char expected)
 {
-  if (is_at_end ())
+  if (is_at_end (scanner))
     return false;
 
-  if (*scanner.current != expected)
+  if (*scanner->current != expected)
     return false;
 
-  scanner.current++;
+  scanner->current++;
   return true;
 }
 
 static char
-peek ()
+peek (Scanner *scanner)
 {
-  return *scanner.current;
+  if (is_at_end (scanner))
+    return '\0';
+  return *scanner->current;
 }
 
 static char
-peek_next ()
+peek_next (Scanner *scanner)
 {
-  if (is_at_end ())
+  if (scanner->end - scanner->current < 2)
     return '\0';
-  return *(scanner.current + 1);
+  return *(scanner->current + 1);
 }
 
 static void
-skip_whitespace ()
+skip_whitespace (Scanner *scanner)
 {
   for (;;)
     {
-      char c = peek ();
+      char c = peek (scanner);
       switch (c)
         {
         case ' ':
         case '\t':
         case '\r':
-          advance ();
-          break;
         case '\n':
-          ++scanner.line;
-          advance ();
+          scanner->current = lox_skip_whitespace (
+              scanner->current, scanner->end, &scanner->line);
           break;
         case '/':
           // treat comments as whitespace
-          if (peek_next () == '/')
+          if (peek_next (scanner) == '/')
             {
               // eat the rest of the line
-              while (peek () != '\n' && !is_at_end ())
-                advance ();
+              scanner->current
+                  = lox_skip_line (scanner->current, scanner->end);
             }
           else
             return;
@@ -113,20 +106,16 @@ skip_whitespace ()
 }
 
 static Token
-string ()
+string (Scanner *scanner)
 {
-  while (peek () != '"' && !is_at_end ())
-    {
-      if (peek () == '\n')
-        ++scanner.line;
-      advance ();
-    }
+  scanner->current
+      = lox_skip_string (scanner->current, scanner->end, &scanner->line);
 
-  if (is_at_end ())
-    return error_token ("Unterminated string.");
+  if (is_at_end (scanner))
+    return error_token (scanner, "Unterminated string.");
   // Closing quote.
-  advance ();
-  return make_token (TOKEN_STRING);
+  advance (scanner);
+  return make_token (scanner, TOKEN_STRING);
 }
 
 static bool
@@ -142,28 +131,29 @@ is_alpha (char c)
 }
 
 static Token
-number ()
+number (Scanner *scanner)
 {
   // Mandatory part in front of decimal
-  while (is_digit (peek ()))
-    advance ();
+  while (is_digit (peek (scanner)))
+    advance (scanner);
 
   // Optional decimal followed by more digits
-  if (peek () == '.' && is_digit (peek_next ()))
+  if (peek (scanner) == '.' && is_digit (peek_next (scanner)))
     {
-      advance ();
-      while (is_digit (peek ()))
-        advance ();
+      advance (scanner);
+      while (is_digit (peek (scanner)))
+        advance (scanner);
     }
 
-  return make_token (TOKEN_NUMBER);
+  return make_token (scanner, TOKEN_NUMBER);
 }
 
 static TokenType
-check_keyword (int start, int length, const char *rest, TokenType type)
+check_keyword (Scanner *scanner, int start, int length, const char *rest,
+               TokenType type)
 {
-  if (scanner.current - scanner.start == start + length
-      && memcmp (scanner.start + start, rest, length) == 0)
+  if (scanner->current - scanner->start == start + length
+      && memcmp (scanner->start + start, rest, length) == 0)
     return type;
 
   return TOKEN_IDENTIFIER;
@@ -172,113 +162,113 @@ check_keyword (int start, int length, const char *rest, TokenType type)
 // Called when the scanner has fully parsed an identifier and we just need to
 // figure out its type.
 static TokenType
-identifier_type ()
+identifier_type (Scanner *scanner)
 {
-  switch (scanner.start[0])
+  switch (scanner->start[0])
     {
     case 'a':
-      return check_keyword (1, 2, "nd", TOKEN_AND);
+      return check_keyword (scanner, 1, 2, "nd", TOKEN_AND);
     case 'c':
-      return check_keyword (1, 4, "lass", TOKEN_CLASS);
+      return check_keyword (scanner, 1, 4, "lass", TOKEN_CLASS);
     case 'e':
-      return check_keyword (1, 3, "lse", TOKEN_ELSE);
+      return check_keyword (scanner, 1, 3, "lse", TOKEN_ELSE);
     case 'f':
-      if (scanner.current - scanner.start > 1)
+      if (scanner->current - scanner->start > 1)
         {
-          switch (scanner.start[1])
+          switch (scanner->start[1])
             {
             case 'a':
-              return check_keyword (2, 3, "lse", TOKEN_FALSE);
+              return check_keyword (scanner, 2, 3, "lse", TOKEN_FALSE);
             case 'o':
-              return check_keyword (2, 1, "r", TOKEN_FOR);
+              return check_keyword (scanner, 2, 1, "r", TOKEN_FOR);
             case 'u':
-              return check_keyword (2, 1, "n", TOKEN_FUN);
+              return check_keyword (scanner, 2, 1, "n", TOKEN_FUN);
             }
         }
       break;
     case 'i':
-      return check_keyword (1, 1, "f", TOKEN_IF);
+      return check_keyword (scanner, 1, 1, "f", TOKEN_IF);
     case 'n':
-      return check_keyword (1, 2, "il", TOKEN_NIL);
+      return check_keyword (scanner, 1, 2, "il", TOKEN_NIL);
     case 'o':
-      return check_keyword (1, 1, "r", TOKEN_OR);
+      return check_keyword (scanner, 1, 1, "r", TOKEN_OR);
     case 'p':
-      return check_keyword (1, 4, "rint", TOKEN_PRINT);
+      return check_keyword (scanner, 1, 4, "rint", TOKEN_PRINT);
     case 'r':
-      return check_keyword (1, 5, "eturn", TOKEN_RETURN);
+      return check_keyword (scanner, 1, 5, "eturn", TOKEN_RETURN);
     case 's':
-      return check_keyword (1, 4, "uper", TOKEN_SUPER);
+      return check_keyword (scanner, 1, 4, "uper", TOKEN_SUPER);
     case 't':
-      if (scanner.current - scanner.start > 1)
+      if (scanner->current - scanner->start > 1)
         {
-          switch (scanner.start[1])
+          switch (scanner->start[1])
             {
             case 'h':
-              return check_keyword (2, 2, "is", TOKEN_THIS);
+              return check_keyword (scanner, 2, 2, "is", TOKEN_THIS);
             case 'r':
-              return check_keyword (2, 2, "ue", TOKEN_TRUE);
+              return check_keyword (scanner, 2, 2, "ue", TOKEN_TRUE);
             }
         }
       break;
     case 'v':
-      return check_keyword (1, 2, "ar", TOKEN_VAR);
+      return check_keyword (scanner, 1, 2, "ar", TOKEN_VAR);
     case 'w':
-      return check_keyword (1, 4, "hile", TOKEN_WHILE);
+      return check_keyword (scanner, 1, 4, "hile", TOKEN_WHILE);
     }
   return TOKEN_IDENTIFIER;
 }
 
 static Token
-identifier ()
+identifier (Scanner *scanner)
 {
-  while (is_alpha (peek ()) || is_digit (peek ()))
-    advance ();
-  return make_token (identifier_type ());
+  while (is_alpha (peek (scanner)) || is_digit (peek (scanner)))
+    advance (scanner);
+  return make_token (scanner, identifier_type (scanner));
 }
 
 Token
-scan_token ()
+scan_token (Scanner *scanner)
 {
-  skip_whitespace ();
-  scanner.start = scanner.current;
+  skip_whitespace (scanner);
+  scanner->start = scanner->current;
 
-  if (is_at_end ())
-    return make_token (TOKEN_EOF);
+  if (is_at_end (scanner))
+    return make_token (scanner, TOKEN_EOF);
 
-  char c = advance ();
+  char c = advance (scanner);
 
   if (is_alpha (c))
-    return identifier ();
+    return identifier (scanner);
   if (is_digit (c))
-    return number ();
+    return number (scanner);
 
 #define MAKE_TOKEN_WITH_EQUALS_IF_MATCH(base_name)                            \
-  make_token (match ('=') ? base_name##_EQUAL : base_name)
+  make_token (scanner, match (scanner, '=') ? base_name##_EQUAL : base_name)
 
   switch (c)
     {
     case '(':
-      return make_token (TOKEN_LEFT_PAREN);
+      return make_token (scanner, TOKEN_LEFT_PAREN);
     case ')':
-      return make_token (TOKEN_RIGHT_PAREN);
+      return make_token (scanner, TOKEN_RIGHT_PAREN);
     case '{':
-      return make_token (TOKEN_LEFT_BRACE);
+      return make_token (scanner, TOKEN_LEFT_BRACE);
     case '}':
-      return make_token (TOKEN_RIGHT_BRACE);
+      return make_token (scanner, TOKEN_RIGHT_BRACE);
     case ';':
-      return make_token (TOKEN_SEMICOLON);
+      return make_token (scanner, TOKEN_SEMICOLON);
     case ',':
-      return make_token (TOKEN_COMMA);
+      return make_token (scanner, TOKEN_COMMA);
     case '.':
-      return make_token (TOKEN_DOT);
+      return make_token (scanner, TOKEN_DOT);
     case '-':
-      return make_token (TOKEN_MINUS);
+      return make_token (scanner, TOKEN_MINUS);
     case '+':
-      return make_token (TOKEN_PLUS);
+      return make_token (scanner, TOKEN_PLUS);
     case '/':
-      return make_token (TOKEN_SLASH);
+      return make_token (scanner, TOKEN_SLASH);
     case '*':
-      return make_token (TOKEN_STAR);
+      return make_token (scanner, TOKEN_STAR);
     case '!':
       return MAKE_TOKEN_WITH_EQUALS_IF_MATCH (TOKEN_BANG);
     case '=':
@@ -288,12 +278,12 @@ scan_token ()
     case '>':
       return MAKE_TOKEN_WITH_EQUALS_IF_MATCH (TOKEN_GREATER);
     case '"':
-      return string ();
+      return string (scanner);
     }
 
 #undef MAKE_TOKEN_WITH_EQUALS_IF_MATCH
 
-  return error_token ("Unexpected character.");
+  return error_token (scanner, "Unexpected character.");
 }
 
 const char *
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 typedef enum
 {
   // Single-character tokens.
@@ -58,7 +60,23 @@ typedef struct
   int line;
 } Token;
 
-void init_scanner (const char *source);
-Token scan_token ();
+/**
+ * The state of scanning one source. Each compilation owns its scanner, so
+ * several sources may be scanned at the same time.
+ */
+typedef struct
+{
+  const char *start;
+  const char *current;
+  const char *end;
+  int line;
+} Scanner;
+
+/**
+ * Start scanning @p length characters at @p source. The source does not need
+ * to be null-terminated.
+ */
+void init_scanner (Scanner *scanner, const char *source, size_t length);
+Token scan_token (Scanner *scanner);
 
 const char *token_type_to_string (TokenType type);
@@ -0,0 +1,102 @@
+#include "table.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include <string.h>
+
+// Grow the table once it is filled to this fraction.
+#define TABLE_MAX_LOAD 0.75
+
+void
+init_table (Table *table)
+{
+  table->count = 0;
+  table->capacity = 0;
+  table->entries = NULL;
+}
+
+void
+free_table (Table *table)
+{
+  FREE_ARRAY (Entry, table->entries, table->capacity);
+  init_table (table);
+}
+
+/**
+ * The bucket holding the key or the empty bucket where it belongs. The
+ * capacity is a power of two, so the modulo is a mask.
+ */
+static Entry *
+find_entry (Entry *entries, int capacity, const char *chars, int length,
+            uint32_t hash)
+{
+  uint32_t index = hash & (capacity - 1);
+  for (;;)
+    {
+      Entry *entry = &entries[index];
+      if (entry->key == NULL
+          || (entry->key->hash == hash && entry->key->length == length
+              && memcmp (entry->key->chars, chars, length) == 0))
+        return entry;
+      index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void
+adjust_capacity (Table *table, int capacity)
+{
+  Entry *entries = ALLOCATE (Entry, capacity);
+  for (int i = 0; i < capacity; i++)
+    {
+      entries[i].key = NULL;
+      entries[i].value = NIL_VAL;
+    }
+
+  for (int i = 0; i < table->capacity; i++)
+    {
+      ObjString *key = table->entries[i].key;
+      if (key == NULL)
+        continue;
+      Entry *dest = find_entry (entries, capacity, key->chars, key->length,
+                                key->hash);
+      dest->key = key;
+      dest->value = table->entries[i].value;
+    }
+
+  FREE_ARRAY (Entry, table->entries, table->capacity);
+  table->entries = entries;
+  table->capacity = capacity;
+}
+
+bool
+table_get (const Table *table, const char *chars, int length, uint32_t hash,
+           Value *value)
+{
+  if (table->count == 0)
+    return false;
+
+  Entry *entry
+      = find_entry (table->entries, table->capacity, chars, length, hash);
+  if (entry->key == NULL)
+    return false;
+
+  *value = entry->value;
+  return true;
+}
+
+bool
+table_set (Table *table, ObjString *key, Value value)
+{
+  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+    adjust_capacity (table, GROW_CAPACITY (table->capacity));
+
+  Entry *entry = find_entry (table->entries, table->capacity, key->chars,
+                             key->length, key->hash);
+  bool is_new_key = entry->key == NULL;
+  if (is_new_key)
+    table->count++;
+
+  entry->key = key;
+  entry->value = value;
+  return is_new_key;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+typedef struct
+{
+  // NULL for empty buckets.
+  ObjString *key;
+  Value value;
+} Entry;
+
+/**
+ * Hash table with open addressing and linear probing. Keys are compared by
+ * their characters, so they do not need to be interned. Entries are never
+ * removed.
+ */
+typedef struct
+{
+  int count;
+  int capacity;
+  Entry *entries;
+} Table;
+
+void init_table (Table *table);
+/// Free the entries but not the keys, which belong to an object list.
+void free_table (Table *table);
+
+/**
+ * Look up the key with @p length characters at @p chars and its @p hash.
+ * Returns false if the key is not in @p table.
+ */
+bool table_get (const Table *table, const char *chars, int length,
+                uint32_t hash, Value *value);
+
+/**
+ * Set the value of @p key. Returns true if the key was not in @p table before.
+ */
+bool table_set (Table *table, ObjString *key, Value value);
@@ -1,7 +1,7 @@
 #include "value.h"
 #include "memory.h"
 #include "object.h"
-#include <stdio.h>
+#include <lox_writer.h>
 #include <string.h>
 
 bool
@@ -26,9 +26,12 @@ values_equal (Value lhs, Value rhs)
             ObjString *lhs_s = AS_STRING (lhs);
             ObjString *rhs_s = AS_STRING (rhs);
             return (lhs_s->length == rhs_s->length)
-                   && (memcmp (lhs_s->chars, rhs_s->chars, lhs_s->length)
+                   && (memcmp (string_chars (lhs_s), string_chars (rhs_s),
+                               lhs_s->length)
                        == 0);
           }
+        default:
+          return AS_OBJ (lhs) == AS_OBJ (rhs);
         }
       break;
     }
@@ -64,21 +67,21 @@ free_value_array (ValueArray *array)
 }
 
 void
-print_value (Value value)
+print_value (LoxWriter *out, Value value)
 {
   switch (value.type)
     {
     case VAL_BOOL:
-      printf (AS_BOOL (value) ? "true" : "false");
+      lox_writer_puts (out, AS_BOOL (value) ? "true" : "false");
       break;
     case VAL_NIL:
-      printf ("nil");
+      lox_writer_puts (out, "nil");
       break;
     case VAL_NUMBER:
-      printf ("%g", AS_NUMBER (value));
+      lox_writer_number (out, AS_NUMBER (value));
       break;
     case VAL_OBJ:
-      print_object (value);
+      print_object (out, value);
       break;
     }
 }
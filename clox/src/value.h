@@ -2,6 +2,8 @@
 
 #include "common.h"
 
+#include <lox_writer.h>
+
 typedef struct Obj Obj;
 
 typedef enum
@@ -51,4 +53,4 @@ void init_value_array (ValueArray *array);
 void write_value_array (ValueArray *array, Value value);
 void free_value_array (ValueArray *array);
 
-void print_value (Value value);
+void print_value (LoxWriter *out, Value value);
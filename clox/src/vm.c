@@ -3,11 +3,15 @@
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "jit.h"
 #include "memory.h"
 #include "object.h"
+#include "table.h"
+#include <lox_writer.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/time.h>
 
 static void
 push (VM *vm, Value value)
@@ -15,109 +19,371 @@ push (VM *vm, Value value)
   *(vm->stack_top++) = value;
 }
 
-static Value
-pop (VM *vm)
-{
-  return *(--(vm->stack_top));
-}
-
-static Value
-peek (VM *vm, int distance)
-{
-  return vm->stack_top[-1 - distance];
-}
-
 static bool
 is_truthy (Value value)
 {
   return !IS_NIL (value) && (!IS_BOOL (value) || AS_BOOL (value));
 }
 
+/**
+ * Move the values of all open upvalues at or above @p last from the stack
+ * into the upvalues.
+ */
 static void
-concatenate (VM *vm)
+close_upvalues (VM *vm, Value *last)
 {
-  ObjString *rhs = AS_STRING (pop (vm));
-  ObjString *lhs = AS_STRING (pop (vm));
-
-  int new_length = lhs->length + rhs->length;
-  char *chars = ALLOCATE (char, new_length + 1);
-  memcpy (chars, lhs->chars, lhs->length);
-  memcpy (chars + lhs->length, rhs->chars, rhs->length);
-  chars[new_length] = '\0';
-
-  ObjString *concat_string = view_string (chars, new_length);
-  push (vm, OBJ_VAL (concat_string));
+  while (vm->open_upvalues != NULL && vm->open_upvalues->location >= last)
+    {
+      ObjUpvalue *upvalue = vm->open_upvalues;
+      upvalue->closed = *upvalue->location;
+      upvalue->location = &upvalue->closed;
+      vm->open_upvalues = upvalue->next_open;
+    }
 }
 
 static void
 reset_stack (VM *vm)
 {
+  // Closures which escaped into globals keep their values.
+  close_upvalues (vm, vm->stack);
   vm->stack_top = vm->stack;
+  vm->frame_count = 0;
 }
 
 static void
 runtime_error (VM *vm, const char *format, ...)
 {
+  // Keep the order of regular output and error messages.
+  lox_writer_flush (vm->out);
+
   va_list args;
   va_start (args, format);
-  vfprintf (stderr, format, args);
+  vfprintf (vm->err, format, args);
   va_end (args);
-  fputs ("\n", stderr);
+  fputs ("\n", vm->err);
 
-  size_t instruction = vm->ip - vm->chunk->code - 1;
-  int line = vm->chunk->lines[instruction];
-  fprintf (stderr, "[line %d] in script\n", line);
+  for (int i = vm->frame_count - 1; i >= 0; i--)
+    {
+      const CallFrame *frame = &vm->frames[i];
+      size_t instruction = frame->ip - frame->chunk->code - 1;
+      int line = frame->chunk->lines[instruction];
+      if (frame->function == NULL)
+        fprintf (vm->err, "[line %d] in script\n", line);
+      else
+        fprintf (vm->err, "[line %d] in %s()\n", line,
+                 frame->function->name->chars);
+    }
   reset_stack (vm);
 }
 
+/**
+ * Milliseconds since the epoch, like the clock() of cpplox.
+ */
+static Value
+clock_native (int arg_count, const Value *args)
+{
+  (void)arg_count;
+  (void)args;
+  struct timeval now;
+  gettimeofday (&now, NULL);
+  return NUMBER_VAL ((double)now.tv_sec * 1000 + now.tv_usec / 1000);
+}
+
+static void
+define_native (VM *vm, const char *name, NativeFn function, int arity)
+{
+  int index = declare_global (vm, name, (int)strlen (name));
+  Global *global = &vm->globals[index];
+  global->value = OBJ_VAL (new_native (&vm->objects, function, arity));
+  global->defined = true;
+}
+
+/**
+ * Natives are the first globals of every VM, so programs agree on their
+ * indices.
+ */
+static void
+define_natives (VM *vm)
+{
+  define_native (vm, "clock", clock_native, 0);
+}
+
+static void
+init_globals (VM *vm)
+{
+  init_table (&vm->global_names);
+  vm->globals = NULL;
+  vm->global_count = 0;
+  vm->global_capacity = 0;
+}
+
+/**
+ * Execution is traced instruction by instruction, so tracing turns the JIT
+ * off.
+ */
+static JitState *
+new_jit (CommandLineOptions options)
+{
+#ifdef CLOX_REGISTER_VM
+  // The JIT translates stack code only.
+  (void)options;
+  return NULL;
+#else
+  if (!(options & OPT_JIT) || (options & OPT_TRACE_EXECUTION))
+    return NULL;
+  return jit_new ();
+#endif
+}
+
 void
-init_vm (VM *vm)
+init_vm (VM *vm, CommandLineOptions options)
 {
+  vm->open_upvalues = NULL;
   reset_stack (vm);
-  allocated_objs = NULL;
+  vm->objects = NULL;
+  init_globals (vm);
+  define_natives (vm);
+  vm->options = options;
+  vm->jit = new_jit (options);
+  vm->out = lox_stdout ();
+  vm->err = stderr;
 }
 
 void
 free_vm (VM *vm)
 {
-  free_objects (allocated_objs);
+  free_table (&vm->global_names);
+  FREE_ARRAY (Global, vm->globals, vm->global_capacity);
+  init_globals (vm);
+  free_objects (vm->objects);
+  vm->objects = NULL;
+  vm->open_upvalues = NULL;
+  jit_free (vm->jit);
+  vm->jit = NULL;
+}
+
+void
+reset_vm (VM *vm)
+{
+  reset_stack (vm);
+  free_vm (vm);
+  define_natives (vm);
+  vm->jit = new_jit (vm->options);
+}
+
+int
+declare_global (VM *vm, const char *name, int length)
+{
+  uint32_t hash = hash_string (name, length);
+  Value index;
+  if (table_get (&vm->global_names, name, length, hash, &index))
+    return (int)AS_NUMBER (index);
+
+  if (vm->global_capacity < vm->global_count + 1)
+    {
+      int old_capacity = vm->global_capacity;
+      vm->global_capacity = GROW_CAPACITY (old_capacity);
+      vm->globals = GROW_ARRAY (Global, vm->globals, old_capacity,
+                                vm->global_capacity);
+    }
+  Global *global = &vm->globals[vm->global_count];
+  global->name = copy_string (&vm->objects, name, length);
+  global->value = NIL_VAL;
+  global->defined = false;
+  table_set (&vm->global_names, global->name,
+             NUMBER_VAL (vm->global_count));
+  return vm->global_count++;
 }
 
+bool
+get_global (VM *vm, const char *name, Value *value)
+{
+  int length = (int)strlen (name);
+  Value index;
+  if (!table_get (&vm->global_names, name, length, hash_string (name, length),
+                  &index))
+    return false;
+  const Global *global = &vm->globals[(int)AS_NUMBER (index)];
+  if (!global->defined)
+    return false;
+  *value = global->value;
+  return true;
+}
+
+static bool
+call (VM *vm, ObjClosure *closure, const ObjFunction *function,
+      int arg_count)
+{
+  if (arg_count != function->arity)
+    {
+      runtime_error (vm, "Expected %d arguments but got %d.", function->arity,
+                     arg_count);
+      return false;
+    }
+  if (vm->frame_count == FRAMES_MAX)
+    {
+      runtime_error (vm, "Stack overflow.");
+      return false;
+    }
+
+  CallFrame *frame = &vm->frames[vm->frame_count++];
+  frame->closure = closure;
+  frame->function = function;
+  frame->chunk = &function->chunk;
+  frame->ip = function->chunk.code;
+  frame->slots = vm->stack_top - arg_count - 1;
+  return true;
+}
+
+static bool
+call_value (VM *vm, Value callee, int arg_count)
+{
+  if (IS_OBJ (callee))
+    {
+      switch (OBJ_TYPE (callee))
+        {
+        case OBJ_CLOSURE:
+          {
+            ObjClosure *closure = AS_CLOSURE (callee);
+            return call (vm, closure, closure->function, arg_count);
+          }
+        case OBJ_FUNCTION:
+          return call (vm, NULL, AS_FUNCTION (callee), arg_count);
+        case OBJ_NATIVE:
+          {
+            ObjNative *native = AS_NATIVE (callee);
+            if (arg_count != native->arity)
+              {
+                runtime_error (vm, "Expected %d arguments but got %d.",
+                               native->arity, arg_count);
+                return false;
+              }
+            Value result
+                = native->function (arg_count, vm->stack_top - arg_count);
+            vm->stack_top -= arg_count + 1;
+            push (vm, result);
+            return true;
+          }
+        default:
+          break;
+        }
+    }
+  runtime_error (vm, "Can only call functions and classes.");
+  return false;
+}
+
+/**
+ * The upvalue for the variable in @p slot. Closures capturing the same
+ * variable share its upvalue.
+ */
+static ObjUpvalue *
+capture_upvalue (VM *vm, Value *slot)
+{
+  ObjUpvalue *previous = NULL;
+  ObjUpvalue *upvalue = vm->open_upvalues;
+  while (upvalue != NULL && upvalue->location > slot)
+    {
+      previous = upvalue;
+      upvalue = upvalue->next_open;
+    }
+  if (upvalue != NULL && upvalue->location == slot)
+    return upvalue;
+
+  ObjUpvalue *created = new_upvalue (&vm->objects, slot);
+  created->next_open = upvalue;
+  if (previous == NULL)
+    vm->open_upvalues = created;
+  else
+    previous->next_open = created;
+  return created;
+}
+
+#ifndef CLOX_REGISTER_VM
+/**
+ * The instruction pointer and the stack top live in local variables, so the
+ * compiler can keep them in machine registers instead of going through the
+ * frame and the VM for every instruction. Everything which looks at the VM
+ * from outside of run() needs them stored first: errors, calls and the JIT.
+ */
 static InterpretResult
 run (VM *vm)
 {
-#define READ_BYTE() (*vm->ip++)
-#define READ_CONSTANT() (vm->chunk->constants.values[READ_BYTE ()])
-#define BINARY_OP(result_value_type, op)                                      \
+  CallFrame *frame;
+  const uint8_t *ip;
+  Value *stack_top;
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() (frame->chunk->constants.values[READ_BYTE ()])
+#define PUSH(value) (*stack_top++ = (value))
+#define POP() (*--stack_top)
+#define PEEK(distance) (stack_top[-1 - (distance)])
+#define STORE_STATE() (frame->ip = ip, vm->stack_top = stack_top)
+#define LOAD_STATE()                                                          \
+  (frame = &vm->frames[vm->frame_count - 1], ip = frame->ip,                  \
+   stack_top = vm->stack_top)
+#define RUNTIME_ERROR(...)                                                    \
   do                                                                          \
     {                                                                         \
-      if (!IS_NUMBER (peek (vm, 0)) || !IS_NUMBER (peek (vm, 1)))             \
+      STORE_STATE ();                                                         \
+      runtime_error (vm, __VA_ARGS__);                                        \
+      return INTERPRET_RUNTIME_ERROR;                                         \
+    }                                                                         \
+  while (false)
+// Hand over to the machine code whenever a chunk is entered or a loop is run.
+#define JIT_ENTER()                                                           \
+  do                                                                          \
+    {                                                                         \
+      if (vm->jit != NULL)                                                    \
         {                                                                     \
-          runtime_error (vm, "Operands must be numbers.");                    \
-          return INTERPRET_RUNTIME_ERROR;                                     \
+          STORE_STATE ();                                                     \
+          frame->ip = jit_enter (vm, frame->chunk, ip);                       \
+          LOAD_STATE ();                                                      \
         }                                                                     \
-      double b = AS_NUMBER (pop (vm));                                        \
-      double a = AS_NUMBER (pop (vm));                                        \
-      push (vm, result_value_type (a op b));                                  \
+    }                                                                         \
+  while (false)
+#define BOTH_NUMBERS() (IS_NUMBER (PEEK (0)) && IS_NUMBER (PEEK (1)))
+// Replace the running instruction by another form of it.
+#define REWRITE(opcode) rewrite_opcode (frame->chunk, ip - 1, opcode)
+// Replace the two values on top of the stack by the result of an operation
+// on their numbers. The result overwrites the left operand in place.
+#define NUMBER_OP(result_value_type, op)                                      \
+  do                                                                          \
+    {                                                                         \
+      double b = AS_NUMBER (POP ());                                          \
+      PEEK (0) = result_value_type (AS_NUMBER (PEEK (0)) op b);               \
+    }                                                                         \
+  while (false)
+#define BINARY_OP(result_value_type, op)                                      \
+  do                                                                          \
+    {                                                                         \
+      if (!BOTH_NUMBERS ())                                                   \
+        RUNTIME_ERROR ("Operands must be numbers.");                          \
+      NUMBER_OP (result_value_type, op);                                      \
     }                                                                         \
   while (false)
 
-  if (is_option_set (OPT_TRACE_EXECUTION))
-    printf ("== execution ==\n");
+  LOAD_STATE ();
+  const bool trace_execution = vm->options & OPT_TRACE_EXECUTION;
+  if (trace_execution)
+    lox_writer_puts (vm->out, "== execution ==\n");
+  JIT_ENTER ();
 
   for (;;)
     {
-      if (is_option_set (OPT_TRACE_EXECUTION))
+      if (trace_execution)
         {
-          printf ("          ");
+          STORE_STATE ();
+          lox_writer_puts (vm->out, "          ");
           for (Value *slot = vm->stack; slot < vm->stack_top; slot++)
             {
-              printf ("[ ");
-              print_value (*slot);
-              printf (" ]");
+              lox_writer_puts (vm->out, "[ ");
+              print_value (vm->out, *slot);
+              lox_writer_puts (vm->out, " ]");
             }
-          printf ("\n");
-          disassemble_instruction (vm->chunk, (int)(vm->ip - vm->chunk->code));
+          lox_writer_putc (vm->out, '\n');
+          disassemble_instruction (vm->out, frame->chunk,
+                                   (int)(ip - frame->chunk->code));
         }
       uint8_t instruction;
       switch (instruction = READ_BYTE ())
@@ -125,49 +391,122 @@ run (VM *vm)
         case OP_CONSTANT:
           {
             Value constant = READ_CONSTANT ();
-            push (vm, constant);
+            PUSH (constant);
             break;
           }
         case OP_NIL:
-          push (vm, NIL_VAL);
+          PUSH (NIL_VAL);
           break;
         case OP_TRUE:
-          push (vm, BOOL_VAL (true));
+          PUSH (BOOL_VAL (true));
           break;
         case OP_FALSE:
-          push (vm, BOOL_VAL (false));
+          PUSH (BOOL_VAL (false));
+          break;
+        case OP_POP:
+          stack_top--;
           break;
+        case OP_GET_LOCAL:
+          {
+            uint8_t slot = READ_BYTE ();
+            PUSH (frame->slots[slot]);
+            break;
+          }
+        case OP_SET_LOCAL:
+          {
+            // Assignment is an expression, so its value stays on the stack.
+            uint8_t slot = READ_BYTE ();
+            frame->slots[slot] = PEEK (0);
+            break;
+          }
+        case OP_GET_GLOBAL:
+          {
+            Global *global = &vm->globals[READ_SHORT ()];
+            if (!global->defined)
+              RUNTIME_ERROR ("Undefined variable '%s'.", global->name->chars);
+            PUSH (global->value);
+            break;
+          }
+        case OP_DEFINE_GLOBAL:
+          {
+            Global *global = &vm->globals[READ_SHORT ()];
+            global->value = POP ();
+            global->defined = true;
+            break;
+          }
+        case OP_SET_GLOBAL:
+          {
+            Global *global = &vm->globals[READ_SHORT ()];
+            if (!global->defined)
+              RUNTIME_ERROR ("Undefined variable '%s'.", global->name->chars);
+            global->value = PEEK (0);
+            break;
+          }
         case OP_EQUAL:
           {
-            Value rhs = pop (vm);
-            Value lhs = pop (vm);
-            push (vm, BOOL_VAL (values_equal (lhs, rhs)));
+            Value rhs = POP ();
+            PEEK (0) = BOOL_VAL (values_equal (PEEK (0), rhs));
             break;
           }
         case OP_GREATER:
           BINARY_OP (BOOL_VAL, >);
           break;
+        // The specialized instructions check only the types they expect. A
+        // failed check turns them back into the generic instruction, which
+        // runs next and specializes them again for the types it sees.
+        case OP_LESS_NUM:
+          if (!BOTH_NUMBERS ())
+            {
+              REWRITE (OP_LESS);
+              ip--;
+              break;
+            }
+          NUMBER_OP (BOOL_VAL, <);
+          break;
         case OP_LESS:
+          if (BOTH_NUMBERS ())
+            REWRITE (OP_LESS_NUM);
           BINARY_OP (BOOL_VAL, <);
           break;
+        case OP_ADD_NUM:
+          if (!BOTH_NUMBERS ())
+            {
+              REWRITE (OP_ADD);
+              ip--;
+              break;
+            }
+          NUMBER_OP (NUMBER_VAL, +);
+          break;
+        case OP_ADD_STR:
+          if (!IS_STRING (PEEK (0)) || !IS_STRING (PEEK (1)))
+            {
+              REWRITE (OP_ADD);
+              ip--;
+              break;
+            }
+          {
+            ObjString *rhs = AS_STRING (POP ());
+            ObjString *lhs = AS_STRING (PEEK (0));
+            PEEK (0) = OBJ_VAL (concatenate_strings (&vm->objects, lhs, rhs));
+            break;
+          }
         case OP_ADD:
           {
-            if (IS_STRING (peek (vm, 0)) && IS_STRING (peek (vm, 1)))
+            if (IS_STRING (PEEK (0)) && IS_STRING (PEEK (1)))
               {
-                concatenate (vm);
+                REWRITE (OP_ADD_STR);
+                ObjString *rhs = AS_STRING (POP ());
+                ObjString *lhs = AS_STRING (PEEK (0));
+                PEEK (0)
+                    = OBJ_VAL (concatenate_strings (&vm->objects, lhs, rhs));
               }
-            else if (IS_NUMBER (peek (vm, 0)) && IS_NUMBER (peek (vm, 1)))
+            else if (BOTH_NUMBERS ())
               {
-                double b = AS_NUMBER (pop (vm));
-                double a = AS_NUMBER (pop (vm));
-                push (vm, NUMBER_VAL (a + b));
+                REWRITE (OP_ADD_NUM);
+                NUMBER_OP (NUMBER_VAL, +);
               }
             else
-              {
-                runtime_error (vm,
-                               "Operands must be two numbers or two strings.");
-                return INTERPRET_RUNTIME_ERROR;
-              }
+              RUNTIME_ERROR ("Operands must be two numbers or two strings.");
             break;
           }
         case OP_SUBTRACT:
@@ -180,53 +519,540 @@ run (VM *vm)
           BINARY_OP (NUMBER_VAL, /);
           break;
         case OP_NOT:
-          push (vm, BOOL_VAL (!is_truthy (pop (vm))));
+          PEEK (0) = BOOL_VAL (!is_truthy (PEEK (0)));
           break;
         case OP_NEGATE:
+          if (!IS_NUMBER (PEEK (0)))
+            RUNTIME_ERROR ("Operand must be a number.");
+          PEEK (0) = NUMBER_VAL (-AS_NUMBER (PEEK (0)));
+          break;
+        case OP_PRINT:
+          print_value (vm->out, POP ());
+          lox_writer_putc (vm->out, '\n');
+          break;
+        case OP_JUMP:
+          {
+            uint8_t offset = READ_BYTE ();
+            ip += offset;
+            break;
+          }
+        case OP_JUMP_LONG:
+          {
+            uint16_t offset = READ_SHORT ();
+            ip += offset;
+            break;
+          }
+        case OP_JUMP_IF_FALSE:
+          {
+            uint8_t offset = READ_BYTE ();
+            if (!is_truthy (PEEK (0)))
+              ip += offset;
+            break;
+          }
+        case OP_JUMP_IF_FALSE_LONG:
+          {
+            uint16_t offset = READ_SHORT ();
+            if (!is_truthy (PEEK (0)))
+              ip += offset;
+            break;
+          }
+        case OP_LOOP:
+          {
+            uint8_t offset = READ_BYTE ();
+            ip -= offset;
+            JIT_ENTER ();
+            break;
+          }
+        case OP_LOOP_LONG:
+          {
+            uint16_t offset = READ_SHORT ();
+            ip -= offset;
+            JIT_ENTER ();
+            break;
+          }
+        case OP_GET_UPVALUE:
+          {
+            uint8_t slot = READ_BYTE ();
+            PUSH (*frame->closure->upvalues[slot]->location);
+            break;
+          }
+        case OP_SET_UPVALUE:
+          {
+            uint8_t slot = READ_BYTE ();
+            *frame->closure->upvalues[slot]->location = PEEK (0);
+            break;
+          }
+        case OP_CLOSE_UPVALUE:
+          close_upvalues (vm, stack_top - 1);
+          stack_top--;
+          break;
+        case OP_CALL:
+          {
+            int arg_count = READ_BYTE ();
+            STORE_STATE ();
+            if (!call_value (vm, PEEK (arg_count), arg_count))
+              return INTERPRET_RUNTIME_ERROR;
+            LOAD_STATE ();
+            JIT_ENTER ();
+            break;
+          }
+        case OP_CLOSURE:
+          {
+            ObjFunction *function = AS_FUNCTION (READ_CONSTANT ());
+            ObjClosure *closure = new_closure (&vm->objects, function);
+            PUSH (OBJ_VAL (closure));
+            for (int i = 0; i < closure->upvalue_count; i++)
+              {
+                uint8_t is_local = READ_BYTE ();
+                uint8_t index = READ_BYTE ();
+                closure->upvalues[i]
+                    = is_local ? capture_upvalue (vm, frame->slots + index)
+                               : frame->closure->upvalues[index];
+              }
+            break;
+          }
+        case OP_RETURN:
           {
-            Value val = peek (vm, 0);
-            if (!IS_NUMBER (val))
+            // The script leaves nothing on the stack.
+            if (frame->function == NULL)
+              {
+                reset_stack (vm);
+                return INTERPRET_OK;
+              }
+            Value result = POP ();
+            // Captured variables leave the stack together with the frame.
+            close_upvalues (vm, frame->slots);
+            vm->frame_count--;
+            stack_top = frame->slots;
+            PUSH (result);
+            frame = &vm->frames[vm->frame_count - 1];
+            ip = frame->ip;
+            JIT_ENTER ();
+            break;
+          }
+        }
+    }
+
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_CONSTANT
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef STORE_STATE
+#undef LOAD_STATE
+#undef RUNTIME_ERROR
+#undef JIT_ENTER
+#undef BOTH_NUMBERS
+#undef REWRITE
+#undef NUMBER_OP
+#undef BINARY_OP
+}
+#else
+/**
+ * Run register code, see register.h. Every instruction reads its operands
+ * before it writes its result, so results may overwrite operands.
+ */
+static InterpretResult
+run (VM *vm)
+{
+  CallFrame *frame = &vm->frames[vm->frame_count - 1];
+
+#define READ_BYTE() (*frame->ip++)
+#define READ_SHORT()                                                          \
+  (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+#define READ_CONSTANT() (frame->chunk->constants.values[READ_BYTE ()])
+#define R(index) (frame->slots[index])
+#define BINARY_OP(result_value_type, op)                                      \
+  do                                                                          \
+    {                                                                         \
+      uint8_t result = READ_BYTE ();                                          \
+      Value lhs = R (READ_BYTE ());                                           \
+      Value rhs = R (READ_BYTE ());                                           \
+      if (!IS_NUMBER (lhs) || !IS_NUMBER (rhs))                               \
+        {                                                                     \
+          runtime_error (vm, "Operands must be numbers.");                    \
+          return INTERPRET_RUNTIME_ERROR;                                     \
+        }                                                                     \
+      R (result) = result_value_type (AS_NUMBER (lhs) op AS_NUMBER (rhs));    \
+    }                                                                         \
+  while (false)
+
+  // Registers have no order like a stack, so only instructions are traced.
+  const bool trace_execution = vm->options & OPT_TRACE_EXECUTION;
+  if (trace_execution)
+    lox_writer_puts (vm->out, "== execution ==\n");
+
+  for (;;)
+    {
+      if (trace_execution)
+        disassemble_instruction (vm->out, frame->chunk,
+                                 (int)(frame->ip - frame->chunk->code));
+      uint8_t instruction;
+      switch (instruction = READ_BYTE ())
+        {
+        case OP_R_MOVE:
+          {
+            uint8_t result = READ_BYTE ();
+            R (result) = R (READ_BYTE ());
+            break;
+          }
+        case OP_R_CONSTANT:
+          {
+            uint8_t result = READ_BYTE ();
+            R (result) = READ_CONSTANT ();
+            break;
+          }
+        case OP_R_NIL:
+          R (READ_BYTE ()) = NIL_VAL;
+          break;
+        case OP_R_TRUE:
+          R (READ_BYTE ()) = BOOL_VAL (true);
+          break;
+        case OP_R_FALSE:
+          R (READ_BYTE ()) = BOOL_VAL (false);
+          break;
+        case OP_R_GET_GLOBAL:
+          {
+            uint8_t result = READ_BYTE ();
+            Global *global = &vm->globals[READ_SHORT ()];
+            if (!global->defined)
+              {
+                runtime_error (vm, "Undefined variable '%s'.",
+                               global->name->chars);
+                return INTERPRET_RUNTIME_ERROR;
+              }
+            R (result) = global->value;
+            break;
+          }
+        case OP_R_DEFINE_GLOBAL:
+          {
+            Value value = R (READ_BYTE ());
+            Global *global = &vm->globals[READ_SHORT ()];
+            global->value = value;
+            global->defined = true;
+            break;
+          }
+        case OP_R_SET_GLOBAL:
+          {
+            Value value = R (READ_BYTE ());
+            Global *global = &vm->globals[READ_SHORT ()];
+            if (!global->defined)
+              {
+                runtime_error (vm, "Undefined variable '%s'.",
+                               global->name->chars);
+                return INTERPRET_RUNTIME_ERROR;
+              }
+            global->value = value;
+            break;
+          }
+        case OP_R_GET_UPVALUE:
+          {
+            uint8_t result = READ_BYTE ();
+            R (result) = *frame->closure->upvalues[READ_BYTE ()]->location;
+            break;
+          }
+        case OP_R_SET_UPVALUE:
+          {
+            Value value = R (READ_BYTE ());
+            *frame->closure->upvalues[READ_BYTE ()]->location = value;
+            break;
+          }
+        case OP_R_CLOSE_UPVALUE:
+          close_upvalues (vm, &R (READ_BYTE ()));
+          break;
+        case OP_R_EQUAL:
+          {
+            uint8_t result = READ_BYTE ();
+            Value lhs = R (READ_BYTE ());
+            Value rhs = R (READ_BYTE ());
+            R (result) = BOOL_VAL (values_equal (lhs, rhs));
+            break;
+          }
+        case OP_R_GREATER:
+          BINARY_OP (BOOL_VAL, >);
+          break;
+        case OP_R_LESS:
+          BINARY_OP (BOOL_VAL, <);
+          break;
+        case OP_R_ADD:
+          {
+            uint8_t result = READ_BYTE ();
+            Value lhs = R (READ_BYTE ());
+            Value rhs = R (READ_BYTE ());
+            if (IS_NUMBER (lhs) && IS_NUMBER (rhs))
+              R (result) = NUMBER_VAL (AS_NUMBER (lhs) + AS_NUMBER (rhs));
+            else if (IS_STRING (lhs) && IS_STRING (rhs))
+              R (result) = OBJ_VAL (concatenate_strings (
+                  &vm->objects, AS_STRING (lhs), AS_STRING (rhs)));
+            else
+              {
+                runtime_error (vm,
+                               "Operands must be two numbers or two strings.");
+                return INTERPRET_RUNTIME_ERROR;
+              }
+            break;
+          }
+        case OP_R_SUBTRACT:
+          BINARY_OP (NUMBER_VAL, -);
+          break;
+        case OP_R_MULTIPLY:
+          BINARY_OP (NUMBER_VAL, *);
+          break;
+        case OP_R_DIVIDE:
+          BINARY_OP (NUMBER_VAL, /);
+          break;
+        case OP_R_NOT:
+          {
+            uint8_t result = READ_BYTE ();
+            R (result) = BOOL_VAL (!is_truthy (R (READ_BYTE ())));
+            break;
+          }
+        case OP_R_NEGATE:
+          {
+            uint8_t result = READ_BYTE ();
+            Value value = R (READ_BYTE ());
+            if (!IS_NUMBER (value))
               {
                 runtime_error (vm, "Operand must be a number.");
                 return INTERPRET_RUNTIME_ERROR;
               }
-            push (vm, NUMBER_VAL (-AS_NUMBER (pop (vm))));
+            R (result) = NUMBER_VAL (-AS_NUMBER (value));
             break;
           }
-        case OP_RETURN:
+        case OP_R_PRINT:
+          print_value (vm->out, R (READ_BYTE ()));
+          lox_writer_putc (vm->out, '\n');
+          break;
+        case OP_R_JUMP:
           {
-            print_value (pop (vm));
-            printf ("\n");
-            return INTERPRET_OK;
+            uint16_t offset = READ_SHORT ();
+            frame->ip += offset;
+            break;
+          }
+        case OP_R_JUMP_IF_FALSE:
+          {
+            Value condition = R (READ_BYTE ());
+            uint16_t offset = READ_SHORT ();
+            if (!is_truthy (condition))
+              frame->ip += offset;
+            break;
+          }
+        case OP_R_LOOP:
+          {
+            uint16_t offset = READ_SHORT ();
+            frame->ip -= offset;
+            break;
+          }
+        case OP_R_CALL:
+          {
+            uint8_t callee = READ_BYTE ();
+            int arg_count = READ_BYTE ();
+            // The callee's frame starts at its register.
+            vm->stack_top = &R (callee) + arg_count + 1;
+            if (!call_value (vm, R (callee), arg_count))
+              return INTERPRET_RUNTIME_ERROR;
+            frame = &vm->frames[vm->frame_count - 1];
+            break;
+          }
+        case OP_R_CLOSURE:
+          {
+            uint8_t result = READ_BYTE ();
+            ObjFunction *function = AS_FUNCTION (READ_CONSTANT ());
+            ObjClosure *closure = new_closure (&vm->objects, function);
+            R (result) = OBJ_VAL (closure);
+            for (int i = 0; i < closure->upvalue_count; i++)
+              {
+                uint8_t is_local = READ_BYTE ();
+                uint8_t index = READ_BYTE ();
+                closure->upvalues[i]
+                    = is_local ? capture_upvalue (vm, frame->slots + index)
+                               : frame->closure->upvalues[index];
+              }
+            break;
+          }
+        case OP_R_RETURN:
+          {
+            Value result = R (READ_BYTE ());
+            if (frame->function == NULL)
+              {
+                reset_stack (vm);
+                return INTERPRET_OK;
+              }
+            // The result replaces the callee in the caller's registers.
+            close_upvalues (vm, frame->slots);
+            frame->slots[0] = result;
+            vm->frame_count--;
+            frame = &vm->frames[vm->frame_count - 1];
+            break;
           }
         }
     }
 
 #undef READ_BYTE
+#undef READ_SHORT
 #undef READ_CONSTANT
+#undef R
 #undef BINARY_OP
 }
+#endif
+
+struct Program
+{
+  Chunk chunk;
+  // The names of all globals of the compiling VM, in the order of their
+  // indices. They are compared to the globals of the running VM.
+  ObjString **global_names;
+  int global_count;
+};
+
+static InterpretResult
+run_chunk (VM *vm, const Chunk *chunk)
+{
+  CallFrame *frame = &vm->frames[vm->frame_count++];
+  frame->closure = NULL;
+  frame->function = NULL;
+  frame->chunk = chunk;
+  frame->ip = chunk->code;
+  frame->slots = vm->stack_top;
+  return run (vm);
+}
 
 InterpretResult
-interpret (VM *vm, const char *source)
+interpret (VM *vm, const char *source, size_t length)
 {
   Chunk chunk;
   init_chunk (&chunk);
 
-  if (!compile (source, &chunk))
+  if (!compile (vm, source, length, &chunk))
     {
       free_chunk (&chunk);
       return INTERPRET_COMPILE_ERROR;
     }
 
-  vm->chunk = &chunk;
-  vm->ip = vm->chunk->code;
-
   InterpretResult result = INTERPRET_OK;
+  if (!(vm->options & OPT_NO_EXECUTION))
+    result = run_chunk (vm, &chunk);
 
-  if (!is_option_set (OPT_NO_EXECUTION))
-    result = run (vm);
+  // Globals may still refer to the constants of the chunk, so the VM takes
+  // over its objects.
+  if (chunk.objects != NULL)
+    {
+      Obj *last = chunk.objects;
+      while (last->next != NULL)
+        last = last->next;
+      last->next = vm->objects;
+      vm->objects = chunk.objects;
+      chunk.objects = NULL;
+    }
 
+  // The functions of the chunk live on and keep their machine code.
+  jit_forget (vm->jit, &chunk);
   free_chunk (&chunk);
   return result;
 }
+
+/**
+ * Mark @p chunk and the chunks of all functions declared in it as shared.
+ */
+static void
+share_chunk (Chunk *chunk)
+{
+  chunk->shared = true;
+  for (int i = 0; i < chunk->constants.count; ++i)
+    {
+      Value constant = chunk->constants.values[i];
+      if (IS_FUNCTION (constant))
+        share_chunk (&AS_FUNCTION (constant)->chunk);
+    }
+}
+
+Program *
+compile_program (VM *vm, const char *source, size_t length)
+{
+  Program *program = ALLOCATE (Program, 1);
+  init_chunk (&program->chunk);
+  program->global_names = NULL;
+  program->global_count = 0;
+  if (!compile (vm, source, length, &program->chunk))
+    {
+      free_program (program);
+      return NULL;
+    }
+  share_chunk (&program->chunk);
+
+  program->global_names = ALLOCATE (ObjString *, vm->global_count);
+  program->global_count = vm->global_count;
+  for (int i = 0; i < vm->global_count; ++i)
+    {
+      const ObjString *name = vm->globals[i].name;
+      program->global_names[i]
+          = copy_string (&program->chunk.objects, name->chars, name->length);
+    }
+  return program;
+}
+
+/**
+ * Forget the machine code of @p chunk and of all functions declared in it.
+ */
+static void
+forget_chunk (JitState *jit, const Chunk *chunk)
+{
+  jit_forget (jit, chunk);
+  for (int i = 0; i < chunk->constants.count; ++i)
+    {
+      Value constant = chunk->constants.values[i];
+      if (IS_FUNCTION (constant))
+        forget_chunk (jit, &AS_FUNCTION (constant)->chunk);
+    }
+}
+
+void
+forget_program (VM *vm, const Program *program)
+{
+  forget_chunk (vm->jit, &program->chunk);
+}
+
+void
+free_program (Program *program)
+{
+  FREE_ARRAY (ObjString *, program->global_names, program->global_count);
+  free_chunk (&program->chunk);
+  FREE (Program, program);
+}
+
+/**
+ * Check that the globals of @p vm have the indices @p program was compiled
+ * for. Globals which @p vm does not know yet are declared.
+ */
+static bool
+link_globals (VM *vm, const Program *program)
+{
+  for (int i = 0; i < program->global_count; ++i)
+    {
+      const ObjString *name = program->global_names[i];
+      if (i == vm->global_count)
+        {
+          if (declare_global (vm, name->chars, name->length) != i)
+            return false;
+          continue;
+        }
+      const ObjString *known = vm->globals[i].name;
+      if (known->hash != name->hash || known->length != name->length
+          || memcmp (known->chars, name->chars, name->length) != 0)
+        return false;
+    }
+  return true;
+}
+
+InterpretResult
+run_program (VM *vm, const Program *program)
+{
+  if (!link_globals (vm, program))
+    {
+      lox_writer_flush (vm->out);
+      fprintf (vm->err, "Program was compiled for other globals.\n");
+      return INTERPRET_ERROR;
+    }
+  return run_chunk (vm, &program->chunk);
+}
@@ -1,18 +1,77 @@
 #pragma once
 
 #include "chunk.h"
+#include "common.h"
+#include "object.h"
+#include "table.h"
 #include "value.h"
 
-#define STACK_MAX 128
+#include <lox_writer.h>
+#include <stdio.h>
 
+#define FRAMES_MAX 64
+// Every local variable of every frame has its own slot.
+#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+
+/**
+ * A running function or the script. Frames live in a fixed array of the VM,
+ * so calls do not allocate.
+ */
 typedef struct
 {
-  Chunk *chunk;
-  uint8_t *ip;
+  // The closure which is called. NULL for functions without upvalues and
+  // the script.
+  ObjClosure *closure;
+  // NULL for the script.
+  const ObjFunction *function;
+  const Chunk *chunk;
+  const uint8_t *ip;
+  // The first stack slot of the frame. It holds the callee in functions and
+  // is followed by the arguments and locals.
+  Value *slots;
+} CallFrame;
+
+/**
+ * A global variable. The compiler resolves the names of globals to their
+ * index in VM::globals, so no names are looked up at run time.
+ */
+typedef struct
+{
+  ObjString *name;
+  Value value;
+  // Globals are declared when the compiler first sees their name, but only
+  // defined once their var statement runs.
+  bool defined;
+} Global;
+
+typedef struct JitState JitState;
+
+typedef struct
+{
+  CallFrame frames[FRAMES_MAX];
+  int frame_count;
   // Stack starts out at index 0 and grows in positive direction.
   Value stack[STACK_MAX];
   // The next free entry on the stack.
   Value *stack_top;
+  // Upvalues which still point into the stack, from the top of the stack.
+  ObjUpvalue *open_upvalues;
+  // Linked list of all objects allocated by this VM.
+  Obj *objects;
+  // Maps the name of every global to its index in globals.
+  Table global_names;
+  Global *globals;
+  int global_count;
+  int global_capacity;
+  // Modify compilation and execution.
+  CommandLineOptions options;
+  // Machine code of hot chunks, NULL if the JIT is off.
+  JitState *jit;
+  // Receives all regular output.
+  LoxWriter *out;
+  // Receives error messages. The regular output is flushed before, so both
+  // may go to the same file.
+  FILE *err;
 } VM;
 
 typedef enum
@@ -23,6 +82,72 @@ typedef enum
   INTERPRET_ERROR,
 } InterpretResult;
 
-void init_vm (VM *vm);
+/**
+ * Set up @p vm with the given @p options. Output goes to standard output and
+ * standard error unless vm->out and vm->err are changed afterwards. VMs share
+ * no other state, so independent VMs may run on different threads at the
+ * same time. Only one thread may write to lox_stdout(), so all VMs but one
+ * of them need their own vm->out.
+ */
+void init_vm (VM *vm, CommandLineOptions options);
 void free_vm (VM *vm);
-InterpretResult interpret (VM *vm, const char *source);
+
+/**
+ * Free all objects and globals created by earlier runs and clear the stack,
+ * so the next run starts from a fresh state.
+ */
+void reset_vm (VM *vm);
+
+/**
+ * The index of the global variable with @p length characters at @p name. An
+ * undefined global is declared if the name is new.
+ */
+int declare_global (VM *vm, const char *name, int length);
+
+/**
+ * Store the value of the global variable @p name in @p value. Returns false
+ * if there is no such global or it has not been defined yet. Objects in
+ * @p value stay valid until the next reset_vm() or free_vm() of @p vm and as
+ * long as the program which created them exists.
+ */
+bool get_global (VM *vm, const char *name, Value *value);
+
+/**
+ * Compile and run a script in one go. Its globals stay defined for later
+ * scripts on @p vm.
+ */
+InterpretResult interpret (VM *vm, const char *source, size_t length);
+
+/**
+ * A compiled script. It may be run many times and by several VMs at the same
+ * time. Running it does not modify it, so unlike the code of interpret(), its
+ * instructions are not specialized to the types they see, see
+ * rewrite_opcode().
+ *
+ * Globals are referenced by the index they have on the VM which compiled the
+ * script. Another VM can only run the program if its globals agree with
+ * these indices, e.g. if it is fresh or ran the same programs before.
+ */
+typedef struct Program Program;
+
+/**
+ * Compile @p length characters at @p source for later runs. Returns NULL if
+ * the script does not compile. Errors are reported to vm->err.
+ */
+Program *compile_program (VM *vm, const char *source, size_t length);
+
+/**
+ * Free the machine code @p vm generated for @p program. Call it on every VM
+ * which ran the program before it is freed, unless the VM is freed or reset
+ * first.
+ */
+void forget_program (VM *vm, const Program *program);
+
+void free_program (Program *program);
+
+/**
+ * Run @p program on @p vm. Its results are left in the globals, see
+ * get_global(). Returns INTERPRET_ERROR if the globals of @p vm do not agree
+ * with those the program was compiled for.
+ */
+InterpretResult run_program (VM *vm, const Program *program);
@@ -0,0 +1,111 @@
+// Use the embedding API: compile scripts once and run them many times on
+// several VMs.
+
+#include "object.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RUNS 1000
+
+static bool ok = true;
+
+static void
+check (bool condition, const char *message)
+{
+  if (!condition)
+    {
+      fprintf (stderr, "Check failed: %s\n", message);
+      ok = false;
+    }
+}
+
+static Program *
+compile_text (VM *vm, const char *source)
+{
+  return compile_program (vm, source, strlen (source));
+}
+
+static bool
+number_global (VM *vm, const char *name, double expected)
+{
+  Value value;
+  return get_global (vm, name, &value) && IS_NUMBER (value)
+         && AS_NUMBER (value) == expected;
+}
+
+int
+main (void)
+{
+  VM first;
+  VM second;
+  init_vm (&first, 0);
+  init_vm (&second, 0);
+  // Errors are expected below and should not clutter the test output.
+  FILE *errors = tmpfile ();
+  first.err = errors;
+  second.err = errors;
+
+  Program *arithmetic
+      = compile_text (&first, "var result = (1 + 2) * 3 - 4 / 8;");
+  Program *strings = compile_text (
+      &first, "var text = \"com\" + \"piled \" + \"once\";");
+  Program *counter = compile_text (
+      &first, "{ var step = 1; count = count + step; }");
+  Program *negate = compile_text (&first, "-\"text\";");
+  Program *start = compile_text (&first, "var count = 0;");
+  check (arithmetic && strings && counter && negate && start,
+         "scripts compile");
+  check (compile_text (&first, "1 +;") == NULL, "syntax errors are reported");
+
+  for (int i = 0; i < RUNS && ok; ++i)
+    {
+      // Alternate between the VMs, which share the programs.
+      VM *vm = i % 2 ? &second : &first;
+      Value text;
+      check (run_program (vm, arithmetic) == INTERPRET_OK
+                 && number_global (vm, "result", 8.5),
+             "arithmetic result");
+      check (run_program (vm, strings) == INTERPRET_OK
+                 && get_global (vm, "text", &text) && IS_STRING (text)
+                 && strcmp (AS_CSTRING (text), "compiled once") == 0,
+             "string result");
+      check (run_program (vm, negate) == INTERPRET_RUNTIME_ERROR,
+             "run time errors are reported");
+      if (i % 100 == 99)
+        reset_vm (vm);
+    }
+
+  // Globals keep their values between runs until the VM is reset.
+  Value count;
+  check (run_program (&first, counter) == INTERPRET_RUNTIME_ERROR,
+         "globals are undefined before their definition");
+  check (run_program (&first, start) == INTERPRET_OK, "counter starts");
+  for (int i = 0; i < 10; ++i)
+    check (run_program (&first, counter) == INTERPRET_OK, "counter runs");
+  check (number_global (&first, "count", 10), "globals are kept");
+  reset_vm (&first);
+  check (!get_global (&first, "count", &count), "globals are reset");
+
+  // A VM whose globals have other indices cannot run the programs.
+  VM third;
+  init_vm (&third, 0);
+  third.err = errors;
+  Program *other = compile_text (&third, "var other = 1;");
+  check (run_program (&third, other) == INTERPRET_OK, "other runs");
+  check (run_program (&third, arithmetic) == INTERPRET_ERROR,
+         "mismatching globals are detected");
+
+  free_program (arithmetic);
+  free_program (strings);
+  free_program (counter);
+  free_program (negate);
+  free_program (start);
+  free_program (other);
+  free_vm (&first);
+  free_vm (&second);
+  free_vm (&third);
+  fclose (errors);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+// Machine code lives as long as the chunk it was generated for.
+
+#include "jit.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LINES 3000
+
+static bool ok = true;
+
+static void
+check (bool condition, const char *message)
+{
+  if (!condition)
+    {
+      fprintf (stderr, "Check failed: %s\n", message);
+      ok = false;
+    }
+}
+
+static InterpretResult
+interpret_text (VM *vm, const char *source)
+{
+  return interpret (vm, source, strlen (source));
+}
+
+int
+main (void)
+{
+  VM vm;
+  init_vm (&vm, OPT_JIT);
+  // Without a JIT on this platform there is no machine code to check.
+  if (vm.jit == NULL)
+    {
+      free_vm (&vm);
+      return 0;
+    }
+
+  // Like a REPL session, every line is a chunk of its own.
+  const char *loop = "for (var i = 0; i < 20; i = i + 1) {}";
+  for (int i = 0; i < LINES; ++i)
+    check (interpret_text (&vm, loop) == INTERPRET_OK, "loop runs");
+  check (jit_code_count (vm.jit) == 0, "code of freed chunks is freed");
+
+  check (interpret_text (&vm, "fun count() {"
+                              "  for (var i = 0; i < 20; i = i + 1) {}"
+                              "}"
+                              "count();")
+             == INTERPRET_OK,
+         "function runs");
+  check (jit_code_count (vm.jit) == 1, "code of live functions is kept");
+
+  const char *source = "fun spin() { for (var i = 0; i < 20; i = i + 1) {} }"
+                       "for (var i = 0; i < 20; i = i + 1) spin();";
+  Program *program = compile_program (&vm, source, strlen (source));
+  check (program != NULL, "program compiles");
+  check (run_program (&vm, program) == INTERPRET_OK, "program runs");
+  check (jit_code_count (vm.jit) == 3, "program is compiled");
+  forget_program (&vm, program);
+  check (jit_code_count (vm.jit) == 1, "code of the program is freed");
+  free_program (program);
+
+  free_vm (&vm);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+// Run independent VMs on several threads at the same time. Each VM writes to
+// its own file and the output of every VM is checked afterwards.
+
+#include "vm.h"
+#include <lox_writer.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREADS 8
+#define ITERATIONS 500
+
+typedef struct
+{
+  int id;
+  VM vm;
+  LoxWriter writer;
+  FILE *file;
+  bool ok;
+} Worker;
+
+/**
+ * The i-th program of a worker. Numbers and string concatenation exercise
+ * constants and objects allocated at run time.
+ */
+static void
+make_program (int id, int i, char *source, size_t size)
+{
+  if (i % 2 == 0)
+    snprintf (source, size, "print %d * 1000 + %d / 2;", id, i);
+  else
+    snprintf (source, size,
+              "print \"worker \" + \"%d\" + \" \" + \"%d\";", id, i);
+}
+
+static void
+make_expected (int id, int i, char *expected, size_t size)
+{
+  if (i % 2 == 0)
+    snprintf (expected, size, "%d\n", id * 1000 + i / 2);
+  else
+    snprintf (expected, size, "worker %d %d\n", id, i);
+}
+
+static void *
+run_worker (void *arg)
+{
+  Worker *worker = arg;
+  char source[64];
+  for (int i = 0; i < ITERATIONS; ++i)
+    {
+      make_program (worker->id, i, source, sizeof (source));
+      if (interpret (&worker->vm, source, strlen (source)) != INTERPRET_OK)
+        {
+          worker->ok = false;
+          return NULL;
+        }
+    }
+  lox_writer_flush (&worker->writer);
+  worker->ok = true;
+  return NULL;
+}
+
+static bool
+check_output (Worker *worker)
+{
+  rewind (worker->file);
+  char line[64];
+  char expected[64];
+  for (int i = 0; i < ITERATIONS; ++i)
+    {
+      make_expected (worker->id, i, expected, sizeof (expected));
+      if (!fgets (line, sizeof (line), worker->file)
+          || strcmp (line, expected) != 0)
+        {
+          fprintf (stderr, "Worker %d: expected \"%s\" in line %d.\n",
+                   worker->id, expected, i + 1);
+          return false;
+        }
+    }
+  return fgetc (worker->file) == EOF;
+}
+
+int
+main (void)
+{
+  static Worker workers[THREADS];
+  pthread_t threads[THREADS];
+
+  for (int t = 0; t < THREADS; ++t)
+    {
+      Worker *worker = &workers[t];
+      worker->id = t;
+      worker->file = tmpfile ();
+      if (worker->file == NULL)
+        {
+          perror ("tmpfile");
+          return 1;
+        }
+      lox_writer_init (&worker->writer, worker->file);
+      init_vm (&worker->vm, 0);
+      worker->vm.out = &worker->writer;
+    }
+
+  for (int t = 0; t < THREADS; ++t)
+    {
+      if (pthread_create (&threads[t], NULL, run_worker, &workers[t]) != 0)
+        {
+          fprintf (stderr, "Could not start thread %d.\n", t);
+          return 1;
+        }
+    }
+
+  bool ok = true;
+  for (int t = 0; t < THREADS; ++t)
+    {
+      pthread_join (threads[t], NULL);
+      Worker *worker = &workers[t];
+      ok = ok && worker->ok && check_output (worker);
+      free_vm (&worker->vm);
+      fclose (worker->file);
+    }
+
+  return ok ? 0 : 1;
+}
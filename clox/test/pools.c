@@ -0,0 +1,76 @@
+// Allocate from the object pools and check their statistics.
+
+#include "memory.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define BLOCKS 2000
+
+static bool ok = true;
+
+static void
+check (bool condition, const char *message)
+{
+  if (!condition)
+    {
+      fprintf (stderr, "Check failed: %s\n", message);
+      ok = false;
+    }
+}
+
+static void *blocks[BLOCKS];
+
+static void *
+allocate_on_thread (void *unused)
+{
+  (void)unused;
+  for (int i = 0; i < BLOCKS; ++i)
+    blocks[i] = pool_allocate (40);
+  return NULL;
+}
+
+int
+main (void)
+{
+  void *first = pool_allocate (24);
+  check ((uintptr_t)first % POOL_GRANULARITY == 0, "blocks are aligned");
+  PoolStatistics statistics = pool_statistics ();
+  check (statistics.classes[1].blocks_in_use == 1, "block is counted");
+  check (statistics.classes[1].block_size == 32, "size is rounded up");
+  check (statistics.requested_bytes == 24, "requested bytes are counted");
+  check (statistics.block_bytes == 32, "block bytes are counted");
+
+  pool_free (first, 24);
+  check (pool_statistics ().classes[1].free_blocks == 1,
+         "freed block is kept");
+  check (pool_allocate (30) == first, "freed block is reused");
+  pool_free (first, 30);
+
+  void *large = pool_allocate (POOL_MAX_SIZE + 1);
+  statistics = pool_statistics ();
+  check (statistics.large_allocations == 1, "large allocation is counted");
+  check (statistics.large_bytes == POOL_MAX_SIZE + 1,
+         "large bytes are counted");
+  pool_free (large, POOL_MAX_SIZE + 1);
+  check (pool_statistics ().large_allocations == 0,
+         "large allocation is freed");
+
+  // Blocks of a finished thread may be freed on another one.
+  pthread_t thread;
+  pthread_create (&thread, NULL, allocate_on_thread, NULL);
+  pthread_join (thread, NULL);
+  check (pool_statistics ().classes[2].blocks_in_use == BLOCKS,
+         "blocks of other threads are counted");
+  for (int i = 0; i < BLOCKS; ++i)
+    pool_free (blocks[i], 40);
+  statistics = pool_statistics ();
+  check (statistics.classes[2].blocks_in_use == 0, "all blocks are freed");
+  check (statistics.classes[2].free_blocks == BLOCKS, "free blocks are kept");
+  check (statistics.requested_bytes == 0, "no bytes are requested");
+  check (statistics.free_bytes == statistics.slab_bytes,
+         "all slab bytes are free");
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,355 @@
+// Measure the stages of the cpplox pipeline in isolation: scanning, parsing,
+// resolving and interpreting. Every stage processes synthetic programs of
+// increasing size and the cost per token or syntax tree node is reported. If
+// this cost grows with the size of the program, the stage scales
+// superlinearly.
+//
+// Usage: pipeline_bench [--max-statements=<n>] [--repeat=<n>] [--strict]
+
+#include "error.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "program.h"
+#include "resolver.h"
+#include "scanner.h"
+#include "stmt.h"
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace
+{
+using namespace lox;
+
+constexpr long min_statements = 256;
+constexpr long size_factor = 4;
+
+//! A stage counts as superlinear if its time grows faster than the size of
+//! the program to this power.
+constexpr double superlinear_exponent = 1.2;
+
+/**
+ * Count all Expr and Stmt nodes of a syntax tree. This is a visitor for both
+ * Expr and Stmt variants.
+ */
+class NodeCounter
+{
+public:
+  std::size_t nodes{};
+
+  void
+  count (const Expr &expr)
+  {
+    ++nodes;
+    std::visit (*this, expr);
+  }
+
+  void
+  count (const Stmt &stmt)
+  {
+    ++nodes;
+    std::visit (*this, stmt);
+  }
+
+  template <typename T>
+  void
+  count (const std::optional<T> &node)
+  {
+    if (node)
+      count (*node);
+  }
+
+  template <typename T>
+  void
+  count (const std::vector<T> &nodes)
+  {
+    for (const T &node : nodes)
+      count (node);
+  }
+
+  template <typename T>
+  void
+  operator() (const Box<T> &boxed)
+  {
+    this->operator() (*boxed);
+  }
+
+  void operator() (const ExprLiteral &) {}
+  void operator() (const ExprVariable &) {}
+
+  void
+  operator() (const ExprLogical &e)
+  {
+    count (e.left);
+    count (e.right);
+  }
+
+  void
+  operator() (const ExprBinary &e)
+  {
+    count (e.left);
+    count (e.right);
+  }
+
+  void
+  operator() (const ExprUnary &e)
+  {
+    count (e.right);
+  }
+
+  void
+  operator() (const ExprGrouping &e)
+  {
+    count (e.expression);
+  }
+
+  void
+  operator() (const ExprAssign &e)
+  {
+    count (e.value);
+  }
+
+  void
+  operator() (const ExprCall &e)
+  {
+    count (e.callee);
+    count (e.arguments);
+  }
+
+  void
+  operator() (const StmtExpr &s)
+  {
+    count (s.expression);
+  }
+
+  void
+  operator() (const StmtPrint &s)
+  {
+    count (s.expression);
+  }
+
+  void
+  operator() (const StmtVar &s)
+  {
+    count (s.initializer);
+  }
+
+  void
+  operator() (const StmtBlock &s)
+  {
+    count (s.statements);
+  }
+
+  void
+  operator() (const StmtIf &s)
+  {
+    count (s.condition);
+    count (s.then_branch);
+    count (s.else_branch);
+  }
+
+  void
+  operator() (const StmtWhile &s)
+  {
+    count (s.condition);
+    count (s.body);
+  }
+
+  void
+  operator() (const StmtFunction &s)
+  {
+    count (s.body);
+  }
+
+  void
+  operator() (const StmtReturn &s)
+  {
+    count (s.value);
+  }
+};
+
+/**
+ * A program of @p statements straight-line statements on a few global
+ * variables. Without loops, every node is executed exactly once.
+ */
+std::string
+generate_program (long statements)
+{
+  std::string source = "var total = 0;\n";
+  for (long i = 0; i < statements; ++i)
+    {
+      const std::string name = "v" + std::to_string (i % 16);
+      const std::string number = std::to_string (i);
+      switch (i % 3)
+        {
+        case 0:
+          source += "var " + name + " = " + number + " * 2 + 1;\n";
+          break;
+        case 1:
+          source += "total = total + (" + number + " - 1) / 3;\n";
+          break;
+        default:
+          source += "if (total > " + number + ") total = total - 1; "
+                    "else total = -total;\n";
+          break;
+        }
+    }
+  return source;
+}
+
+struct Stage
+{
+  const char *name;
+  const char *unit;
+  //! Run the stage once on the prepared input and return the seconds.
+  std::function<double ()> run;
+  //! The number of units the time is divided by.
+  std::size_t units;
+  //! Nanoseconds per unit for each program size.
+  std::vector<double> cost{};
+};
+
+template <typename F>
+double
+time_it (F &&f)
+{
+  const auto start = std::chrono::steady_clock::now ();
+  f ();
+  const std::chrono::duration<double> elapsed
+      = std::chrono::steady_clock::now () - start;
+  return elapsed.count ();
+}
+
+[[noreturn]] void
+print_usage (const char *program)
+{
+  std::cerr << "Usage: " << program
+            << " [--max-statements=<n>] [--repeat=<n>] [--strict]\n";
+  std::exit (64);
+}
+} // namespace
+
+int
+main (int argc, char **argv)
+{
+  long max_statements = 64 * 1024;
+  long repeat = 5;
+  bool strict = false;
+  for (int i = 1; i < argc; ++i)
+    {
+      const std::string_view arg = argv[i];
+      if (arg.substr (0, 17) == "--max-statements=")
+        max_statements = std::strtol (argv[i] + 17, nullptr, 10);
+      else if (arg.substr (0, 9) == "--repeat=")
+        repeat = std::strtol (argv[i] + 9, nullptr, 10);
+      else if (arg == "--strict")
+        strict = true;
+      else
+        print_usage (argv[0]);
+    }
+  if (max_statements < min_statements || repeat < 1)
+    print_usage (argv[0]);
+
+  std::vector<long> sizes;
+  std::array<Stage, 5> stages{ {
+      { "scan", "ns/token", {}, 0 },
+      { "parse", "ns/node", {}, 0 },
+      { "resolve", "ns/node", {}, 0 },
+      { "interpret", "ns/node", {}, 0 },
+      { "explicit stack", "ns/node", {}, 0 },
+  } };
+
+  std::printf ("%10s %10s %10s", "statements", "tokens", "nodes");
+  for (const Stage &stage : stages)
+    std::printf (" %14s", stage.name);
+  std::printf ("\n");
+
+  Interpreter interpreter;
+  InterpreterOptions explicit_stack_options;
+  explicit_stack_options.explicit_stack = true;
+  Interpreter explicit_stack{ explicit_stack_options };
+
+  for (long n = min_statements; n <= max_statements; n *= size_factor)
+    {
+      const std::string source = generate_program (n);
+      const std::vector<Token> tokens = scan_tokens (source);
+      const std::optional<Program> program = compile (source);
+      if (!program)
+        {
+          std::cerr << "The generated program does not compile.\n";
+          return 1;
+        }
+      NodeCounter counter;
+      counter.count (program->statements);
+
+      stages[0].run
+          = [&] () { return time_it ([&] { scan_tokens (source); }); };
+      stages[1].run = [&] () {
+        Parser parser{ tokens };
+        return time_it ([&] { parser.parse (); });
+      };
+      stages[2].run = [&] () {
+        Resolution resolution;
+        return time_it (
+            [&] { resolve (program->statements, resolution); });
+      };
+      stages[3].run = [&] () {
+        interpreter.reset ();
+        return time_it ([&] { interpreter.execute (*program); });
+      };
+      stages[4].run = [&] () {
+        explicit_stack.reset ();
+        return time_it ([&] { explicit_stack.execute (*program); });
+      };
+      stages[0].units = tokens.size () - 1;
+      for (std::size_t s = 1; s < stages.size (); ++s)
+        stages[s].units = counter.nodes;
+
+      std::printf ("%10ld %10zu %10zu", n, stages[0].units, counter.nodes);
+      for (Stage &stage : stages)
+        {
+          double best = 0.0;
+          for (long run = 0; run < repeat; ++run)
+            {
+              const double seconds = stage.run ();
+              if (run == 0 || seconds < best)
+                best = seconds;
+            }
+          stage.cost.push_back (best * 1e9
+                                / static_cast<double> (stage.units));
+          std::printf (" %14.2f", stage.cost.back ());
+        }
+      std::printf ("\n");
+      sizes.push_back (n);
+    }
+
+  // Compare the cost per unit of the smallest and the largest program.
+  bool ok = !had_error && !had_run_time_error;
+  const double size_ratio
+      = static_cast<double> (sizes.back ()) / static_cast<double> (sizes[0]);
+  for (const Stage &stage : stages)
+    {
+      if (sizes.size () < 2)
+        break;
+      const double growth = stage.cost.back () / stage.cost.front ();
+      const double exponent = 1.0 + std::log (growth) / std::log (size_ratio);
+      const bool superlinear = exponent > superlinear_exponent;
+      std::printf ("%-15s %-9s scaling exponent %.2f%s\n", stage.name,
+                   stage.unit, exponent, superlinear ? "  SUPERLINEAR" : "");
+      if (superlinear && strict)
+        ok = false;
+    }
+
+  return ok ? 0 : 1;
+}
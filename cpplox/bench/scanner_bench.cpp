@@ -0,0 +1,208 @@
+// Measure the throughput of the scanner on a large synthetic source. The
+// source is scanned with every instruction set the CPU supports and the
+// results are checked against each other.
+//
+// Usage: scanner_bench [--size=<MiB>] [--repeat=<n>]
+
+#include "error.h"
+#include "scanner.h"
+#include "token.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <lox_scan.h>
+#include <string>
+#include <string_view>
+
+namespace
+{
+class SourceGenerator
+{
+public:
+  /**
+   * A source which is mostly comments and long string literals, with some
+   * indented expressions in between.
+   */
+  std::string
+  generate (std::size_t size)
+  {
+    std::string source;
+    source.reserve (size + 1024);
+    while (source.size () < size)
+      {
+        switch (next_random () % 4)
+          {
+          case 0:
+            source += "// ";
+            append_words (source, 8, 20);
+            source += '\n';
+            break;
+          case 1:
+            source += '"';
+            append_words (source, 10, 40);
+            source += '\n';
+            append_words (source, 0, 20);
+            source += "\" + \"";
+            append_words (source, 1, 5);
+            source += "\"\n";
+            break;
+          case 2:
+            source += "        \t  (1.5 + 22) * -3 >= 4 == !true\r\n";
+            break;
+          default:
+            source += "\n      \n  \t    \n";
+            break;
+          }
+      }
+    return source;
+  }
+
+private:
+  std::uint32_t
+  next_random ()
+  {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+  }
+
+  void
+  append_words (std::string &source, std::uint32_t min, std::uint32_t max)
+  {
+    constexpr std::array<std::string_view, 12> words
+        = { "lorem", "ipsum", "dolor", "sit", "amet", "scanner",
+            "token", "line",  "of",    "the", "log",  "processing" };
+    const std::uint32_t count = min + next_random () % (max - min + 1);
+    for (std::uint32_t i = 0; i < count; ++i)
+      {
+        source += words[next_random () % words.size ()];
+        source += ' ';
+      }
+  }
+
+  std::uint32_t state{ 42 };
+};
+
+struct ScanResult
+{
+  long tokens{};
+  long checksum{};
+  int last_line{};
+
+  bool
+  operator!= (const ScanResult &other) const
+  {
+    return tokens != other.tokens || checksum != other.checksum
+           || last_line != other.last_line;
+  }
+};
+
+ScanResult
+scan_all (std::string_view source)
+{
+  ScanResult result;
+  lox::TokenStream tokens{ source };
+  for (;;)
+    {
+      const lox::Token token = tokens.next ();
+      if (token.type == lox::TokenType::TOK_EOF)
+        {
+          result.last_line = token.line;
+          return result;
+        }
+      result.tokens++;
+      result.checksum += static_cast<long> (token.type)
+                         + static_cast<long> (token.lexeme.size ())
+                         + token.line;
+    }
+}
+
+const char *
+level_name (LoxScanLevel level)
+{
+  switch (level)
+    {
+    case LOX_SCAN_SCALAR:
+      return "scalar";
+    case LOX_SCAN_SSE2:
+      return "sse2";
+    case LOX_SCAN_AVX2:
+      return "avx2";
+    }
+  return "unknown";
+}
+
+[[noreturn]] void
+print_usage (const char *program)
+{
+  std::cerr << "Usage: " << program << " [--size=<MiB>] [--repeat=<n>]\n";
+  std::exit (64);
+}
+} // namespace
+
+int
+main (int argc, char **argv)
+{
+  long size_mib = 64;
+  long repeat = 3;
+  for (int i = 1; i < argc; ++i)
+    {
+      const std::string_view arg = argv[i];
+      if (arg.substr (0, 7) == "--size=")
+        size_mib = std::strtol (argv[i] + 7, nullptr, 10);
+      else if (arg.substr (0, 9) == "--repeat=")
+        repeat = std::strtol (argv[i] + 9, nullptr, 10);
+      else
+        print_usage (argv[0]);
+    }
+  if (size_mib < 1 || repeat < 1)
+    print_usage (argv[0]);
+
+  const std::string source = SourceGenerator{}.generate (
+      static_cast<std::size_t> (size_mib) << 20);
+  const double mib = static_cast<double> (source.size ()) / (1 << 20);
+  std::printf ("scanning %.1f MiB, best of %ld runs\n", mib, repeat);
+
+  bool ok = true;
+  ScanResult reference;
+  const LoxScanLevel supported = lox_scan_supported_level ();
+  for (int level = LOX_SCAN_SCALAR; level <= supported; ++level)
+    {
+      lox_scan_set_level (static_cast<LoxScanLevel> (level));
+      double best = 0.0;
+      ScanResult result;
+      for (long run = 0; run < repeat; ++run)
+        {
+          const auto start = std::chrono::steady_clock::now ();
+          result = scan_all (source);
+          const std::chrono::duration<double> elapsed
+              = std::chrono::steady_clock::now () - start;
+          if (run == 0 || elapsed.count () < best)
+            best = elapsed.count ();
+        }
+
+      const char *name = level_name (static_cast<LoxScanLevel> (level));
+      std::printf ("%-8s %10.1f MiB/s  %ld tokens, %d lines\n", name,
+                   mib / best, result.tokens, result.last_line);
+
+      if (level == LOX_SCAN_SCALAR)
+        reference = result;
+      else if (result != reference)
+        {
+          std::fprintf (stderr, "%s scanner disagrees with the scalar one.\n",
+                        name);
+          ok = false;
+        }
+    }
+
+  if (lox::had_error)
+    {
+      std::fprintf (stderr, "Unexpected scanner errors.\n");
+      ok = false;
+    }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,620 @@
+#include "ast_cache.h"
+#include "expr.h"
+#include "runtime.h"
+#include "stmt.h"
+#include "token.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <unistd.h>
+#include <utility>
+#include <variant>
+
+namespace lox
+{
+namespace
+{
+constexpr std::string_view magic = "LOXAST";
+
+/**
+ * Increment whenever the encoding changes. Nodes are tagged with their index
+ * in the Expr and Stmt variants, so any change to these variants also
+ * requires a new version.
+ */
+constexpr std::uint64_t format_version = 1;
+
+/**
+ * Write the AST in pre-order. Integers are stored as LEB128 varints. This is a
+ * visitor for both Expr and Stmt variants.
+ */
+class Encoder
+{
+public:
+  std::string out;
+
+  void
+  byte (std::uint8_t b)
+  {
+    out.push_back (static_cast<char> (b));
+  }
+
+  void
+  varint (std::uint64_t value)
+  {
+    while (value >= 0x80)
+      {
+        byte (static_cast<std::uint8_t> (value | 0x80));
+        value >>= 7;
+      }
+    byte (static_cast<std::uint8_t> (value));
+  }
+
+  void
+  string (const std::string &s)
+  {
+    varint (s.size ());
+    out.append (s);
+  }
+
+  void
+  number (double d)
+  {
+    std::uint64_t bits;
+    std::memcpy (&bits, &d, sizeof (bits));
+    for (int i = 0; i < 8; ++i)
+      byte (static_cast<std::uint8_t> (bits >> (8 * i)));
+  }
+
+  void
+  literal (const Literal &l)
+  {
+    byte (l.index ());
+    std::visit (overloaded{ [] (std::nullptr_t) {},
+                            [this] (const std::string &s) { string (s); },
+                            [this] (bool b) { byte (b); },
+                            [this] (double d) { number (d); } },
+                l);
+  }
+
+  void
+  token (const Token &t)
+  {
+    byte (static_cast<std::uint8_t> (t.type));
+    string (t.lexeme);
+    byte (t.literal.has_value ());
+    if (t.literal)
+      literal (*t.literal);
+    varint (t.line);
+    varint (t.start);
+  }
+
+  void
+  expr (const Expr &e)
+  {
+    byte (e.index ());
+    std::visit (*this, e);
+  }
+
+  void
+  stmt (const Stmt &s)
+  {
+    byte (s.index ());
+    std::visit (*this, s);
+  }
+
+  template <typename T>
+  void
+  list (const std::vector<T> &nodes)
+  {
+    varint (nodes.size ());
+    for (const T &node : nodes)
+      {
+        if constexpr (std::is_same_v<T, Token>)
+          token (node);
+        else if constexpr (std::is_same_v<T, Expr>)
+          expr (node);
+        else
+          stmt (node);
+      }
+  }
+
+  template <typename T>
+  void
+  optional (const std::optional<T> &node)
+  {
+    byte (node.has_value ());
+    if (node)
+      {
+        if constexpr (std::is_same_v<T, Expr>)
+          expr (*node);
+        else
+          stmt (*node);
+      }
+  }
+
+  /**
+   * Helper to resolve the boxed content. Forwards the call to the unboxed
+   * type T. Notaby, this works for boxed Stmt _and_ Expr variants.
+   */
+  template <typename T>
+  void
+  operator() (const Box<T> &boxed)
+  {
+    this->operator() (*boxed);
+  }
+
+  void
+  operator() (const ExprLiteral &e)
+  {
+    literal (e.value);
+  }
+
+  void
+  operator() (const ExprVariable &e)
+  {
+    token (e.name);
+  }
+
+  void
+  operator() (const ExprLogical &e)
+  {
+    expr (e.left);
+    expr (e.right);
+    token (e.op);
+  }
+
+  void
+  operator() (const ExprBinary &e)
+  {
+    expr (e.left);
+    expr (e.right);
+    token (e.op);
+  }
+
+  void
+  operator() (const ExprUnary &e)
+  {
+    expr (e.right);
+    token (e.op);
+  }
+
+  void
+  operator() (const ExprGrouping &e)
+  {
+    expr (e.expression);
+  }
+
+  void
+  operator() (const ExprAssign &e)
+  {
+    token (e.name);
+    expr (e.value);
+  }
+
+  void
+  operator() (const ExprCall &e)
+  {
+    expr (e.callee);
+    token (e.paren);
+    list (e.arguments);
+  }
+
+  void
+  operator() (const StmtExpr &s)
+  {
+    expr (s.expression);
+  }
+
+  void
+  operator() (const StmtPrint &s)
+  {
+    expr (s.expression);
+  }
+
+  void
+  operator() (const StmtVar &s)
+  {
+    token (s.name);
+    optional (s.initializer);
+  }
+
+  void
+  operator() (const StmtBlock &s)
+  {
+    list (s.statements);
+  }
+
+  void
+  operator() (const StmtIf &s)
+  {
+    expr (s.condition);
+    stmt (s.then_branch);
+    optional (s.else_branch);
+  }
+
+  void
+  operator() (const StmtWhile &s)
+  {
+    expr (s.condition);
+    stmt (s.body);
+  }
+
+  void
+  operator() (const StmtFunction &s)
+  {
+    token (s.name);
+    list (s.params);
+    list (s.body);
+  }
+
+  void
+  operator() (const StmtReturn &s)
+  {
+    token (s.keyword);
+    optional (s.value);
+  }
+};
+
+/**
+ * Read what the Encoder wrote. Any inconsistency throws Malformed.
+ */
+class Decoder
+{
+public:
+  struct Malformed
+  {
+  };
+
+  explicit Decoder (std::string_view data) : data (data) {}
+
+  [[nodiscard]] bool
+  at_end () const
+  {
+    return position == data.size ();
+  }
+
+  std::uint8_t
+  byte ()
+  {
+    if (position >= data.size ())
+      throw Malformed{};
+    return static_cast<std::uint8_t> (data[position++]);
+  }
+
+  std::uint64_t
+  varint ()
+  {
+    std::uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+      {
+        const std::uint8_t b = byte ();
+        value |= static_cast<std::uint64_t> (b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+          return value;
+      }
+    throw Malformed{};
+  }
+
+  int
+  integer ()
+  {
+    const std::uint64_t value = varint ();
+    if (value > static_cast<unsigned> (std::numeric_limits<int>::max ()))
+      throw Malformed{};
+    return static_cast<int> (value);
+  }
+
+  bool
+  flag ()
+  {
+    const std::uint8_t b = byte ();
+    if (b > 1)
+      throw Malformed{};
+    return b == 1;
+  }
+
+  std::string
+  string ()
+  {
+    const std::uint64_t length = varint ();
+    if (length > data.size () - position)
+      throw Malformed{};
+    std::string s (data.substr (position, length));
+    position += length;
+    return s;
+  }
+
+  double
+  number ()
+  {
+    std::uint64_t bits = 0;
+    for (int i = 0; i < 8; ++i)
+      bits |= static_cast<std::uint64_t> (byte ()) << (8 * i);
+    double d;
+    std::memcpy (&d, &bits, sizeof (d));
+    return d;
+  }
+
+  Literal
+  literal ()
+  {
+    switch (byte ())
+      {
+      case 0:
+        return nullptr;
+      case 1:
+        return string ();
+      case 2:
+        return flag ();
+      case 3:
+        return number ();
+      default:
+        throw Malformed{};
+      }
+  }
+
+  Token
+  token ()
+  {
+    const std::uint8_t type = byte ();
+    if (type > static_cast<std::uint8_t> (TokenType::TOK_EOF))
+      throw Malformed{};
+    std::string lexeme = string ();
+    std::optional<Literal> literal_value;
+    if (flag ())
+      literal_value = literal ();
+    const int line = integer ();
+    const int start = integer ();
+
+    Token t (static_cast<TokenType> (type), std::move (lexeme), Literal{},
+             line, start);
+    t.literal = std::move (literal_value);
+    return t;
+  }
+
+  Expr
+  expr ()
+  {
+    // Tags are the indices of the alternatives in Expr.
+    switch (byte ())
+      {
+      case 0:
+        return ExprLiteral{ literal () };
+      case 1:
+        return ExprVariable{ token () };
+      case 2:
+        return ExprLogical{ expr (), expr (), token () };
+      case 3:
+        return ExprBinary{ expr (), expr (), token () };
+      case 4:
+        return ExprUnary{ expr (), token () };
+      case 5:
+        return ExprGrouping{ expr () };
+      case 6:
+        return ExprAssign{ token (), expr () };
+      case 7:
+        return ExprCall{ expr (), token (), exprs () };
+      default:
+        throw Malformed{};
+      }
+  }
+
+  Stmt
+  stmt ()
+  {
+    // Tags are the indices of the alternatives in Stmt.
+    switch (byte ())
+      {
+      case 0:
+        return StmtExpr{ expr () };
+      case 1:
+        return StmtPrint{ expr () };
+      case 2:
+        return StmtVar{ token (), optional_expr () };
+      case 3:
+        return StmtBlock{ stmts () };
+      case 4:
+        return StmtIf{ expr (), stmt (), optional_stmt () };
+      case 5:
+        return StmtWhile{ expr (), stmt () };
+      case 6:
+        return StmtFunction{ token (), tokens (), stmts () };
+      case 7:
+        return StmtReturn{ token (), optional_expr () };
+      default:
+        throw Malformed{};
+      }
+  }
+
+  std::vector<Stmt>
+  stmts ()
+  {
+    return list (&Decoder::stmt);
+  }
+
+private:
+  std::vector<Expr>
+  exprs ()
+  {
+    return list (&Decoder::expr);
+  }
+
+  std::vector<Token>
+  tokens ()
+  {
+    return list (&Decoder::token);
+  }
+
+  std::optional<Expr>
+  optional_expr ()
+  {
+    if (flag ())
+      return expr ();
+    return std::nullopt;
+  }
+
+  std::optional<Stmt>
+  optional_stmt ()
+  {
+    if (flag ())
+      return stmt ();
+    return std::nullopt;
+  }
+
+  template <typename T>
+  std::vector<T>
+  list (T (Decoder::*read) ())
+  {
+    const std::uint64_t count = varint ();
+    // Every node takes at least one byte, which protects against huge
+    // allocations from corrupted counts.
+    if (count > data.size () - position)
+      throw Malformed{};
+
+    std::vector<T> nodes;
+    nodes.reserve (count);
+    for (std::uint64_t i = 0; i < count; ++i)
+      nodes.push_back ((this->*read) ());
+    return nodes;
+  }
+
+  std::string_view data;
+  std::size_t position{};
+};
+
+/**
+ * A 64 bit hash of @p source independent of hash_source(): a polynomial hash
+ * with the finalizer of SplitMix64.
+ */
+std::uint64_t
+check_hash (std::string_view source)
+{
+  std::uint64_t hash = 0;
+  for (const char c : source)
+    hash = hash * 0x9e3779b97f4a7c15ULL + static_cast<unsigned char> (c) + 1;
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+  return hash ^ (hash >> 31);
+}
+
+/**
+ * The header of a cache file identifies the source it was created from. A
+ * source of the same length would have to collide in two independent hashes
+ * to load the wrong AST.
+ */
+std::string
+cache_header (std::string_view source)
+{
+  Encoder header;
+  header.varint (hash_source (source));
+  header.varint (source.size ());
+  header.varint (check_hash (source));
+  return header.out;
+}
+
+} // namespace
+
+std::string
+serialize_program (const std::vector<Stmt> &program)
+{
+  Encoder encoder;
+  encoder.out.append (magic);
+  encoder.varint (format_version);
+  encoder.list (program);
+  return encoder.out;
+}
+
+std::optional<std::vector<Stmt> >
+deserialize_program (std::string_view data)
+{
+  if (data.substr (0, magic.size ()) != magic)
+    return std::nullopt;
+
+  try
+    {
+      Decoder decoder{ data.substr (magic.size ()) };
+      if (decoder.varint () != format_version)
+        return std::nullopt;
+      std::vector<Stmt> program = decoder.stmts ();
+      if (!decoder.at_end ())
+        return std::nullopt;
+      return program;
+    }
+  catch (const Decoder::Malformed &)
+    {
+      return std::nullopt;
+    }
+}
+
+std::uint64_t
+hash_source (std::string_view source)
+{
+  std::uint64_t hash = 14695981039346656037ULL;
+  for (const char c : source)
+    {
+      hash ^= static_cast<unsigned char> (c);
+      hash *= 1099511628211ULL;
+    }
+  return hash;
+}
+
+std::string
+ast_cache_file (const std::string &directory, std::string_view source)
+{
+  char name[32];
+  std::snprintf (name, sizeof (name), "%016llx.loxast",
+                 static_cast<unsigned long long> (hash_source (source)));
+  return directory + "/" + name;
+}
+
+std::optional<std::vector<Stmt> >
+load_ast_cache (const std::string &file, std::string_view source)
+{
+  std::ifstream in (file, std::ios::binary);
+  if (!in)
+    return std::nullopt;
+  const std::string content{ std::istreambuf_iterator<char> (in),
+                             std::istreambuf_iterator<char> () };
+
+  // Guard against stale entries and hash collisions.
+  const std::string header = cache_header (source);
+  if (content.compare (0, header.size (), header) != 0)
+    return std::nullopt;
+
+  return deserialize_program (
+      std::string_view (content).substr (header.size ()));
+}
+
+void
+store_ast_cache (const std::string &file, std::string_view source,
+                 const std::vector<Stmt> &program)
+{
+  // Write to a temporary file of this run first, so concurrent runs never see
+  // a partial cache entry.
+  std::string temporary = file + ".XXXXXX";
+  const int fd = mkstemp (temporary.data ());
+  if (fd == -1)
+    return;
+  std::FILE *out = fdopen (fd, "wb");
+  if (out == nullptr)
+    {
+      close (fd);
+      std::remove (temporary.c_str ());
+      return;
+    }
+
+  const std::string content
+      = cache_header (source) + serialize_program (program);
+  const bool written
+      = std::fwrite (content.data (), 1, content.size (), out)
+        == content.size ();
+  if (std::fclose (out) != 0 || !written
+      || std::rename (temporary.c_str (), file.c_str ()) != 0)
+    std::remove (temporary.c_str ());
+}
+
+} // namespace lox
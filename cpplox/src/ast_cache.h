@@ -0,0 +1,52 @@
+#pragma once
+
+#include "stmt.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lox
+{
+
+/**
+ * Encode @p program in a compact binary format. The encoding starts with a
+ * format version and contains everything needed to restore the AST without
+ * the source.
+ */
+std::string serialize_program (const std::vector<Stmt> &program);
+
+/**
+ * Decode a program encoded by serialize_program(). Returns std::nullopt if
+ * @p data is malformed or was written by another format version.
+ */
+std::optional<std::vector<Stmt> > deserialize_program (std::string_view data);
+
+/**
+ * A 64 bit FNV-1a hash of @p source, which identifies cached programs.
+ */
+std::uint64_t hash_source (std::string_view source);
+
+/**
+ * The file in the cache @p directory which stores the AST of @p source.
+ */
+std::string ast_cache_file (const std::string &directory,
+                            std::string_view source);
+
+/**
+ * Load the program cached for @p source from @p file. Returns std::nullopt if
+ * there is no usable cache entry.
+ */
+std::optional<std::vector<Stmt> > load_ast_cache (const std::string &file,
+                                                  std::string_view source);
+
+/**
+ * Store @p program parsed from @p source in @p file. Failures to write the
+ * cache are silently ignored.
+ */
+void store_ast_cache (const std::string &file, std::string_view source,
+                      const std::vector<Stmt> &program);
+
+} // namespace lox
@@ -84,6 +84,18 @@ Environment::operator[] (const Token &name) const
   throw RunTimeError (name, "Undefined variable '" + name.lexeme + "'.");
 }
 
+const Value *
+Environment::find (const std::string &name) const
+{
+  if (auto it = pimpl->values.find (name); it != pimpl->values.end ())
+    return &it->second;
+
+  if (pimpl->enclosing)
+    return pimpl->enclosing->find (name);
+
+  return nullptr;
+}
+
 Value &
 Environment::operator[] (const Token &name)
 {
@@ -33,6 +33,12 @@ public:
 
   [[nodiscard]] const Value &operator[] (const Token &name) const;
 
+  /**
+   * The value of @p name defined in this environment or an enclosing one.
+   * Returns nullptr if there is no such variable.
+   */
+  [[nodiscard]] const Value *find (const std::string &name) const;
+
   Value &operator[] (const Token &name);
 
 private:
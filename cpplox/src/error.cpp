@@ -1,6 +1,7 @@
 #include "error.h"
 #include "token.h"
 #include <iostream>
+#include <lox_writer.h>
 
 namespace lox
 {
@@ -26,6 +27,8 @@ error (Token token, const std::string &message)
 void
 report (int line, const std::string &where, const std::string &message)
 {
+  // Keep the order of regular output and error messages.
+  lox_writer_flush (lox_stdout ());
   std::cout << "[line " << line << "] Error" + where + ": " + message << "\n";
   had_error = true;
 }
@@ -33,6 +36,7 @@ report (int line, const std::string &where, const std::string &message)
 void
 run_time_error (RunTimeError error)
 {
+  lox_writer_flush (lox_stdout ());
   std::cout << error.what () << "\n[line " << error.token.line << "]\n";
   had_run_time_error = true;
 }
@@ -2,14 +2,20 @@
 #include "environment.h"
 #include "error.h"
 #include "expr.h"
+#include "resolver.h"
+#include "runtime.h"
 #include "scope_exit.h"
+#include "stack_interpreter.h"
 #include "stmt.h"
 #include "token.h"
+#include <algorithm>
 #include <cassert>
-#include <cmath>
 #include <cstddef>
 #include <iostream>
+#include <iterator>
+#include <lox_writer.h>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <variant>
 
@@ -19,119 +25,23 @@ namespace lox
 struct InterpreterVisitor;
 
 /**
- * Various helpers when interpreting an AST.
+ * Types used when interpreting an AST.
  */
 namespace
 {
-// overload visit with multiple lambdas
-template <class... Ts> struct overloaded : Ts...
-{
-  using Ts::operator()...;
-};
-template <class... Ts> overloaded (Ts...) -> overloaded<Ts...>;
-
-[[nodiscard]] double
-numeric (const Value &value)
-{
-  // This call can never fail due to checks performed before-hand
-  return std::get<double> (value);
-}
-
-bool
-is_truthy (const Value &value)
-{
-  return std::visit (overloaded{ [] (const bool &b) { return b; },
-                                 [] (const std::nullptr_t &) { return false; },
-                                 [] (const auto &) { return true; } },
-                     value);
-}
-
-struct is_equal_same_type
-{
-  template <typename T>
-  bool
-  operator() (const T &a, const T &b) const
-  {
-    return a == b;
-  }
-};
-
-bool
-is_equal (const Value &left, const Value &right) // NOLINT
-{
-  return std::visit (
-      overloaded{ // Perform the C++ equality check if the two types match
-                  is_equal_same_type{},
-                  // Two callables are assumed to be always unequal!
-                  [] (const Callable &, const Callable &) { return false; },
-                  // Two non-matching types can never be equal
-                  [] (const auto &, const auto &) { return false; } },
-      left, right);
-}
-
-Value
-evaluate_plus_operator (const Value &left, const Token &op, const Value &right)
-{
-  return std::visit (
-      overloaded{
-          // numeric addition
-          [] (const double &l, const double &r) -> Value { return l + r; },
-          // string concatenation
-          [] (const std::string &l, const std::string &r) -> Value {
-            return l + r;
-          },
-          // anything else is an error
-          [&op] (const auto &, const auto &) -> Value {
-            throw RunTimeError (
-                op, "Operands must be two numbers or two strings.");
-          } },
-      left, right);
-}
-
-void
-check_number_operand (const Token &op, const Value &operand)
-{
-  if (!std::holds_alternative<double> (operand))
-    throw RunTimeError (op, "Operand must be a number.");
-}
-
-void
-check_number_operands (const Value &left, const Token &op, const Value &right)
-{
-  if (!(std::holds_alternative<double> (left)
-        && std::holds_alternative<double> (right)))
-    throw RunTimeError (op, "Operands must be numbers.");
-}
-
-std::string
-stringify (const Value &value)
-{
-  return std::visit (
-      overloaded{
-          [] (std::nullptr_t) -> std::string { return "nil"; },
-          [] (double d) -> std::string {
-            double i;
-            double fractional_part = std::modf (d, &i);
-            std::string s = std::to_string (d);
-            if (fractional_part == 0.)
-              return s.substr (0, s.find ('.'));
-            else
-              return s;
-          },
-          [] (bool b) -> std::string { return b ? "true" : "false"; },
-          [] (const std::string &s) { return s; },
-          [] (const Callable &) { return std::string{ "<callable>" }; } },
-      value);
-}
-
 struct Function
 {
-  StmtFunction declaration;
+  //! Shared by all copies of this function, which are made whenever the
+  //! function is passed around as a Value.
+  std::shared_ptr<const StmtFunction> declaration;
 
   const InterpreterVisitor &interpreter;
 
   Environment closure;
 
+  //! Static information about the program which defined the function.
+  std::shared_ptr<const Resolution> resolution;
+
   Value operator() (const std::vector<Value> &args) const;
 };
 
@@ -143,6 +53,17 @@ struct Return
   Value value{};
 };
 
+/**
+ * A type used to throw when a function returns the result of a call to a Lox
+ * function. The caller's Function::operator() catches it and runs the callee
+ * in its own native stack frame instead of nesting a new one.
+ */
+struct TailCall
+{
+  Callable callee;
+  std::vector<Value> arguments;
+};
+
 } // namespace
 
 /**
@@ -153,20 +74,14 @@ struct Return
 struct InterpreterVisitor
 {
 
-  InterpreterVisitor (const Environment &globals)
-      : env (globals), globals (globals)
+  InterpreterVisitor (const Environment &globals,
+                      std::shared_ptr<const Resolution> resolution,
+                      Profiler *profiler)
+      : profiler (profiler), resolution (std::move (resolution)),
+        env (globals), globals (globals)
   {
   }
 
-  /**
-   * Resolve a variable expression.
-   */
-  void
-  resolve (const Token &token, unsigned depth)
-  {
-    locals.emplace (token, depth);
-  }
-
   /**
    * Helper to resolve the boxed content. Forwards the call to the unboxed
    * type T. Notaby, this works for boxed Stmt _and_ Expr variants.
@@ -194,7 +109,9 @@ struct InterpreterVisitor
   operator() (const StmtPrint &stmt) const
   {
     Value val = evaluate (stmt.expression);
-    std::cout << stringify (val) << '\n';
+    LoxWriter *out = lox_stdout ();
+    print_value (out, val);
+    lox_writer_putc (out, '\n');
   }
 
   void
@@ -255,7 +172,9 @@ struct InterpreterVisitor
   {
 
     env.define (stmt.name.lexeme,
-                Callable (Function{ stmt, *this, env }, stmt.params.size ()));
+                Callable (Function{ std::make_shared<StmtFunction> (stmt),
+                                    *this, env, resolution },
+                          stmt.params.size ()));
   }
 
   void
@@ -263,7 +182,17 @@ struct InterpreterVisitor
   {
     Value value{};
     if (stmt.value)
-      value = evaluate (*stmt.value);
+      {
+        if (resolution->tail_calls.count (stmt.keyword) == 1)
+          {
+            auto [fn, arguments] = evaluate_call (*find_call (*stmt.value));
+            if (fn.target<Function> () != nullptr)
+              throw TailCall{ std::move (fn), std::move (arguments) };
+            value = fn (arguments);
+          }
+        else
+          value = evaluate (*stmt.value);
+      }
     throw Return{ value };
   }
 
@@ -346,8 +275,8 @@ struct InterpreterVisitor
   {
     Value value = evaluate (expr.value);
 
-    auto it = locals.find (expr.name);
-    if (it != locals.end ())
+    auto it = resolution->locals.find (expr.name);
+    if (it != resolution->locals.end ())
       env.assign_at (it->second, expr.name, value);
     else
       globals[expr.name] = value;
@@ -370,6 +299,17 @@ struct InterpreterVisitor
 
   [[nodiscard]] Value
   operator() (const ExprCall &expr) const
+  {
+    const auto [fn, arguments] = evaluate_call (expr);
+    return fn (arguments);
+  }
+
+  /**
+   * Evaluate the callee and the arguments of a call and check that they fit
+   * together.
+   */
+  [[nodiscard]] std::pair<Callable, std::vector<Value> >
+  evaluate_call (const ExprCall &expr) const
   {
     Value callee = evaluate (expr.callee);
 
@@ -378,27 +318,27 @@ struct InterpreterVisitor
     for (const Expr &arg : expr.arguments)
       arguments.emplace_back (evaluate (arg));
 
-    if (!std::holds_alternative<Callable> (callee))
-      throw RunTimeError (expr.paren, "Can only call functions and classes.");
-    const auto &fn = std::get<Callable> (callee);
+    return { as_callable (callee, arguments.size (), expr.paren),
+             std::move (arguments) };
+  }
 
-    if (arguments.size () != fn.arity ())
-      {
-        throw RunTimeError (expr.paren,
-                            "Expected " + std::to_string (fn.arity ())
-                                + " arguments but got "
-                                + std::to_string (arguments.size ()) + ".");
-      }
+  /**
+   * Records function calls if profiling is enabled, otherwise null.
+   */
+  Profiler *profiler;
 
-    return fn (arguments);
-  }
+  /**
+   * Where to find local variables and which calls are tail calls. This
+   * belongs to the program which is currently executed.
+   */
+  mutable std::shared_ptr<const Resolution> resolution;
 
 private:
   Value
   look_up_variable (const Token &name) const
   {
-    auto it = locals.find (name);
-    if (it != locals.end ())
+    auto it = resolution->locals.find (name);
+    if (it != resolution->locals.end ())
       return env.get_at (it->second, name.lexeme);
     else
       return globals[name];
@@ -416,281 +356,178 @@ private:
    * on.
    */
   mutable Environment globals;
-
-  /**
-   * Store the depth information on where to look up a variable in the
-   * environment linked list.
-   */
-  std::map<Token, unsigned> locals;
 };
 
+namespace
+{
 /**
- * Resolve variables before interpretation.
+ * Whether @p stmt declares a function anywhere. The body of such a function
+ * may still run after the statement itself has been executed.
  */
-struct Resolver
+bool
+declares_function (const Stmt &stmt)
 {
-  Resolver (InterpreterVisitor &visitor) : interpreter (visitor) {}
-
-  /**
-   * Helper to resolve the boxed content. Forwards the call to the unboxed
-   * type T. Notaby, this works for boxed Stmt _and_ Expr variants.
-   */
-  template <typename T>
-  void
-  operator() (const Box<T> &boxed)
-  {
-    return this->operator() (*boxed);
-  }
-
-  void
-  resolve (const std::vector<Stmt> &statements)
-  {
-    for (const auto &stmt : statements)
-      resolve (stmt);
-  }
-
-  void
-  resolve (const Stmt &stmt)
-  {
-    std::visit (*this, stmt);
-  }
-
-  void
-  resolve (const Expr &expr)
-  {
-    std::visit (*this, expr);
-  }
-
-  void
-  operator() (const StmtBlock &stmt)
-  {
-    begin_scope ();
-    resolve (stmt.statements);
-    end_scope ();
-  }
-
-  void
-  operator() (const StmtExpr &stmt)
-  {
-    resolve (stmt.expression);
-  }
-
-  void
-  operator() (const StmtPrint &stmt)
-  {
-    resolve (stmt.expression);
-  }
-
-  void
-  operator() (const StmtVar &stmt)
-  {
-    declare (stmt.name);
-    if (stmt.initializer)
-      resolve (*stmt.initializer);
-    define (stmt.name);
-  }
-
-  void
-  operator() (const StmtIf &stmt)
-  {
-    resolve (stmt.condition);
-    resolve (stmt.then_branch);
-    if (stmt.else_branch)
-      resolve (*stmt.else_branch);
-  }
-
-  void
-  operator() (const StmtWhile &stmt)
-  {
-    resolve (stmt.condition);
-    resolve (stmt.body);
-  }
-
-  void
-  operator() (const StmtFunction &stmt)
-  {
-    // Declare and define, so that a function may refer to itself within its
-    // body.
-    declare (stmt.name);
-    define (stmt.name);
-
-    resolve_function (stmt);
-  }
-
-  void
-  operator() (const StmtReturn &stmt)
-  {
-    if (stmt.value)
-      resolve (*stmt.value);
-  }
-
-  void
-  operator() (const ExprBinary &expr)
-  {
-    resolve (expr.left);
-    resolve (expr.right);
-  }
-
-  void
-  operator() (const ExprGrouping &expr)
-  {
-    resolve (expr.expression);
-  }
-
-  void
-  operator() (const ExprLiteral &expr)
-  {
-    // nothing to do
-  }
+  return std::visit (
+      overloaded{
+          [] (const Box<StmtFunction> &) { return true; },
+          [] (const StmtBlock &block) {
+            return std::any_of (block.statements.begin (),
+                                block.statements.end (), declares_function);
+          },
+          [] (const Box<StmtIf> &if_stmt) {
+            return declares_function (if_stmt->then_branch)
+                   || (if_stmt->else_branch
+                       && declares_function (*if_stmt->else_branch));
+          },
+          [] (const Box<StmtWhile> &while_stmt) {
+            return declares_function (while_stmt->body);
+          },
+          [] (const auto &) { return false; } },
+      stmt);
+}
 
-  void
-  operator() (const ExprLogical &expr)
-  {
-    resolve (expr.left);
-    resolve (expr.right);
-  }
+/**
+ * Remove the @p count entries with the largest keys from @p tokens.
+ */
+template <typename Container>
+void
+erase_last (Container &tokens, std::size_t count)
+{
+  tokens.erase (std::prev (tokens.end (), count), tokens.end ());
+}
+} // namespace
 
-  void
-  operator() (const ExprUnary &expr)
+namespace internal
+{
+/**
+ * The state which persists across calls to Interpreter::interpret().
+ */
+class InterpreterImpl
+{
+public:
+  explicit InterpreterImpl (InterpreterOptions options)
+      : options (options), visitor (globals, resolution, options.profiler)
   {
-    resolve (expr.right);
+    define_globals (globals);
+    if (options.explicit_stack)
+      stack_interpreter.emplace (globals, this->options);
   }
 
   void
-  operator() (const ExprVariable &expr)
+  interpret (const std::vector<Stmt> &program)
   {
-    if (!scopes.empty () && scopes.back ().count (expr.name.lexeme) == 1
-        && scopes.back ().at (expr.name.lexeme) == false)
-      error (expr.name, "Can't read local variable in its own initializer.");
+    try
+      {
+        resolve (program, *resolution);
+        if (had_error)
+          return;
 
-    resolve_local (expr, expr.name);
-  }
+        if (stack_interpreter)
+          {
+            stack_interpreter->execute (program, *resolution);
+            return;
+          }
 
-  void
-  operator() (const ExprAssign &expr)
-  {
-    resolve (expr.value);
-    resolve_local (expr, expr.name);
+        for (const auto &stmt : program)
+          visitor.execute (stmt);
+      }
+    catch (const RunTimeError &e)
+      {
+        run_time_error (e);
+      }
   }
 
-  void
-  operator() (const ExprCall &expr)
+  bool
+  execute (const Program &program)
   {
-    resolve (expr.callee);
-    for (const Expr &arg : expr.arguments)
-      resolve (arg);
-  }
+    try
+      {
+        if (stack_interpreter)
+          {
+            stack_interpreter->execute (program);
+            return true;
+          }
 
-private:
-  void
-  begin_scope ()
-  {
-    scopes.emplace_back ();
+        ScopeExit restore_resolution (
+            [this, previous = visitor.resolution] () {
+              visitor.resolution = previous;
+            });
+        visitor.resolution = program.resolution;
+        for (const auto &stmt : program.statements)
+          visitor.execute (stmt);
+        return true;
+      }
+    catch (const RunTimeError &e)
+      {
+        run_time_error (e);
+        return false;
+      }
   }
 
-  void
-  end_scope ()
+  [[nodiscard]] std::optional<Value>
+  get_global (const std::string &name) const
   {
-    scopes.pop_back ();
+    if (const Value *value = globals.find (name))
+      return *value;
+    return std::nullopt;
   }
 
-  void
-  declare (const Token &name)
+  [[nodiscard]] const InterpreterOptions &
+  get_options () const
   {
-    if constexpr (debug)
-      std::cout << "Declaring variable " << name.lexeme << " at line "
-                << name.line << " at offset " << name.start << std::endl;
-
-    // If not in any scope, i.e. at global scope,
-    // nothing to do.
-    if (scopes.empty ())
-      return;
-
-    scopes.back ().emplace (name.lexeme, false);
+    return options;
   }
 
   void
-  define (const Token &name)
+  interpret_top_level (Stmt stmt)
   {
-    if constexpr (debug)
-      std::cout << "Defining variable " << name.lexeme << " at line "
-                << name.line << " at offset " << name.start << std::endl;
-    if (scopes.empty ())
-      return;
-    scopes.back ().at (name.lexeme) = true;
-  }
+    const std::size_t n_locals = resolution->locals.size ();
+    const std::size_t n_tail_calls = resolution->tail_calls.size ();
 
-  void
-  resolve_local (const Expr &expr, const Token &name)
-  {
-    for (int i = static_cast<int> (scopes.size ()) - 1; i >= 0; --i)
-      {
-        if (scopes[i].count (name.lexeme) == 1)
-          {
-            const unsigned depth = scopes.size () - 1 - i;
-            if constexpr (debug)
-              {
-                std::cout << "Resolved variable " << name.lexeme << " at line "
-                          << name.line << " at offset " << name.start
-                          << ": depth " << depth << std::endl;
-              }
-            interpreter.resolve (name, depth);
-            return;
-          }
-      }
+    std::vector<Stmt> program;
+    program.push_back (std::move (stmt));
+    interpret (program);
 
-    if constexpr (debug)
+    // The statement is executed completely unless it left functions behind.
+    // Since statements arrive in source order, all entries the Resolver added
+    // for it are the last ones.
+    if (!declares_function (program.front ()))
       {
-        std::cout << "Nothing to resolve for variable " << name.lexeme
-                  << " at line " << name.line << " at offset " << name.start
-                  << ": treat as global" << std::endl;
+        erase_last (resolution->locals,
+                    resolution->locals.size () - n_locals);
+        erase_last (resolution->tail_calls,
+                    resolution->tail_calls.size () - n_tail_calls);
       }
   }
 
-  void
-  resolve_function (const StmtFunction &function)
-  {
-    begin_scope ();
-
-    for (const Token &param : function.params)
-      {
-        declare (param);
-        define (param);
-      }
-    resolve (function.body);
+private:
+  InterpreterOptions options;
 
-    end_scope ();
-  }
+  Environment globals;
 
-  InterpreterVisitor &interpreter;
+  //! Static information about all statements passed to interpret() so far.
+  //! The visitor looks up local variables in here while executing functions.
+  std::shared_ptr<Resolution> resolution{ std::make_shared<Resolution> () };
 
-  //! Store the different scopes which contain variable names. The boolean
-  //! indicates whether the variable is initialized.
-  std::vector<std::map<std::string, bool> > scopes;
+  InterpreterVisitor visitor;
 
-  //! If true, trace the resolution process.
-  static constexpr bool debug{ false };
+  //! Only set if the program is run on an explicit stack.
+  std::optional<StackInterpreter> stack_interpreter;
 };
+} // namespace internal
+
+Interpreter::Interpreter (InterpreterOptions options)
+    : pimpl (std::make_unique<internal::InterpreterImpl> (options))
+{
+}
+
+//! Default in implementation to allow PIMPL with unique_ptr
+Interpreter::~Interpreter () = default;
 
 void
 Interpreter::interpret (const std::vector<Stmt> &program)
 {
-  Environment global;
-  define_globals (global);
-  InterpreterVisitor visitor{ global };
-  Resolver resolver{ visitor };
-  try
-    {
-      resolver.resolve (program);
-      if (had_error)
-        return;
-      for (const auto &stmt : program)
-        visitor.execute (stmt);
-    }
-  catch (const RunTimeError &e)
-    {
-      run_time_error (e);
-    }
+  pimpl->interpret (program);
 }
 
 void
@@ -699,24 +536,92 @@ Interpreter::interpret (const Stmt &stmt)
   interpret (std::vector{ stmt });
 }
 
+void
+Interpreter::interpret_top_level (Stmt stmt)
+{
+  pimpl->interpret_top_level (std::move (stmt));
+}
+
+bool
+Interpreter::execute (const Program &program)
+{
+  return pimpl->execute (program);
+}
+
+void
+Interpreter::reset ()
+{
+  pimpl = std::make_unique<internal::InterpreterImpl> (pimpl->get_options ());
+}
+
+std::optional<Value>
+Interpreter::get_global (const std::string &name) const
+{
+  return pimpl->get_global (name);
+}
+
 Value
 Function::operator() (const std::vector<Value> &args) const
 {
-  Environment environment = Environment::enclose (closure);
-  for (int i = 0; i < declaration.params.size (); i++)
-    {
-      environment.define (declaration.params[i].lexeme, args[i]);
-    }
-
-  try
+  // The trampoline: a tail call replaces the function and arguments of this
+  // frame and runs the loop again.
+  const Function *function = this;
+  std::optional<TailCall> tail_call;
+
+  // Leave the profiled function and its tail callees also if a RunTimeError
+  // unwinds the call.
+  std::optional<ScopeExit> leave_profiled;
+  if (Profiler *profiler = interpreter.profiler)
+    leave_profiled.emplace ([profiler] () { profiler->exit (); });
+
+  for (;;)
     {
-      interpreter.execute_block (declaration.body, environment);
+      const StmtFunction &decl = *function->declaration;
+      const std::vector<Value> &arguments
+          = tail_call ? tail_call->arguments : args;
+
+      Environment environment = Environment::enclose (function->closure);
+      for (int i = 0; i < decl.params.size (); i++)
+        {
+          environment.define (decl.params[i].lexeme, arguments[i]);
+        }
+
+      if (Profiler *profiler = interpreter.profiler)
+        {
+          if (tail_call)
+            profiler->tail_call (decl.name);
+          else
+            profiler->enter (decl.name);
+        }
+
+      // The function may come from another program than the caller.
+      std::optional<ScopeExit> restore_resolution;
+      if (function->resolution != interpreter.resolution)
+        {
+          restore_resolution.emplace (
+              [this, previous = interpreter.resolution] () {
+                interpreter.resolution = previous;
+              });
+          interpreter.resolution = function->resolution;
+        }
+
+      try
+        {
+          interpreter.execute_block (decl.body, environment);
+        }
+      catch (const Return &return_value)
+        {
+          return return_value.value;
+        }
+      catch (TailCall &next)
+        {
+          // Keep the callee alive while its body runs in this frame.
+          tail_call = std::move (next);
+          function = tail_call->callee.target<Function> ();
+          continue;
+        }
+
+      return nullptr;
     }
-  catch (const Return &return_value)
-    {
-      return return_value.value;
-    }
-
-  return nullptr;
 }
 } // namespace lox
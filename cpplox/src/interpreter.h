@@ -1,16 +1,53 @@
+#pragma once
+
+#include "profiler.h"
+#include "program.h"
 #include "stmt.h"
+#include "types.h"
 #include <memory>
+#include <optional>
+#include <string>
 #include <vector>
 
 namespace lox
 {
+namespace internal
+{
+class InterpreterImpl;
+}
 
 /**
- * The interpreter evaluating and holding the state of the program.
+ * Settings which control how the Interpreter executes a program.
+ */
+struct InterpreterOptions
+{
+  //! If set, all calls to Lox functions are recorded in this profiler.
+  Profiler *profiler{ nullptr };
+
+  //! Keep Lox call frames and pending work on a heap-allocated stack instead
+  //! of recursing on the native stack. This allows for deep recursion.
+  bool explicit_stack{ false };
+
+  //! The maximum number of nested calls when using an explicit stack. Deeper
+  //! recursion raises a RunTimeError.
+  unsigned max_call_depth{ 100000 };
+};
+
+/**
+ * The interpreter evaluating and holding the state of the program. Global
+ * variables, functions and the static information about them persist across
+ * calls to interpret(), so a program may be fed in several parts.
  */
 class Interpreter
 {
 public:
+  explicit Interpreter (InterpreterOptions options = {});
+
+  /**
+   * Destructor.
+   */
+  ~Interpreter ();
+
   /**
    * The central interpret call: given a program, evaluate it and print the
    * result or report an error.
@@ -22,6 +59,36 @@ public:
    * method for the REPL.
    */
   void interpret (const Stmt &stmt);
+
+  /**
+   * Evaluate a single top-level statement and drop all static information
+   * about it which is not needed anymore. Use this to execute a program
+   * statement by statement while it is parsed.
+   */
+  void interpret_top_level (Stmt stmt);
+
+  /**
+   * Execute a compiled @p program. Unlike interpret(), this does not resolve
+   * the program again, so the same program may be executed many times at low
+   * cost. Returns false if a run time error was reported.
+   */
+  bool execute (const Program &program);
+
+  /**
+   * Forget all global variables and functions, so the next program starts
+   * from a fresh state.
+   */
+  void reset ();
+
+  /**
+   * The value of the global variable @p name, or std::nullopt if there is no
+   * such variable.
+   */
+  [[nodiscard]] std::optional<Value>
+  get_global (const std::string &name) const;
+
+private:
+  std::unique_ptr<internal::InterpreterImpl> pimpl;
 };
 
 } // namespace lox
@@ -1,14 +1,20 @@
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
-#include <sstream>
+#include <lox_source.h>
+#include <lox_writer.h>
+#include <optional>
+#include <string_view>
 #include <sysexits.h>
 
+#include "ast_cache.h"
 #include "ast_printer.h"
 #include "error.h"
 #include "interpreter.h"
 #include "parser.h"
+#include "profiler.h"
 #include "scanner.h"
 #include "stmt.h"
 #include "token.h"
@@ -23,58 +29,161 @@ enum class Mode
   dump_ast,
 };
 
-std::string
-read_file (const char *file_name)
+struct Options
 {
-  std::ifstream in (file_name);
-  std::stringstream whole_file;
-  whole_file << in.rdbuf ();
-  return whole_file.str ();
-}
+  Mode mode{ Mode::interpret };
+  const char *file{ nullptr };
+  //! Record all calls to Lox functions and print a report at exit.
+  bool profile{ false };
+  //! Evaluate on a heap-allocated stack instead of the native stack.
+  bool explicit_stack{ false };
+  //! Limit of nested calls when evaluating on an explicit stack.
+  unsigned max_call_depth{ InterpreterOptions{}.max_call_depth };
+  //! If set, also write the profiled call stacks in folded format to this
+  //! file.
+  const char *folded_stacks_file{ nullptr };
+  //! If set, parsed scripts are cached in this directory and reused as long
+  //! as the script does not change.
+  const char *ast_cache_directory{ nullptr };
+  //! Tell on standard error whether the AST cache had the script.
+  bool ast_cache_stats{ false };
+  //! Execute every top-level statement as soon as it is parsed. Ignored if
+  //! an AST cache is used.
+  bool incremental{ false };
+};
 
-void
-run (const std::string &source, Mode mode)
+/**
+ * A script loaded with lox_source_open(). Large scripts are mapped into
+ * memory instead of being copied.
+ */
+class SourceFile
 {
-  auto tokens = scan_tokens (source);
+public:
+  explicit SourceFile (const char *file_name)
+  {
+    if (!lox_source_open (&source, file_name))
+      {
+        std::cerr << "Could not read file \"" << file_name
+                  << "\": " << std::strerror (errno) << ".\n";
+        std::exit (EX_IOERR);
+      }
+  }
+
+  ~SourceFile () { lox_source_close (&source); }
 
+  SourceFile (const SourceFile &) = delete;
+  SourceFile &operator= (const SourceFile &) = delete;
+
+  [[nodiscard]] std::string_view
+  view () const
+  {
+    return { source.data, source.length };
+  }
+
+private:
+  LoxSource source;
+};
+
+void
+run_program (const std::vector<Stmt> &program, Mode mode,
+             const InterpreterOptions &interpreter_options)
+{
   switch (mode)
     {
     case Mode::interpret:
       {
-        Parser parser{ tokens };
-        std::vector<Stmt> program = parser.parse ();
-
         // TODO interpreter is thrown away in REPL after every line
-        Interpreter interpreter;
+        Interpreter interpreter{ interpreter_options };
         interpreter.interpret (program);
         break;
       }
-    case Mode::dump_tokens:
-      {
-        for (const auto &t : tokens)
-          std::cout << t.to_string ();
-        std::cout << std::endl;
-        break;
-      }
     case Mode::dump_ast:
       {
-        Parser parser{ tokens };
-        std::vector<Stmt> program = parser.parse ();
         for (const auto &stmt : program)
           std::cout << print_ast (stmt) << std::endl;
         break;
       }
+    case Mode::dump_tokens:
+      break;
     }
 }
 
 void
-run_script (const char *file, Mode mode)
+run (std::string_view source, Mode mode,
+     const InterpreterOptions &interpreter_options)
 {
-  run (read_file (file), mode);
+  if (mode == Mode::dump_tokens)
+    {
+      for (const auto &t : scan_tokens (source))
+        std::cout << t.to_string ();
+      std::cout << std::endl;
+      return;
+    }
+
+  TokenStream tokens{ source };
+  Parser parser{ tokens };
+  run_program (parser.parse (), mode, interpreter_options);
 }
 
+/**
+ * Parse and execute one top-level statement after the other. Output appears
+ * right away and only the AST of a single statement is in memory at a time.
+ */
 void
-run_prompt (Mode mode)
+run_incrementally (std::string_view source,
+                   const InterpreterOptions &interpreter_options)
+{
+  TokenStream tokens{ source };
+  Parser parser{ tokens };
+  Interpreter interpreter{ interpreter_options };
+  while (std::optional<Stmt> stmt = parser.next ())
+    {
+      // Keep parsing after an error to report all syntax errors.
+      if (!had_error && !had_run_time_error)
+        interpreter.interpret_top_level (std::move (*stmt));
+    }
+}
+
+void
+run_script (const Options &options,
+            const InterpreterOptions &interpreter_options)
+{
+  const Mode mode = options.mode;
+  const SourceFile source_file (options.file);
+  const std::string_view source = source_file.view ();
+  const char *ast_cache_directory = options.ast_cache_directory;
+  if (ast_cache_directory == nullptr || mode == Mode::dump_tokens)
+    {
+      if (options.incremental && mode == Mode::interpret)
+        run_incrementally (source, interpreter_options);
+      else
+        run (source, mode, interpreter_options);
+      return;
+    }
+
+  const std::string cache_file
+      = ast_cache_file (ast_cache_directory, source);
+  if (auto program = load_ast_cache (cache_file, source))
+    {
+      if (options.ast_cache_stats)
+        std::cerr << "AST cache hit\n";
+      run_program (*program, mode, interpreter_options);
+      return;
+    }
+
+  if (options.ast_cache_stats)
+    std::cerr << "AST cache miss\n";
+  TokenStream tokens{ source };
+  Parser parser{ tokens };
+  const std::vector<Stmt> program = parser.parse ();
+  // Never cache a program with syntax errors, they need to be reported again.
+  if (!had_error)
+    store_ast_cache (cache_file, source, program);
+  run_program (program, mode, interpreter_options);
+}
+
+void
+run_prompt (Mode mode, const InterpreterOptions &interpreter_options)
 {
   std::string line;
   for (;;)
@@ -82,29 +191,90 @@ run_prompt (Mode mode)
       std::getline (std::cin, line);
       if (line.empty ())
         break;
-      run (line, mode);
+      run (line, mode, interpreter_options);
+      lox_writer_flush (lox_stdout ());
       had_error = false;
     }
 }
 
-std::pair<Mode, const char *>
-find_mode_file (int argc, char **argv)
+[[noreturn]] void
+print_usage ()
 {
-  Mode mode = Mode::interpret;
-  const char *file{ nullptr };
+  std::cout << "Usage: cpplox [--tokens|--ast] [--profile] "
+               "[--profile-folded=<file>] [--explicit-stack] "
+               "[--max-depth=<n>] [--ast-cache=<dir>] [--ast-cache-stats] "
+               "[--incremental] [script]\n"
+               "Use \"-\" as script to read it from standard input.\n";
+  std::exit (EX_USAGE);
+}
+
+Options
+parse_options (int argc, char **argv)
+{
+  Options options;
+  constexpr std::string_view folded_prefix = "--profile-folded=";
+  constexpr std::string_view max_depth_prefix = "--max-depth=";
+  constexpr std::string_view ast_cache_prefix = "--ast-cache=";
 
   for (int i = 1; i < argc; ++i)
     {
-      const auto *current_arg = argv[i];
-      if (strcmp (current_arg, "--ast") == 0)
-        mode = Mode::dump_ast;
-      else if (strcmp (current_arg, "--tokens") == 0)
-        mode = Mode::dump_tokens;
+      const std::string_view current_arg = argv[i];
+      if (current_arg == "--ast")
+        options.mode = Mode::dump_ast;
+      else if (current_arg == "--tokens")
+        options.mode = Mode::dump_tokens;
+      else if (current_arg == "--profile")
+        options.profile = true;
+      else if (current_arg.substr (0, folded_prefix.size ()) == folded_prefix)
+        {
+          options.profile = true;
+          options.folded_stacks_file = argv[i] + folded_prefix.size ();
+        }
+      else if (current_arg == "--ast-cache-stats")
+        options.ast_cache_stats = true;
+      else if (current_arg == "--incremental")
+        options.incremental = true;
+      else if (current_arg == "--explicit-stack")
+        options.explicit_stack = true;
+      else if (current_arg.substr (0, max_depth_prefix.size ())
+               == max_depth_prefix)
+        {
+          char *end = nullptr;
+          const char *value = argv[i] + max_depth_prefix.size ();
+          options.max_call_depth = std::strtoul (value, &end, 10);
+          if (*value == '\0' || *end != '\0')
+            print_usage ();
+        }
+      else if (current_arg.substr (0, ast_cache_prefix.size ())
+               == ast_cache_prefix)
+        options.ast_cache_directory = argv[i] + ast_cache_prefix.size ();
+      else if (options.file == nullptr)
+        options.file = argv[i];
       else
-        file = current_arg;
+        print_usage ();
     }
 
-  return { mode, file };
+  return options;
+}
+
+void
+write_profile (const Profiler &profiler, const Options &options)
+{
+  // Print the report after all output of the script.
+  lox_writer_flush (lox_stdout ());
+  profiler.report (std::cerr);
+
+  if (options.folded_stacks_file)
+    {
+      std::ofstream out (options.folded_stacks_file);
+      if (!out)
+        {
+          std::cerr << "Could not open \"" << options.folded_stacks_file
+                    << "\" for writing.\n";
+          return;
+        }
+      profiler.write_folded_stacks (out);
+    }
 }
 
 } // namespace lox
@@ -112,18 +282,23 @@ find_mode_file (int argc, char **argv)
 int
 main (int argc, char **argv)
 {
-  if (argc > 3)
-    {
-      std::cout << "Usage: cpplox [--tokens|--ast] [script]\n";
-      std::exit (EX_USAGE);
-    }
+  const lox::Options options = lox::parse_options (argc, argv);
 
-  const auto [mode, file] = lox::find_mode_file (argc, argv);
+  std::optional<lox::Profiler> profiler;
+  if (options.profile)
+    profiler.emplace ();
+  lox::InterpreterOptions interpreter_options;
+  interpreter_options.profiler = profiler ? &*profiler : nullptr;
+  interpreter_options.explicit_stack = options.explicit_stack;
+  interpreter_options.max_call_depth = options.max_call_depth;
 
-  if (file)
-    lox::run_script (file, mode);
+  if (options.file)
+    lox::run_script (options, interpreter_options);
   else
-    lox::run_prompt (mode);
+    lox::run_prompt (options.mode, interpreter_options);
+
+  if (profiler)
+    lox::write_profile (*profiler, options);
 
   if (lox::had_error)
     return EX_DATAERR;
@@ -5,8 +5,10 @@
 #include "token.h"
 
 #include <cassert>
+#include <functional>
 #include <memory>
 #include <optional>
+#include <utility>
 #include <variant>
 namespace lox
 {
@@ -16,7 +18,14 @@ namespace internal
 class ParserImpl
 {
 public:
-  ParserImpl (std::vector<Token> &&tokens) : tokens (std::move (tokens)) {}
+  /**
+   * Parse the Tokens returned by @p next_token, which has to return an EOF
+   * Token after the last one.
+   */
+  ParserImpl (std::function<Token ()> next_token)
+      : next_token (std::move (next_token)), current (this->next_token ())
+  {
+  }
 
   std::vector<Stmt>
   parse ()
@@ -29,6 +38,14 @@ public:
     return statements;
   }
 
+  std::optional<Stmt>
+  next ()
+  {
+    if (is_at_end ())
+      return std::nullopt;
+    return declaration ();
+  }
+
 private:
   /**
    * An exception type used to unwind parsing until a desired synchronization
@@ -39,8 +56,13 @@ private:
   {
   };
 
-  std::vector<Token> tokens;
-  std::size_t current{};
+  //! Source of all Tokens. Tokens are requested one at a time, so only the
+  //! lookahead window below is kept in memory.
+  std::function<Token ()> next_token;
+  //! The Token which was consumed last.
+  std::optional<Token> previous_token;
+  //! The next Token to consume.
+  Token current;
 
   Stmt
   declaration ()
@@ -470,7 +492,7 @@ private:
   advance ()
   {
     if (!is_at_end ())
-      ++current;
+      previous_token = std::exchange (current, next_token ());
     return previous ();
   }
 
@@ -491,14 +513,14 @@ private:
   const Token &
   peek ()
   {
-    return tokens[current];
+    return current;
   }
 
   const Token &
   previous ()
   {
-    assert (current > 0);
-    return tokens[current - 1];
+    assert (previous_token.has_value ());
+    return *previous_token;
   }
 
   // Match and advance.
@@ -518,7 +540,18 @@ private:
 } // namespace internal
 
 Parser::Parser (std::vector<Token> tokens)
-    : pimpl (std::make_unique<internal::ParserImpl> (std::move (tokens)))
+{
+  assert (!tokens.empty () && tokens.back ().type == TokenType::TOK_EOF);
+  pimpl = std::make_unique<internal::ParserImpl> (
+      [tokens = std::move (tokens), index = std::size_t{}] () mutable {
+        // The parser never asks for more Tokens after EOF.
+        return std::move (tokens[index++]);
+      });
+}
+
+Parser::Parser (TokenStream &tokens)
+    : pimpl (std::make_unique<internal::ParserImpl> (
+        [&tokens] () { return tokens.next (); }))
 {
 }
 
@@ -531,4 +564,10 @@ Parser::parse ()
   return pimpl->parse ();
 }
 
+std::optional<Stmt>
+Parser::next ()
+{
+  return pimpl->next ();
+}
+
 } // namespace lox
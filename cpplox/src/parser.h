@@ -1,9 +1,11 @@
 #pragma once
 
+#include "scanner.h"
 #include "stmt.h"
 #include "token.h"
 
 #include <memory>
+#include <optional>
 #include <vector>
 
 namespace lox
@@ -16,8 +18,17 @@ class ParserImpl;
 class Parser
 {
 public:
+  /**
+   * Parse all @p tokens, which have to end with an EOF Token.
+   */
   Parser (std::vector<Token> tokens);
 
+  /**
+   * Parse Tokens taken from @p tokens while parsing. No Token vector is
+   * created and parsing starts before the whole source is scanned.
+   */
+  explicit Parser (TokenStream &tokens);
+
   /**
    * Destructor.
    */
@@ -25,10 +36,16 @@ public:
 
   /**
    * Parse the sequence of Tokens in this Parser into a program, i.e., a series
-   * of statements.
+   * of statements. This may only be called once.
    */
   std::vector<Stmt> parse ();
 
+  /**
+   * Parse only the next top-level declaration. Returns std::nullopt after the
+   * last one.
+   */
+  std::optional<Stmt> next ();
+
 private:
   std::unique_ptr<internal::ParserImpl> pimpl;
 };
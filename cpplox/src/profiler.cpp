@@ -0,0 +1,166 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+
+namespace lox
+{
+namespace
+{
+double
+to_milliseconds (std::chrono::steady_clock::duration d)
+{
+  return std::chrono::duration<double, std::milli> (d).count ();
+}
+} // namespace
+
+Profiler::Profiler () : paths (1) {}
+
+void
+Profiler::enter (const Token &function_name)
+{
+  push_frame (function_name, false);
+}
+
+void
+Profiler::tail_call (const Token &function_name)
+{
+  assert (!frames.empty ());
+  std::size_t chain = frames.size () - 1;
+  while (frames[chain].tail)
+    chain--;
+
+  const auto it = functions.find (function_name.start);
+  if (it != functions.end ())
+    {
+      for (std::size_t i = chain; i < frames.size (); ++i)
+        {
+          if (frames[i].function != &it->second)
+            continue;
+          while (frames.size () > i)
+            pop_frame ();
+          break;
+        }
+    }
+
+  push_frame (function_name, frames.size () > chain);
+}
+
+void
+Profiler::exit ()
+{
+  assert (!frames.empty ());
+  bool tail;
+  do
+    {
+      tail = frames.back ().tail;
+      pop_frame ();
+    }
+  while (tail);
+}
+
+void
+Profiler::push_frame (const Token &function_name, bool tail)
+{
+  auto [it, inserted] = functions.try_emplace (function_name.start);
+  FunctionStats &stats = it->second;
+  if (inserted)
+    {
+      stats.name = function_name.lexeme;
+      stats.line = function_name.line;
+    }
+
+  stats.calls++;
+  stats.depth++;
+  stats.max_depth = std::max (stats.max_depth, stats.depth);
+
+  const std::size_t parent = frames.empty () ? 0 : frames.back ().path;
+  auto [child, new_path] = paths[parent].children.try_emplace (&stats, 0);
+  if (new_path)
+    {
+      child->second = paths.size ();
+      paths.push_back (CallPath{ &stats, parent, {}, {} });
+    }
+
+  frames.push_back (Frame{ &stats, child->second, Clock::now (), {}, tail });
+}
+
+void
+Profiler::pop_frame ()
+{
+  const Frame frame = frames.back ();
+  frames.pop_back ();
+
+  const Clock::duration elapsed = Clock::now () - frame.start;
+  const Clock::duration self = elapsed - frame.children;
+
+  FunctionStats &stats = *frame.function;
+  stats.exclusive += self;
+  stats.depth--;
+  // Only count the outermost activation of a recursive function, otherwise
+  // the time of the inner calls would be included several times.
+  if (stats.depth == 0)
+    stats.inclusive += elapsed;
+
+  paths[frame.path].exclusive += self;
+
+  if (!frames.empty ())
+    frames.back ().children += elapsed;
+}
+
+void
+Profiler::report (std::ostream &out) const
+{
+  std::vector<const FunctionStats *> sorted;
+  sorted.reserve (functions.size ());
+  for (const auto &[start, stats] : functions)
+    sorted.push_back (&stats);
+
+  std::sort (sorted.begin (), sorted.end (),
+             [] (const FunctionStats *a, const FunctionStats *b) {
+               return a->exclusive > b->exclusive;
+             });
+
+  out << "== profile ==\n";
+  out << std::left << std::setw (24) << "function" << std::right
+      << std::setw (6) << "line" << std::setw (12) << "calls"
+      << std::setw (16) << "inclusive ms" << std::setw (16) << "exclusive ms"
+      << std::setw (11) << "max depth" << '\n';
+
+  out << std::fixed << std::setprecision (3);
+  for (const FunctionStats *stats : sorted)
+    {
+      out << std::left << std::setw (24) << stats->name << std::right
+          << std::setw (6) << stats->line << std::setw (12) << stats->calls
+          << std::setw (16) << to_milliseconds (stats->inclusive)
+          << std::setw (16) << to_milliseconds (stats->exclusive)
+          << std::setw (11) << stats->max_depth << '\n';
+    }
+  out << std::defaultfloat;
+}
+
+void
+Profiler::write_folded_stacks (std::ostream &out) const
+{
+  for (std::size_t i = 1; i < paths.size (); ++i)
+    {
+      using std::chrono::microseconds;
+      const auto micros
+          = std::chrono::duration_cast<microseconds> (paths[i].exclusive)
+                .count ();
+      if (micros == 0)
+        continue;
+
+      std::vector<const std::string *> names;
+      for (std::size_t p = i; p != 0; p = paths[p].parent)
+        names.push_back (&paths[p].function->name);
+
+      out << "script";
+      for (auto it = names.rbegin (); it != names.rend (); ++it)
+        out << ';' << **it;
+      out << ' ' << micros << '\n';
+    }
+}
+
+} // namespace lox
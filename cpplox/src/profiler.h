@@ -0,0 +1,110 @@
+#pragma once
+
+#include "token.h"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace lox
+{
+
+/**
+ * Collect call statistics for Lox functions. Every call to a user function is
+ * bracketed by enter() and exit(). Functions are identified by the Token of
+ * their declaration, so two functions of the same name are kept apart.
+ *
+ * The interpreter only holds a pointer to a Profiler. If that pointer is null,
+ * profiling is disabled and costs a single branch per call.
+ */
+class Profiler
+{
+public:
+  Profiler ();
+
+  /**
+   * Record entering the function declared with @p function_name.
+   */
+  void enter (const Token &function_name);
+
+  /**
+   * Record a tail call from the function which was entered last to the one
+   * declared with @p function_name. The caller stays on the stack below the
+   * callee, so its time includes the callee and flame graphs keep it. A tail
+   * call to a function which is already part of the same chain of tail calls
+   * replaces the frames from there on, so tail recursion does not pile up
+   * frames.
+   */
+  void tail_call (const Token &function_name);
+
+  /**
+   * Record leaving the function which was entered last, together with the
+   * tail callers it replaced.
+   */
+  void exit ();
+
+  /**
+   * Print a table of all profiled functions sorted by exclusive time.
+   */
+  void report (std::ostream &out) const;
+
+  /**
+   * Write the call stacks in the folded format understood by flame graph
+   * tools: one line per stack with frames separated by ';' followed by the
+   * exclusive time in microseconds.
+   */
+  void write_folded_stacks (std::ostream &out) const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct FunctionStats
+  {
+    std::string name;
+    int line{};
+    std::uint64_t calls{};
+    Clock::duration inclusive{};
+    Clock::duration exclusive{};
+    //! Number of activations of this function currently on the stack.
+    unsigned depth{};
+    unsigned max_depth{};
+  };
+
+  //! A node in the tree of all observed call paths.
+  struct CallPath
+  {
+    FunctionStats *function{};
+    std::size_t parent{};
+    std::map<FunctionStats *, std::size_t> children;
+    Clock::duration exclusive{};
+  };
+
+  struct Frame
+  {
+    FunctionStats *function;
+    std::size_t path;
+    Clock::time_point start;
+    //! Inclusive time spent in callees of this frame.
+    Clock::duration children{};
+    //! Whether the frame was entered by a tail call and leaves together with
+    //! the frame below.
+    bool tail{};
+  };
+
+  void push_frame (const Token &function_name, bool tail);
+
+  void pop_frame ();
+
+  //! Keyed by the source offset of the declaration.
+  std::map<int, FunctionStats> functions;
+
+  //! Index 0 is the root representing the top level script.
+  std::vector<CallPath> paths;
+
+  std::vector<Frame> frames;
+};
+
+} // namespace lox
@@ -0,0 +1,31 @@
+#include "program.h"
+#include "error.h"
+#include "parser.h"
+#include "scanner.h"
+
+#include <utility>
+
+namespace lox
+{
+
+std::optional<Program>
+compile (std::string_view source)
+{
+  // Only report errors in this source, but keep earlier ones visible.
+  const bool earlier_errors = std::exchange (had_error, false);
+
+  TokenStream tokens{ source };
+  Parser parser{ tokens };
+  std::vector<Stmt> statements = parser.parse ();
+  auto resolution = std::make_shared<Resolution> ();
+  if (!had_error)
+    resolve (statements, *resolution);
+
+  const bool failed = had_error;
+  had_error = earlier_errors || failed;
+  if (failed)
+    return std::nullopt;
+  return Program{ std::move (statements), std::move (resolution) };
+}
+
+} // namespace lox
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "resolver.h"
+#include "stmt.h"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace lox
+{
+namespace internal
+{
+struct CompiledScript;
+
+/**
+ * The instructions of a Program for the explicit stack. The first
+ * StackInterpreter which executes the program compiles them, all later
+ * executions reuse them.
+ */
+struct StackCode
+{
+  std::once_flag compiled;
+  std::shared_ptr<const CompiledScript> script;
+};
+} // namespace internal
+
+/**
+ * A parsed and resolved program. An Interpreter may execute it any number of
+ * times without parsing or resolving it again.
+ */
+struct Program
+{
+  std::vector<Stmt> statements;
+
+  //! Shared with the functions the program defines, since these may be
+  //! called after the Program is gone.
+  std::shared_ptr<const Resolution> resolution;
+
+  //! Shared by all copies of the program.
+  std::shared_ptr<internal::StackCode> stack_code{
+    std::make_shared<internal::StackCode> ()
+  };
+};
+
+/**
+ * Parse and resolve @p source. Returns std::nullopt if errors were reported.
+ */
+std::optional<Program> compile (std::string_view source);
+
+} // namespace lox
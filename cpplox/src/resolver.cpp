@@ -0,0 +1,289 @@
+#include "resolver.h"
+#include "error.h"
+
+#include <iostream>
+#include <string>
+#include <variant>
+
+namespace lox
+{
+namespace
+{
+/**
+ * Resolve variables before interpretation.
+ */
+struct Resolver
+{
+  Resolver (Resolution &resolution) : resolution (resolution) {}
+
+  /**
+   * Helper to resolve the boxed content. Forwards the call to the unboxed
+   * type T. Notaby, this works for boxed Stmt _and_ Expr variants.
+   */
+  template <typename T>
+  void
+  operator() (const Box<T> &boxed)
+  {
+    return this->operator() (*boxed);
+  }
+
+  void
+  resolve (const std::vector<Stmt> &statements)
+  {
+    for (const auto &stmt : statements)
+      resolve (stmt);
+  }
+
+  void
+  resolve (const Stmt &stmt)
+  {
+    std::visit (*this, stmt);
+  }
+
+  void
+  resolve (const Expr &expr)
+  {
+    std::visit (*this, expr);
+  }
+
+  void
+  operator() (const StmtBlock &stmt)
+  {
+    begin_scope ();
+    resolve (stmt.statements);
+    end_scope ();
+  }
+
+  void
+  operator() (const StmtExpr &stmt)
+  {
+    resolve (stmt.expression);
+  }
+
+  void
+  operator() (const StmtPrint &stmt)
+  {
+    resolve (stmt.expression);
+  }
+
+  void
+  operator() (const StmtVar &stmt)
+  {
+    declare (stmt.name);
+    if (stmt.initializer)
+      resolve (*stmt.initializer);
+    define (stmt.name);
+  }
+
+  void
+  operator() (const StmtIf &stmt)
+  {
+    resolve (stmt.condition);
+    resolve (stmt.then_branch);
+    if (stmt.else_branch)
+      resolve (*stmt.else_branch);
+  }
+
+  void
+  operator() (const StmtWhile &stmt)
+  {
+    resolve (stmt.condition);
+    resolve (stmt.body);
+  }
+
+  void
+  operator() (const StmtFunction &stmt)
+  {
+    // Declare and define, so that a function may refer to itself within its
+    // body.
+    declare (stmt.name);
+    define (stmt.name);
+
+    resolve_function (stmt);
+  }
+
+  void
+  operator() (const StmtReturn &stmt)
+  {
+    if (stmt.value)
+      {
+        resolve (*stmt.value);
+        // Nothing is left to do in the current function after the call
+        // returns. Outside of a function, there is no frame to reuse.
+        if (function_depth > 0 && find_call (*stmt.value) != nullptr)
+          resolution.tail_calls.emplace (stmt.keyword);
+      }
+  }
+
+  void
+  operator() (const ExprBinary &expr)
+  {
+    resolve (expr.left);
+    resolve (expr.right);
+  }
+
+  void
+  operator() (const ExprGrouping &expr)
+  {
+    resolve (expr.expression);
+  }
+
+  void
+  operator() (const ExprLiteral &expr)
+  {
+    // nothing to do
+  }
+
+  void
+  operator() (const ExprLogical &expr)
+  {
+    resolve (expr.left);
+    resolve (expr.right);
+  }
+
+  void
+  operator() (const ExprUnary &expr)
+  {
+    resolve (expr.right);
+  }
+
+  void
+  operator() (const ExprVariable &expr)
+  {
+    if (!scopes.empty () && scopes.back ().count (expr.name.lexeme) == 1
+        && scopes.back ().at (expr.name.lexeme) == false)
+      error (expr.name, "Can't read local variable in its own initializer.");
+
+    resolve_local (expr, expr.name);
+  }
+
+  void
+  operator() (const ExprAssign &expr)
+  {
+    resolve (expr.value);
+    resolve_local (expr, expr.name);
+  }
+
+  void
+  operator() (const ExprCall &expr)
+  {
+    resolve (expr.callee);
+    for (const Expr &arg : expr.arguments)
+      resolve (arg);
+  }
+
+private:
+  void
+  begin_scope ()
+  {
+    scopes.emplace_back ();
+  }
+
+  void
+  end_scope ()
+  {
+    scopes.pop_back ();
+  }
+
+  void
+  declare (const Token &name)
+  {
+    if constexpr (debug)
+      std::cout << "Declaring variable " << name.lexeme << " at line "
+                << name.line << " at offset " << name.start << std::endl;
+
+    // If not in any scope, i.e. at global scope,
+    // nothing to do.
+    if (scopes.empty ())
+      return;
+
+    scopes.back ().emplace (name.lexeme, false);
+  }
+
+  void
+  define (const Token &name)
+  {
+    if constexpr (debug)
+      std::cout << "Defining variable " << name.lexeme << " at line "
+                << name.line << " at offset " << name.start << std::endl;
+    if (scopes.empty ())
+      return;
+    scopes.back ().at (name.lexeme) = true;
+  }
+
+  void
+  resolve_local (const Expr &expr, const Token &name)
+  {
+    for (int i = static_cast<int> (scopes.size ()) - 1; i >= 0; --i)
+      {
+        if (scopes[i].count (name.lexeme) == 1)
+          {
+            const unsigned depth = scopes.size () - 1 - i;
+            if constexpr (debug)
+              {
+                std::cout << "Resolved variable " << name.lexeme << " at line "
+                          << name.line << " at offset " << name.start
+                          << ": depth " << depth << std::endl;
+              }
+            resolution.locals.emplace (name, depth);
+            return;
+          }
+      }
+
+    if constexpr (debug)
+      {
+        std::cout << "Nothing to resolve for variable " << name.lexeme
+                  << " at line " << name.line << " at offset " << name.start
+                  << ": treat as global" << std::endl;
+      }
+  }
+
+  void
+  resolve_function (const StmtFunction &function)
+  {
+    ++function_depth;
+    begin_scope ();
+
+    for (const Token &param : function.params)
+      {
+        declare (param);
+        define (param);
+      }
+    resolve (function.body);
+
+    end_scope ();
+    --function_depth;
+  }
+
+  Resolution &resolution;
+
+  //! Store the different scopes which contain variable names. The boolean
+  //! indicates whether the variable is initialized.
+  std::vector<std::map<std::string, bool> > scopes;
+
+  //! Number of function declarations enclosing the current node.
+  unsigned function_depth{};
+
+  //! If true, trace the resolution process.
+  static constexpr bool debug{ false };
+};
+} // namespace
+
+void
+resolve (const std::vector<Stmt> &program, Resolution &resolution)
+{
+  Resolver{ resolution }.resolve (program);
+}
+
+const ExprCall *
+find_call (const Expr &expr)
+{
+  const Expr *current = &expr;
+  while (std::holds_alternative<Box<ExprGrouping> > (*current))
+    current = &std::get<Box<ExprGrouping> > (*current)->expression;
+
+  if (std::holds_alternative<Box<ExprCall> > (*current))
+    return &*std::get<Box<ExprCall> > (*current);
+  return nullptr;
+}
+} // namespace lox
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "expr.h"
+#include "stmt.h"
+#include "token.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+namespace lox
+{
+
+/**
+ * The static information about a program which the Resolver determines before
+ * the program is executed.
+ */
+struct Resolution
+{
+  /**
+   * Store the depth information on where to look up a variable in the
+   * environment linked list. Variables which are not contained are globals.
+   */
+  std::map<Token, unsigned> locals;
+
+  /**
+   * The return statements, identified by their keyword, which return the
+   * result of a call and may thus reuse the caller's frame.
+   */
+  std::set<Token> tail_calls;
+};
+
+/**
+ * Resolve variables and tail calls in @p program and add them to
+ * @p resolution. Errors are reported via lox::error().
+ */
+void resolve (const std::vector<Stmt> &program, Resolution &resolution);
+
+/**
+ * Return the call if @p expr is a call, possibly wrapped in parentheses.
+ */
+const ExprCall *find_call (const Expr &expr);
+
+} // namespace lox
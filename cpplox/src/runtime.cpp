@@ -0,0 +1,110 @@
+#include "runtime.h"
+#include "error.h"
+
+#include <string>
+#include <variant>
+
+namespace lox
+{
+
+bool
+is_truthy (const Value &value)
+{
+  return std::visit (overloaded{ [] (const bool &b) { return b; },
+                                 [] (const std::nullptr_t &) { return false; },
+                                 [] (const auto &) { return true; } },
+                     value);
+}
+
+namespace
+{
+struct is_equal_same_type
+{
+  template <typename T>
+  bool
+  operator() (const T &a, const T &b) const
+  {
+    return a == b;
+  }
+};
+} // namespace
+
+bool
+is_equal (const Value &left, const Value &right) // NOLINT
+{
+  return std::visit (
+      overloaded{ // Perform the C++ equality check if the two types match
+                  is_equal_same_type{},
+                  // Two callables are assumed to be always unequal!
+                  [] (const Callable &, const Callable &) { return false; },
+                  // Two non-matching types can never be equal
+                  [] (const auto &, const auto &) { return false; } },
+      left, right);
+}
+
+Value
+evaluate_plus_operator (const Value &left, const Token &op, const Value &right)
+{
+  return std::visit (
+      overloaded{
+          // numeric addition
+          [] (const double &l, const double &r) -> Value { return l + r; },
+          // string concatenation
+          [] (const std::string &l, const std::string &r) -> Value {
+            return l + r;
+          },
+          // anything else is an error
+          [&op] (const auto &, const auto &) -> Value {
+            throw RunTimeError (
+                op, "Operands must be two numbers or two strings.");
+          } },
+      left, right);
+}
+
+void
+check_number_operand (const Token &op, const Value &operand)
+{
+  if (!std::holds_alternative<double> (operand))
+    throw RunTimeError (op, "Operand must be a number.");
+}
+
+void
+check_number_operands (const Value &left, const Token &op, const Value &right)
+{
+  if (!(std::holds_alternative<double> (left)
+        && std::holds_alternative<double> (right)))
+    throw RunTimeError (op, "Operands must be numbers.");
+}
+
+const Callable &
+as_callable (const Value &callee, std::size_t argument_count,
+             const Token &paren)
+{
+  if (!std::holds_alternative<Callable> (callee))
+    throw RunTimeError (paren, "Can only call functions and classes.");
+  const auto &fn = std::get<Callable> (callee);
+
+  if (argument_count != fn.arity ())
+    {
+      throw RunTimeError (paren, "Expected " + std::to_string (fn.arity ())
+                                     + " arguments but got "
+                                     + std::to_string (argument_count) + ".");
+    }
+  return fn;
+}
+
+void
+print_value (LoxWriter *out, const Value &value)
+{
+  std::visit (
+      overloaded{
+          [out] (std::nullptr_t) { lox_writer_puts (out, "nil"); },
+          [out] (double d) { lox_writer_number (out, d); },
+          [out] (bool b) { lox_writer_puts (out, b ? "true" : "false"); },
+          [out] (const std::string &s) {
+            lox_writer_write (out, s.data (), s.size ());
+          },
+          [out] (const Callable &) { lox_writer_puts (out, "<callable>"); } },
+      value);
+}
+} // namespace lox
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "token.h"
+#include "types.h"
+
+#include <cstddef>
+#include <lox_writer.h>
+#include <variant>
+
+namespace lox
+{
+/**
+ * Operations on Values which are shared by the different ways of executing a
+ * program.
+ */
+
+// overload visit with multiple lambdas
+template <class... Ts> struct overloaded : Ts...
+{
+  using Ts::operator()...;
+};
+template <class... Ts> overloaded (Ts...) -> overloaded<Ts...>;
+
+[[nodiscard]] inline double
+numeric (const Value &value)
+{
+  // This call can never fail due to checks performed before-hand
+  return std::get<double> (value);
+}
+
+bool is_truthy (const Value &value);
+
+bool is_equal (const Value &left, const Value &right);
+
+Value evaluate_plus_operator (const Value &left, const Token &op,
+                              const Value &right);
+
+void check_number_operand (const Token &op, const Value &operand);
+
+void check_number_operands (const Value &left, const Token &op,
+                            const Value &right);
+
+/**
+ * Return the Callable in @p callee after checking that it can be called with
+ * @p argument_count arguments. Errors are reported at the @p paren of the
+ * call.
+ */
+const Callable &as_callable (const Value &callee, std::size_t argument_count,
+                             const Token &paren);
+
+/**
+ * Write the string representation of @p value without creating temporary
+ * strings.
+ */
+void print_value (LoxWriter *out, const Value &value);
+
+} // namespace lox
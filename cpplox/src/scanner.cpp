@@ -2,9 +2,14 @@
 #include "error.h"
 
 #include <cassert>
-#include <cctype>
+#include <array>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
+#include <lox_number.h>
+#include <lox_scan.h>
+#include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -12,128 +17,161 @@
 
 namespace lox
 {
+namespace
+{
+enum CharacterClass : std::uint8_t
+{
+  DIGIT = 1 << 0,
+  ALPHA = 1 << 1,
+};
+
+/**
+ * The class of every character. Unlike std::isalpha(), this does not depend
+ * on the current locale.
+ */
+constexpr std::array<std::uint8_t, 256> character_classes = [] () {
+  std::array<std::uint8_t, 256> classes{};
+  for (char c = '0'; c <= '9'; ++c)
+    classes[static_cast<unsigned char> (c)] = DIGIT;
+  for (char c = 'a'; c <= 'z'; ++c)
+    classes[static_cast<unsigned char> (c)] = ALPHA;
+  for (char c = 'A'; c <= 'Z'; ++c)
+    classes[static_cast<unsigned char> (c)] = ALPHA;
+  classes['_'] = ALPHA;
+  return classes;
+}();
+
+constexpr bool
+is_digit (char c)
+{
+  return character_classes[static_cast<unsigned char> (c)] & DIGIT;
+}
+
+constexpr bool
+is_alpha (char c)
+{
+  return character_classes[static_cast<unsigned char> (c)] & ALPHA;
+}
+
+constexpr bool
+is_alpha_numeric (char c)
+{
+  return character_classes[static_cast<unsigned char> (c)] & (ALPHA | DIGIT);
+}
+} // namespace
+
+namespace internal
+{
 
 class Scanner
 {
 public:
   Scanner (std::string_view source) : source (std::move (source)) {}
 
-  std::vector<Token>
-  scan_tokens ()
+  /**
+   * Scan until the next Token is complete. At the end of the source, an EOF
+   * Token is returned for every further call.
+   */
+  Token
+  next_token ()
   {
     while (!at_end ())
       {
         start = current;
-        scan_token ();
+        if (std::optional<Token> token = scan_token ())
+          return std::move (*token);
       }
-    tokens.emplace_back (TokenType::TOK_EOF, "", Literal{}, line, start);
-    return tokens;
+    return Token{ TokenType::TOK_EOF, "", Literal{}, line, start };
   }
 
 private:
-  void
+  /**
+   * Scan a single lexeme. Returns std::nullopt for whitespace, comments and
+   * errors.
+   */
+  std::optional<Token>
   scan_token ()
   {
     char c = advance ();
     switch (c)
       {
       case '(':
-        add_token (TokenType::LEFT_PAREN);
-        break;
+        return add_token (TokenType::LEFT_PAREN);
       case ')':
-        add_token (TokenType::RIGHT_PAREN);
-        break;
+        return add_token (TokenType::RIGHT_PAREN);
       case '{':
-        add_token (TokenType::LEFT_BRACE);
-        break;
+        return add_token (TokenType::LEFT_BRACE);
       case '}':
-        add_token (TokenType::RIGHT_BRACE);
-        break;
+        return add_token (TokenType::RIGHT_BRACE);
       case ',':
-        add_token (TokenType::COMMA);
-        break;
+        return add_token (TokenType::COMMA);
       case '.':
-        add_token (TokenType::DOT);
-        break;
+        return add_token (TokenType::DOT);
       case '-':
-        add_token (TokenType::MINUS);
-        break;
+        return add_token (TokenType::MINUS);
       case '+':
-        add_token (TokenType::PLUS);
-        break;
+        return add_token (TokenType::PLUS);
       case ';':
-        add_token (TokenType::SEMICOLON);
-        break;
+        return add_token (TokenType::SEMICOLON);
       case '*':
-        add_token (TokenType::STAR);
-        break;
+        return add_token (TokenType::STAR);
 
       case '!':
-        add_token (match ('=') ? TokenType::BANG_EQUAL : TokenType::BANG);
-        break;
+        return add_token (match ('=') ? TokenType::BANG_EQUAL
+                                      : TokenType::BANG);
       case '=':
-        add_token (match ('=') ? TokenType::EQUAL_EQUAL : TokenType::EQUAL);
-        break;
+        return add_token (match ('=') ? TokenType::EQUAL_EQUAL
+                                      : TokenType::EQUAL);
       case '<':
-        add_token (match ('=') ? TokenType::LESS_EQUAL : TokenType::LESS);
-        break;
+        return add_token (match ('=') ? TokenType::LESS_EQUAL
+                                      : TokenType::LESS);
       case '>':
-        add_token (match ('=') ? TokenType::GREATER_EQUAL
-                               : TokenType::GREATER);
-        break;
+        return add_token (match ('=') ? TokenType::GREATER_EQUAL
+                                      : TokenType::GREATER);
 
       case '/':
         if (match ('/'))
           {
             // absorb all character following a comment until the end of the
             // line
-            while (peek () != '\n' && !at_end ())
-              advance ();
+            seek (lox_skip_line (position (), end ()));
+            return std::nullopt;
           }
-        else
-          add_token (TokenType::SLASH);
-        break;
+        return add_token (TokenType::SLASH);
 
       // Ignored whitespace
+      case '\n':
+        line++;
+        [[fallthrough]];
       case ' ':
       case '\r':
       case '\t':
-        break;
-
-      case '\n':
-        line++;
-        break;
+        seek (lox_skip_whitespace (position (), end (), &line));
+        return std::nullopt;
 
       case '"':
-        parse_string ();
-        break;
+        return parse_string ();
 
       default:
-        if (std::isdigit (c))
-          parse_number ();
-        else if (std::isalpha (c))
-          parse_identifier ();
-        else
-          error (line, "Unrecognized character.");
-        break;
+        if (is_digit (c))
+          return parse_number ();
+        if (is_alpha (c))
+          return parse_identifier ();
+        error (line, "Unrecognized character.");
+        return std::nullopt;
       }
   }
 
-  void
+  std::optional<Token>
   parse_string ()
   {
     // Advance until the next character is an ".
-    while (peek () != '"' && !at_end ())
-      {
-        if (peek () == '\n')
-          ++line;
-        advance ();
-      }
+    seek (lox_skip_string (position (), end (), &line));
 
     if (at_end ())
       {
         error (line, "Unterminated string");
-        return;
+        return std::nullopt;
       }
 
     // Advance past the closing quote
@@ -141,60 +179,74 @@ private:
     assert (closing_quote == '"');
 
     // Discard the quotes by shifting 1 character.
-    add_token (
+    return add_token (
         TokenType::STRING,
         std::string (source.substr (start + 1, (current - 1) - (start + 1))));
   }
 
-  void
+  Token
   parse_number ()
   {
-    while (std::isdigit (peek ()))
+    while (is_digit (peek ()))
       advance ();
 
-    if (peek () == '.' && std::isdigit (peek_next ()))
+    if (peek () == '.' && is_digit (peek_next ()))
       {
         // Consume the decimal point
         advance ();
 
-        while (std::isdigit (peek ()))
+        while (is_digit (peek ()))
           advance ();
       }
 
-    add_token (
-        TokenType::NUMBER,
-        std::stod (std::string (source.substr (start, current - start))));
+    return add_token (TokenType::NUMBER,
+                      lox_parse_number (source.data () + start,
+                                        current - start));
   }
 
-  void
+  Token
   parse_identifier ()
   {
-    const auto is_alpha_numeric
-        = [] (char c) { return std::isdigit (c) || std::isalpha (c); };
-
     while (is_alpha_numeric (peek ()))
       advance ();
 
-    TokenType type
-        = keyword (std::string (source.substr (start, current - start)));
+    TokenType type = keyword (source.substr (start, current - start));
     if (type == TokenType::INVALID)
       type = TokenType::IDENTIFIER;
 
-    add_token (type);
+    return add_token (type);
   }
 
-  void
+  Token
   add_token (TokenType t)
   {
-    add_token (t, Literal{});
+    return add_token (t, Literal{});
   }
 
-  void
+  Token
   add_token (TokenType t, Literal literal)
   {
-    tokens.emplace_back (t,
-                         std::string (source.substr (start, current - start)),
-                         literal, line, start);
+    return Token{ t, std::string (source.substr (start, current - start)),
+                  std::move (literal), line, start };
+  }
+  //! The next character in memory.
+  [[nodiscard]] const char *
+  position () const
+  {
+    return source.data () + current;
+  }
+
+  [[nodiscard]] const char *
+  end () const
+  {
+    return source.data () + source.size ();
+  }
+
+  //! Continue scanning at @p next, which points into the source.
+  void
+  seek (const char *next)
+  {
+    current = static_cast<int> (next - source.data ());
   }
 
   char
@@ -249,13 +301,32 @@ private:
 
   //! Line information purely for error and debugging purposes
   int line{ 1 };
-
-  std::vector<Token> tokens;
 };
 
+} // namespace internal
+
+TokenStream::TokenStream (std::string_view source)
+    : pimpl (std::make_unique<internal::Scanner> (source))
+{
+}
+
+//! Default in implementation to allow PIMPL with unique_ptr
+TokenStream::~TokenStream () = default;
+
+Token
+TokenStream::next ()
+{
+  return pimpl->next_token ();
+}
+
 std::vector<Token>
 scan_tokens (std::string_view source)
 {
-  return Scanner{ std::move (source) }.scan_tokens ();
+  TokenStream stream{ source };
+  std::vector<Token> tokens;
+  do
+    tokens.push_back (stream.next ());
+  while (tokens.back ().type != TokenType::TOK_EOF);
+  return tokens;
 }
 } // namespace lox
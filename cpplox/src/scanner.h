@@ -1,11 +1,41 @@
 #pragma once
 
 #include "token.h"
+#include <memory>
 #include <string_view>
 #include <vector>
 
 namespace lox
 {
+namespace internal
+{
+class Scanner;
+}
+
+/**
+ * Scan the Tokens of a source one at a time, only when they are requested.
+ * The source has to outlive the TokenStream.
+ */
+class TokenStream
+{
+public:
+  explicit TokenStream (std::string_view source);
+
+  /**
+   * Destructor.
+   */
+  ~TokenStream ();
+
+  /**
+   * Scan and return the next Token. After the end of the source, every call
+   * returns an EOF Token.
+   */
+  Token next ();
+
+private:
+  std::unique_ptr<internal::Scanner> pimpl;
+};
+
 /**
  * Split the @p source into tokens.
  */
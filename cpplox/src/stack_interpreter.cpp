@@ -0,0 +1,808 @@
+#include "stack_interpreter.h"
+#include "error.h"
+#include "expr.h"
+#include "runtime.h"
+#include "stmt.h"
+#include "token.h"
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <lox_writer.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <variant>
+
+namespace lox
+{
+namespace internal
+{
+class StackMachine;
+}
+
+namespace
+{
+enum class OpCode : std::uint8_t
+{
+  //! Push constants[operand].
+  CONSTANT,
+  NIL,
+  POP,
+  //! Push the variable named by token, found operand environments up.
+  GET_LOCAL,
+  //! Assign the top of the stack to a variable and keep it on the stack.
+  SET_LOCAL,
+  GET_GLOBAL,
+  SET_GLOBAL,
+  //! Pop a value and define it under the name of token.
+  DEFINE,
+  NEGATE,
+  NOT,
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE,
+  GREATER,
+  GREATER_EQUAL,
+  LESS,
+  LESS_EQUAL,
+  EQUAL,
+  NOT_EQUAL,
+  //! Continue at instruction operand.
+  JUMP,
+  //! Pop a condition and jump if it is falsey.
+  JUMP_IF_FALSE,
+  //! Short-circuit of 'and': keep a falsey value and jump, otherwise pop it.
+  JUMP_IF_FALSE_OR_POP,
+  //! Short-circuit of 'or': keep a truthy value and jump, otherwise pop it.
+  JUMP_IF_TRUE_OR_POP,
+  PRINT,
+  BEGIN_SCOPE,
+  END_SCOPE,
+  //! Define functions[operand] as a closure over the current environment.
+  FUNCTION,
+  //! Call the callee below operand arguments on the stack.
+  CALL,
+  //! Like CALL followed by RETURN but reuses the current frame.
+  TAIL_CALL,
+  RETURN,
+};
+
+struct Instruction
+{
+  OpCode op;
+  unsigned operand;
+  //! The name of a variable or the token used to report errors.
+  const Token *token;
+};
+
+/**
+ * The instructions of a function or the top-level script.
+ */
+struct Code
+{
+  std::vector<Instruction> instructions;
+  std::vector<Value> constants;
+  std::vector<std::shared_ptr<const Code> > functions;
+  //! Owns the tokens referenced by the instructions. Null for the script.
+  std::shared_ptr<const StmtFunction> declaration;
+};
+
+/**
+ * Translate the AST into Code. This is a visitor for both Expr and Stmt
+ * variants.
+ */
+class CodeCompiler
+{
+public:
+  static std::shared_ptr<const Code>
+  compile_script (const std::vector<Stmt> &program,
+                  const Resolution &resolution)
+  {
+    auto code = std::make_shared<Code> ();
+    CodeCompiler compiler{ *code, resolution };
+    for (const Stmt &stmt : program)
+      compiler.compile (stmt);
+    compiler.emit (OpCode::NIL);
+    compiler.emit (OpCode::RETURN);
+    return code;
+  }
+
+  static std::shared_ptr<const Code>
+  compile_function (std::shared_ptr<const StmtFunction> declaration,
+                    const Resolution &resolution)
+  {
+    auto code = std::make_shared<Code> ();
+    code->declaration = std::move (declaration);
+    CodeCompiler compiler{ *code, resolution };
+    for (const Stmt &stmt : code->declaration->body)
+      compiler.compile (stmt);
+    compiler.emit (OpCode::NIL);
+    compiler.emit (OpCode::RETURN);
+    return code;
+  }
+
+  /**
+   * Helper to resolve the boxed content. Forwards the call to the unboxed
+   * type T. Notaby, this works for boxed Stmt _and_ Expr variants.
+   */
+  template <typename T>
+  void
+  operator() (const Box<T> &boxed)
+  {
+    this->operator() (*boxed);
+  }
+
+  void
+  operator() (const StmtExpr &stmt)
+  {
+    compile (stmt.expression);
+    emit (OpCode::POP);
+  }
+
+  void
+  operator() (const StmtPrint &stmt)
+  {
+    compile (stmt.expression);
+    emit (OpCode::PRINT);
+  }
+
+  void
+  operator() (const StmtVar &stmt)
+  {
+    if (stmt.initializer)
+      compile (*stmt.initializer);
+    else
+      emit (OpCode::NIL);
+    emit (OpCode::DEFINE, 0, &stmt.name);
+  }
+
+  void
+  operator() (const StmtBlock &stmt)
+  {
+    emit (OpCode::BEGIN_SCOPE);
+    for (const Stmt &s : stmt.statements)
+      compile (s);
+    emit (OpCode::END_SCOPE);
+  }
+
+  void
+  operator() (const StmtIf &stmt)
+  {
+    compile (stmt.condition);
+    const std::size_t then_jump = emit (OpCode::JUMP_IF_FALSE);
+    compile (stmt.then_branch);
+    if (stmt.else_branch)
+      {
+        const std::size_t else_jump = emit (OpCode::JUMP);
+        patch_jump (then_jump);
+        compile (*stmt.else_branch);
+        patch_jump (else_jump);
+      }
+    else
+      patch_jump (then_jump);
+  }
+
+  void
+  operator() (const StmtWhile &stmt)
+  {
+    const std::size_t loop_start = code.instructions.size ();
+    compile (stmt.condition);
+    const std::size_t exit_jump = emit (OpCode::JUMP_IF_FALSE);
+    compile (stmt.body);
+    emit (OpCode::JUMP, loop_start);
+    patch_jump (exit_jump);
+  }
+
+  void
+  operator() (const StmtFunction &stmt)
+  {
+    // The body of a nested function is owned by the enclosing declaration.
+    // Functions of the script are copied once, since the Code of a function
+    // may outlive the program.
+    std::shared_ptr<const StmtFunction> declaration
+        = code.declaration
+              ? std::shared_ptr<const StmtFunction> (code.declaration, &stmt)
+              : std::make_shared<const StmtFunction> (stmt);
+
+    code.functions.push_back (
+        compile_function (std::move (declaration), resolution));
+    const StmtFunction &owned = *code.functions.back ()->declaration;
+    emit (OpCode::FUNCTION, code.functions.size () - 1, &owned.name);
+  }
+
+  void
+  operator() (const StmtReturn &stmt)
+  {
+    if (stmt.value && resolution.tail_calls.count (stmt.keyword) == 1)
+      {
+        const ExprCall *call = find_call (*stmt.value);
+        assert (call != nullptr);
+        compile_call (*call, OpCode::TAIL_CALL);
+        return;
+      }
+
+    if (stmt.value)
+      compile (*stmt.value);
+    else
+      emit (OpCode::NIL);
+    emit (OpCode::RETURN);
+  }
+
+  void
+  operator() (const ExprLiteral &expr)
+  {
+    if (std::holds_alternative<std::nullptr_t> (expr.value))
+      {
+        emit (OpCode::NIL);
+        return;
+      }
+    code.constants.push_back (
+        std::visit ([] (const auto &v) { return Value{ v }; }, expr.value));
+    emit (OpCode::CONSTANT, code.constants.size () - 1);
+  }
+
+  void
+  operator() (const ExprGrouping &expr)
+  {
+    compile (expr.expression);
+  }
+
+  void
+  operator() (const ExprUnary &expr)
+  {
+    compile (expr.right);
+    emit (expr.op.type == TokenType::MINUS ? OpCode::NEGATE : OpCode::NOT, 0,
+          &expr.op);
+  }
+
+  void
+  operator() (const ExprBinary &expr)
+  {
+    compile (expr.left);
+    compile (expr.right);
+    emit (binary_op (expr.op.type), 0, &expr.op);
+  }
+
+  void
+  operator() (const ExprVariable &expr)
+  {
+    if (auto it = resolution.locals.find (expr.name);
+        it != resolution.locals.end ())
+      emit (OpCode::GET_LOCAL, it->second, &expr.name);
+    else
+      emit (OpCode::GET_GLOBAL, 0, &expr.name);
+  }
+
+  void
+  operator() (const ExprAssign &expr)
+  {
+    compile (expr.value);
+    if (auto it = resolution.locals.find (expr.name);
+        it != resolution.locals.end ())
+      emit (OpCode::SET_LOCAL, it->second, &expr.name);
+    else
+      emit (OpCode::SET_GLOBAL, 0, &expr.name);
+  }
+
+  void
+  operator() (const ExprLogical &expr)
+  {
+    compile (expr.left);
+    const std::size_t end_jump
+        = emit (expr.op.type == TokenType::OR ? OpCode::JUMP_IF_TRUE_OR_POP
+                                              : OpCode::JUMP_IF_FALSE_OR_POP);
+    compile (expr.right);
+    patch_jump (end_jump);
+  }
+
+  void
+  operator() (const ExprCall &expr)
+  {
+    compile_call (expr, OpCode::CALL);
+  }
+
+private:
+  CodeCompiler (Code &code, const Resolution &resolution)
+      : code (code), resolution (resolution)
+  {
+  }
+
+  void
+  compile (const Stmt &stmt)
+  {
+    std::visit (*this, stmt);
+  }
+
+  void
+  compile (const Expr &expr)
+  {
+    std::visit (*this, expr);
+  }
+
+  void
+  compile_call (const ExprCall &expr, OpCode op)
+  {
+    compile (expr.callee);
+    for (const Expr &arg : expr.arguments)
+      compile (arg);
+    emit (op, expr.arguments.size (), &expr.paren);
+  }
+
+  std::size_t
+  emit (OpCode op, std::size_t operand = 0, const Token *token = nullptr)
+  {
+    code.instructions.push_back (
+        Instruction{ op, static_cast<unsigned> (operand), token });
+    return code.instructions.size () - 1;
+  }
+
+  /**
+   * Let the jump at index @p jump continue after the last instruction.
+   */
+  void
+  patch_jump (std::size_t jump)
+  {
+    code.instructions[jump].operand = code.instructions.size ();
+  }
+
+  static OpCode
+  binary_op (TokenType type)
+  {
+    switch (type)
+      {
+      case TokenType::PLUS:
+        return OpCode::ADD;
+      case TokenType::MINUS:
+        return OpCode::SUBTRACT;
+      case TokenType::STAR:
+        return OpCode::MULTIPLY;
+      case TokenType::SLASH:
+        return OpCode::DIVIDE;
+      case TokenType::GREATER:
+        return OpCode::GREATER;
+      case TokenType::GREATER_EQUAL:
+        return OpCode::GREATER_EQUAL;
+      case TokenType::LESS:
+        return OpCode::LESS;
+      case TokenType::LESS_EQUAL:
+        return OpCode::LESS_EQUAL;
+      case TokenType::BANG_EQUAL:
+        return OpCode::NOT_EQUAL;
+      case TokenType::EQUAL_EQUAL:
+        return OpCode::EQUAL;
+      default:
+        assert (false);
+        return OpCode::EQUAL;
+      }
+  }
+
+  Code &code;
+  const Resolution &resolution;
+};
+
+/**
+ * A Lox function run by the StackMachine.
+ */
+struct StackFunction
+{
+  std::shared_ptr<const Code> code;
+
+  Environment closure;
+
+  internal::StackMachine &machine;
+
+  Value operator() (const std::vector<Value> &args) const;
+};
+
+struct CallFrame
+{
+  std::shared_ptr<const Code> code;
+  //! Index of the next instruction.
+  std::size_t ip;
+  //! The environment of the caller which is restored on return.
+  Environment caller_env;
+  //! Number of entries in the scope stack when the frame was entered.
+  std::size_t scope_base;
+};
+
+} // namespace
+
+namespace internal
+{
+//! The Code of a Program, which only this file knows.
+struct CompiledScript
+{
+  std::shared_ptr<const Code> code;
+};
+
+class StackMachine
+{
+public:
+  StackMachine (Environment &globals, const InterpreterOptions &options)
+      : globals (globals), env (globals), profiler (options.profiler),
+        max_call_depth (options.max_call_depth)
+  {
+  }
+
+  void
+  run_script (std::shared_ptr<const Code> script)
+  {
+    frames.push_back (CallFrame{ std::move (script), 0, env, scopes.size () });
+    try
+      {
+        run (0);
+      }
+    catch (...)
+      {
+        // Drop the temporaries of the aborted script, the machine may run
+        // more scripts afterwards.
+        stack.clear ();
+        throw;
+      }
+  }
+
+  /**
+   * Call @p function from native code. Runs until the function returns.
+   */
+  Value
+  call (const StackFunction &function, const std::vector<Value> &args)
+  {
+    const std::size_t base = frames.size ();
+    for (const Value &arg : args)
+      stack.push_back (arg);
+    enter (function, args.size (), function.code->declaration->name);
+    run (base);
+
+    Value result = std::move (stack.back ());
+    stack.pop_back ();
+    return result;
+  }
+
+private:
+  /**
+   * Execute instructions until the frame at index @p base returns.
+   */
+  void
+  run (std::size_t base)
+  {
+    try
+      {
+        while (frames.size () > base)
+          step ();
+      }
+    catch (...)
+      {
+        // Unwind all frames of this run, so the profiler sees every exit.
+        while (frames.size () > base)
+          leave ();
+        throw;
+      }
+  }
+
+  void
+  step ()
+  {
+    CallFrame &frame = frames.back ();
+    const Code &code = *frame.code;
+    const Instruction &in = code.instructions[frame.ip++];
+
+    switch (in.op)
+      {
+      case OpCode::CONSTANT:
+        stack.push_back (code.constants[in.operand]);
+        break;
+      case OpCode::NIL:
+        stack.emplace_back (nullptr);
+        break;
+      case OpCode::POP:
+        stack.pop_back ();
+        break;
+      case OpCode::GET_LOCAL:
+        stack.push_back (env.get_at (in.operand, in.token->lexeme));
+        break;
+      case OpCode::SET_LOCAL:
+        env.assign_at (in.operand, *in.token, stack.back ());
+        break;
+      case OpCode::GET_GLOBAL:
+        stack.push_back (globals[*in.token]);
+        break;
+      case OpCode::SET_GLOBAL:
+        globals[*in.token] = stack.back ();
+        break;
+      case OpCode::DEFINE:
+        env.define (in.token->lexeme, pop ());
+        break;
+      case OpCode::NEGATE:
+        check_number_operand (*in.token, stack.back ());
+        stack.back () = -numeric (stack.back ());
+        break;
+      case OpCode::NOT:
+        stack.back () = !is_truthy (stack.back ());
+        break;
+      case OpCode::ADD:
+        {
+          Value right = pop ();
+          stack.back () = evaluate_plus_operator (stack.back (), *in.token,
+                                                  right);
+          break;
+        }
+      case OpCode::SUBTRACT:
+        numeric_binary (*in.token, std::minus<> ());
+        break;
+      case OpCode::MULTIPLY:
+        numeric_binary (*in.token, std::multiplies<> ());
+        break;
+      case OpCode::DIVIDE:
+        numeric_binary (*in.token, std::divides<> ());
+        break;
+      case OpCode::GREATER:
+        numeric_binary (*in.token, std::greater<> ());
+        break;
+      case OpCode::GREATER_EQUAL:
+        numeric_binary (*in.token, std::greater_equal<> ());
+        break;
+      case OpCode::LESS:
+        numeric_binary (*in.token, std::less<> ());
+        break;
+      case OpCode::LESS_EQUAL:
+        numeric_binary (*in.token, std::less_equal<> ());
+        break;
+      case OpCode::EQUAL:
+        {
+          Value right = pop ();
+          stack.back () = is_equal (stack.back (), right);
+          break;
+        }
+      case OpCode::NOT_EQUAL:
+        {
+          Value right = pop ();
+          stack.back () = !is_equal (stack.back (), right);
+          break;
+        }
+      case OpCode::JUMP:
+        frame.ip = in.operand;
+        break;
+      case OpCode::JUMP_IF_FALSE:
+        if (!is_truthy (pop ()))
+          frame.ip = in.operand;
+        break;
+      case OpCode::JUMP_IF_FALSE_OR_POP:
+        if (!is_truthy (stack.back ()))
+          frame.ip = in.operand;
+        else
+          stack.pop_back ();
+        break;
+      case OpCode::JUMP_IF_TRUE_OR_POP:
+        if (is_truthy (stack.back ()))
+          frame.ip = in.operand;
+        else
+          stack.pop_back ();
+        break;
+      case OpCode::PRINT:
+        {
+          LoxWriter *out = lox_stdout ();
+          print_value (out, stack.back ());
+          lox_writer_putc (out, '\n');
+          stack.pop_back ();
+          break;
+        }
+      case OpCode::BEGIN_SCOPE:
+        scopes.push_back (env);
+        env = Environment::enclose (env);
+        break;
+      case OpCode::END_SCOPE:
+        env = std::move (scopes.back ());
+        scopes.pop_back ();
+        break;
+      case OpCode::FUNCTION:
+        {
+          const auto &function = code.functions[in.operand];
+          const auto arity = function->declaration->params.size ();
+          env.define (in.token->lexeme,
+                      Callable (StackFunction{ function, env, *this }, arity));
+          break;
+        }
+      case OpCode::CALL:
+        call_value (in.operand, *in.token);
+        break;
+      case OpCode::TAIL_CALL:
+        tail_call_value (in.operand, *in.token);
+        break;
+      case OpCode::RETURN:
+        {
+          Value result = pop ();
+          leave ();
+          stack.push_back (std::move (result));
+          break;
+        }
+      }
+  }
+
+  Value
+  pop ()
+  {
+    Value value = std::move (stack.back ());
+    stack.pop_back ();
+    return value;
+  }
+
+  template <typename Operation>
+  void
+  numeric_binary (const Token &op, Operation operation)
+  {
+    Value right = pop ();
+    Value &left = stack.back ();
+    check_number_operands (left, op, right);
+    left = operation (numeric (left), numeric (right));
+  }
+
+  /**
+   * Call the value below @p argument_count arguments on the stack.
+   */
+  void
+  call_value (std::size_t argument_count, const Token &paren)
+  {
+    const Value &callee = stack[stack.size () - 1 - argument_count];
+    const Callable &fn = as_callable (callee, argument_count, paren);
+
+    if (const auto *function = fn.target<StackFunction> ())
+      enter (*function, argument_count, paren);
+    else
+      stack.push_back (call_native (fn, argument_count));
+  }
+
+  /**
+   * Replace the current frame with a call to the value below
+   * @p argument_count arguments on the stack.
+   */
+  void
+  tail_call_value (std::size_t argument_count, const Token &paren)
+  {
+    const Value &callee = stack[stack.size () - 1 - argument_count];
+    const Callable &fn = as_callable (callee, argument_count, paren);
+
+    if (const auto *function = fn.target<StackFunction> ())
+      {
+        // The current code owns paren, keep it alive until the new frame is
+        // set up.
+        const std::shared_ptr<const Code> current = frames.back ().code;
+        leave (true);
+        enter (*function, argument_count, paren, true);
+        return;
+      }
+
+    // Native functions cannot reuse the frame, return their result.
+    Value result = call_native (fn, argument_count);
+    leave ();
+    stack.push_back (std::move (result));
+  }
+
+  /**
+   * Call @p fn with the topmost @p argument_count values and remove them and
+   * the callee from the stack.
+   */
+  Value
+  call_native (const Callable &fn, std::size_t argument_count)
+  {
+    std::vector<Value> arguments (
+        std::make_move_iterator (stack.end () - argument_count),
+        std::make_move_iterator (stack.end ()));
+    Value result = fn (arguments);
+    stack.resize (stack.size () - argument_count - 1);
+    return result;
+  }
+
+  /**
+   * Push a frame for @p function. It is called with the topmost
+   * @p argument_count values, which are removed from the stack along with the
+   * callee. A @p tail_call replaces the frame which was left before.
+   */
+  void
+  enter (const StackFunction &function, std::size_t argument_count,
+         const Token &paren, bool tail_call = false)
+  {
+    if (frames.size () >= max_call_depth)
+      throw RunTimeError (paren, "Maximum call depth of "
+                                     + std::to_string (max_call_depth)
+                                     + " exceeded.");
+
+    const StmtFunction &declaration = *function.code->declaration;
+    Environment environment = Environment::enclose (function.closure);
+    const std::size_t first_argument = stack.size () - argument_count;
+    for (std::size_t i = 0; i < argument_count; ++i)
+      environment.define (declaration.params[i].lexeme,
+                          std::move (stack[first_argument + i]));
+
+    if (profiler)
+      {
+        if (tail_call)
+          profiler->tail_call (declaration.name);
+        else
+          profiler->enter (declaration.name);
+      }
+
+    // The function may be owned by the callee on the stack, so take what is
+    // needed before popping it.
+    frames.push_back (CallFrame{ function.code, 0, std::move (env),
+                                 scopes.size () });
+    env = std::move (environment);
+    stack.resize (first_argument - 1);
+  }
+
+  /**
+   * Pop the current frame and restore the environment of the caller. Before
+   * a @p tail_call, the profiler keeps the frame until its callee returns.
+   */
+  void
+  leave (bool tail_call = false)
+  {
+    CallFrame &frame = frames.back ();
+    if (profiler && frame.code->declaration && !tail_call)
+      profiler->exit ();
+
+    env = std::move (frame.caller_env);
+    scopes.resize (frame.scope_base);
+    frames.pop_back ();
+  }
+
+  Environment &globals;
+
+  //! The environment of the innermost scope.
+  Environment env;
+
+  //! Temporary values of expressions and arguments of calls.
+  std::vector<Value> stack;
+
+  std::vector<CallFrame> frames;
+
+  //! The environments enclosing the blocks which are currently executed.
+  std::vector<Environment> scopes;
+
+  Profiler *profiler;
+
+  unsigned max_call_depth;
+};
+
+} // namespace internal
+
+namespace
+{
+Value
+StackFunction::operator() (const std::vector<Value> &args) const
+{
+  return machine.call (*this, args);
+}
+} // namespace
+
+StackInterpreter::StackInterpreter (Environment &globals,
+                                    const InterpreterOptions &options)
+    : pimpl (std::make_unique<internal::StackMachine> (globals, options))
+{
+}
+
+//! Default in implementation to allow PIMPL with unique_ptr
+StackInterpreter::~StackInterpreter () = default;
+
+void
+StackInterpreter::execute (const std::vector<Stmt> &program,
+                           const Resolution &resolution)
+{
+  pimpl->run_script (CodeCompiler::compile_script (program, resolution));
+}
+
+void
+StackInterpreter::execute (const Program &program)
+{
+  internal::StackCode &stack_code = *program.stack_code;
+  std::call_once (stack_code.compiled, [&program, &stack_code] () {
+    stack_code.script = std::make_shared<internal::CompiledScript> (
+        internal::CompiledScript{ CodeCompiler::compile_script (
+            program.statements, *program.resolution) });
+  });
+  pimpl->run_script (stack_code.script->code);
+}
+
+} // namespace lox
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "environment.h"
+#include "interpreter.h"
+#include "resolver.h"
+#include "stmt.h"
+
+#include <memory>
+#include <vector>
+
+namespace lox
+{
+namespace internal
+{
+class StackMachine;
+}
+
+/**
+ * Execute programs without recursing on the native stack. Every function is
+ * translated into a flat list of instructions which is run by a single loop.
+ * Call frames and intermediate values are kept in heap-allocated stacks, so
+ * the recursion depth is only limited by InterpreterOptions::max_call_depth.
+ */
+class StackInterpreter
+{
+public:
+  /**
+   * Execute programs on @p globals, which has to outlive this object.
+   */
+  StackInterpreter (Environment &globals, const InterpreterOptions &options);
+
+  /**
+   * Destructor.
+   */
+  ~StackInterpreter ();
+
+  /**
+   * Execute the resolved @p program. Functions defined by earlier programs
+   * stay callable.
+   */
+  void execute (const std::vector<Stmt> &program,
+                const Resolution &resolution);
+
+  /**
+   * Execute @p program. Its instructions are only compiled on its first
+   * execution.
+   */
+  void execute (const Program &program);
+
+private:
+  std::unique_ptr<internal::StackMachine> pimpl;
+};
+
+} // namespace lox
@@ -1,7 +1,8 @@
 #include "token.h"
 
+#include <array>
 #include <cassert>
-#include <map>
+#include <cstddef>
 #include <utility>
 #include <variant>
 
@@ -9,78 +10,154 @@ namespace lox
 {
 namespace
 {
-const std::map<TokenType, std::string> token_to_string
-    = { { TokenType::LEFT_PAREN, "LEFT_PAREN" },
-        { TokenType::RIGHT_PAREN, "RIGHT_PAREN" },
-        { TokenType::LEFT_BRACE, "LEFT_BRACE" },
-        { TokenType::RIGHT_BRACE, "RIGHT_BRACE" },
-        { TokenType::COMMA, "COMMA" },
-        { TokenType::DOT, "DOT" },
-        { TokenType::MINUS, "MINUS" },
-        { TokenType::PLUS, "PLUS" },
-        { TokenType::SEMICOLON, "SEMICOLON" },
-        { TokenType::SLASH, "SLASH" },
-        { TokenType::STAR, "STAR" },
-        // One or two character tokens.
-        { TokenType::BANG, "BANG" },
-        { TokenType::BANG_EQUAL, "BANG_EQUAL" },
-        { TokenType::EQUAL, "EQUAL" },
-        { TokenType::EQUAL_EQUAL, "EQUAL_EQUAL" },
-        { TokenType::GREATER, "GREATER" },
-        { TokenType::GREATER_EQUAL, "GREATER_EQUAL" },
-        { TokenType::LESS, "LESS" },
-        { TokenType::LESS_EQUAL, "LESS_EQUAL" },
-        // Literals.
-        { TokenType::IDENTIFIER, "IDENTIFIER" },
-        { TokenType::STRING, "STRING" },
-        { TokenType::NUMBER, "NUMBER" },
-        // Keywords.
-        { TokenType::AND, "AND" },
-        { TokenType::CLASS, "CLASS" },
-        { TokenType::ELSE, "ELSE" },
-        { TokenType::FALSE, "FALSE" },
-        { TokenType::FUN, "FUN" },
-        { TokenType::FOR, "FOR" },
-        { TokenType::IF, "IF" },
-        { TokenType::NIL, "NIL" },
-        { TokenType::OR, "OR" },
-        { TokenType::PRINT, "PRINT" },
-        { TokenType::RETURN, "RETURN" },
-        { TokenType::SUPER, "SUPER" },
-        { TokenType::THIS, "THIS" },
-        { TokenType::TRUE, "TRUE" },
-        { TokenType::VAR, "VAR" },
-        { TokenType::WHILE, "WHILE" },
-
-        { TokenType::TOK_EOF, "TOK_EOF" } };
-
-const std::map<std::string, TokenType> keywords = {
-  { "and", TokenType::AND },       { "class", TokenType::CLASS },
-  { "else", TokenType::ELSE },     { "false", TokenType::FALSE },
-  { "fun", TokenType::FUN },       { "for", TokenType::FOR },
-  { "if", TokenType::IF },         { "nil", TokenType::NIL },
-  { "or", TokenType::OR },         { "print", TokenType::PRINT },
-  { "return", TokenType::RETURN }, { "super", TokenType::SUPER },
-  { "this", TokenType::THIS },     { "true", TokenType::TRUE },
-  { "var", TokenType::VAR },       { "while", TokenType::WHILE },
-};
+//! The names of all TokenTypes, indexed by their value.
+constexpr std::array<std::string_view,
+                     static_cast<std::size_t> (TokenType::TOK_EOF) + 1>
+    token_names = { "INVALID",
+                    "LEFT_PAREN",
+                    "RIGHT_PAREN",
+                    "LEFT_BRACE",
+                    "RIGHT_BRACE",
+                    "COMMA",
+                    "DOT",
+                    "MINUS",
+                    "PLUS",
+                    "SEMICOLON",
+                    "SLASH",
+                    "STAR",
+                    // One or two character tokens.
+                    "BANG",
+                    "BANG_EQUAL",
+                    "EQUAL",
+                    "EQUAL_EQUAL",
+                    "GREATER",
+                    "GREATER_EQUAL",
+                    "LESS",
+                    "LESS_EQUAL",
+                    // Literals.
+                    "IDENTIFIER",
+                    "STRING",
+                    "NUMBER",
+                    // Keywords.
+                    "AND",
+                    "CLASS",
+                    "ELSE",
+                    "FALSE",
+                    "FUN",
+                    "FOR",
+                    "IF",
+                    "NIL",
+                    "OR",
+                    "PRINT",
+                    "RETURN",
+                    "SUPER",
+                    "THIS",
+                    "TRUE",
+                    "VAR",
+                    "WHILE",
+
+                    "TOK_EOF" };
+
+static_assert (token_names.back () == "TOK_EOF",
+               "token_names must list every TokenType in order");
+
+/**
+ * Return @p type if @p text continues with @p rest after the first @p offset
+ * characters. Otherwise, return INVALID.
+ */
+constexpr TokenType
+check_keyword (std::string_view text, std::size_t offset,
+               std::string_view rest, TokenType type)
+{
+  if (text.size () == offset + rest.size () && text.substr (offset) == rest)
+    return type;
+  return TokenType::INVALID;
+}
+
+/**
+ * A trie of switch statements over the leading characters. At most one
+ * comparison with a keyword is needed to classify any identifier.
+ */
+constexpr TokenType
+keyword_type (std::string_view text)
+{
+  if (text.empty ())
+    return TokenType::INVALID;
+
+  switch (text[0])
+    {
+    case 'a':
+      return check_keyword (text, 1, "nd", TokenType::AND);
+    case 'c':
+      return check_keyword (text, 1, "lass", TokenType::CLASS);
+    case 'e':
+      return check_keyword (text, 1, "lse", TokenType::ELSE);
+    case 'f':
+      if (text.size () > 1)
+        {
+          switch (text[1])
+            {
+            case 'a':
+              return check_keyword (text, 2, "lse", TokenType::FALSE);
+            case 'o':
+              return check_keyword (text, 2, "r", TokenType::FOR);
+            case 'u':
+              return check_keyword (text, 2, "n", TokenType::FUN);
+            }
+        }
+      break;
+    case 'i':
+      return check_keyword (text, 1, "f", TokenType::IF);
+    case 'n':
+      return check_keyword (text, 1, "il", TokenType::NIL);
+    case 'o':
+      return check_keyword (text, 1, "r", TokenType::OR);
+    case 'p':
+      return check_keyword (text, 1, "rint", TokenType::PRINT);
+    case 'r':
+      return check_keyword (text, 1, "eturn", TokenType::RETURN);
+    case 's':
+      return check_keyword (text, 1, "uper", TokenType::SUPER);
+    case 't':
+      if (text.size () > 1)
+        {
+          switch (text[1])
+            {
+            case 'h':
+              return check_keyword (text, 2, "is", TokenType::THIS);
+            case 'r':
+              return check_keyword (text, 2, "ue", TokenType::TRUE);
+            }
+        }
+      break;
+    case 'v':
+      return check_keyword (text, 1, "ar", TokenType::VAR);
+    case 'w':
+      return check_keyword (text, 1, "hile", TokenType::WHILE);
+    }
+  return TokenType::INVALID;
+}
+
+static_assert (keyword_type ("while") == TokenType::WHILE);
+static_assert (keyword_type ("this") == TokenType::THIS);
+static_assert (keyword_type ("fo") == TokenType::INVALID);
+static_assert (keyword_type ("classy") == TokenType::INVALID);
 
 } // namespace
 
-std::string
+std::string_view
 to_string (const TokenType &t)
 {
-  assert (token_to_string.count (t) == 1);
+  const auto index = static_cast<std::size_t> (t);
+  assert (index < token_names.size ());
 
-  return token_to_string.at (t);
+  return token_names[index];
 }
 
 TokenType
-keyword (const std::string &text)
+keyword (std::string_view text)
 {
-  if (auto it = keywords.find (text); it != keywords.end ())
-    return it->second;
-  return TokenType::INVALID;
+  return keyword_type (text);
 }
 
 Token::Token (TokenType type, std::string lexeme, Literal literal, int line,
@@ -94,7 +171,7 @@ std::string
 Token::to_string () const
 {
   // TODO see what we need here.
-  return "{" + lox::to_string (type) + " " + lexeme + "}";
+  return "{" + std::string (lox::to_string (type)) + " " + lexeme + "}";
 }
 
 bool
@@ -2,6 +2,7 @@
 
 #include "types.h"
 #include <optional>
+#include <string_view>
 #include <utility>
 
 namespace lox
@@ -58,13 +59,13 @@ enum class TokenType
   TOK_EOF,
 };
 
-std::string to_string (const TokenType &t);
+std::string_view to_string (const TokenType &t);
 
 /**
  * Return the correct keyword token if the given @p text is indeed a keyword.
  * Otherwise, return INVALID.
  */
-TokenType keyword (const std::string &text);
+TokenType keyword (std::string_view text);
 
 struct Token
 {
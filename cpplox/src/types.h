@@ -53,6 +53,16 @@ struct Callable
     return my_arity;
   }
 
+  /**
+   * Access the wrapped object if it is of type T, otherwise return nullptr.
+   */
+  template <typename T>
+  [[nodiscard]] const T *
+  target () const
+  {
+    return fn.template target<T> ();
+  }
+
 private:
   std::function<Value (const std::vector<Value> &args)> fn;
   unsigned my_arity{};
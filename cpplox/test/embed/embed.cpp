@@ -0,0 +1,79 @@
+// Use the embedding API: compile programs once and execute them many times.
+
+#include "interpreter.h"
+#include "program.h"
+
+#include <iostream>
+#include <optional>
+#include <string>
+#include <variant>
+
+using namespace lox;
+
+namespace
+{
+bool ok = true;
+
+void
+check (bool condition, const char *message)
+{
+  if (!condition)
+    {
+      std::cerr << "Check failed: " << message << "\n";
+      ok = false;
+    }
+}
+
+bool
+global_equals (const Interpreter &interpreter, const std::string &name,
+               double expected)
+{
+  const std::optional<Value> value = interpreter.get_global (name);
+  return value && std::holds_alternative<double> (*value)
+         && std::get<double> (*value) == expected;
+}
+
+void
+run_rules (const InterpreterOptions &options)
+{
+  Interpreter interpreter{ options };
+
+  {
+    // The function outlives the program which defines it.
+    const std::optional<Program> library = compile (
+        "fun score (x) { var doubled = 2 * x; return doubled + 1; }");
+    check (library.has_value (), "library compiles");
+    interpreter.execute (*library);
+  }
+
+  const std::optional<Program> rule = compile (
+      "var count = count + 1; var result = score (count);");
+  const std::optional<Program> setup = compile ("var count = 0;");
+  check (rule && setup, "rule compiles");
+
+  interpreter.execute (*setup);
+  for (int i = 1; i <= 1000; ++i)
+    {
+      check (interpreter.execute (*rule), "rule executes");
+      check (global_equals (interpreter, "result", 2.0 * i + 1),
+             "result of the rule");
+    }
+
+  interpreter.reset ();
+  check (!interpreter.get_global ("count"), "reset forgets globals");
+  check (interpreter.get_global ("clock").has_value (),
+         "reset keeps native functions");
+}
+} // namespace
+
+int
+main ()
+{
+  run_rules ({});
+  InterpreterOptions explicit_stack;
+  explicit_stack.explicit_stack = true;
+  run_rules (explicit_stack);
+
+  check (!compile ("var broken = ;"), "syntax errors are reported");
+  return ok ? 0 : 1;
+}
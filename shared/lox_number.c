@@ -0,0 +1,196 @@
+#include "lox_number.h"
+
+#include <locale.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Doubles up to this magnitude are formatted as integers. All integers below
+// 2^53 are exactly representable.
+#define MAX_EXACT_INTEGER 9007199254740992.0
+
+// Largest number of fractional digits tried by the fast path.
+#define MAX_FAST_FRACTION_DIGITS 9
+
+// Significant digits which always fit into an uint64_t.
+#define MAX_PARSED_DIGITS 19
+
+// All powers of ten which are exactly representable as doubles.
+static const double powers_of_ten[]
+    = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+#define MAX_EXACT_POWER_OF_TEN 22
+
+// Write the decimal digits of @p n to @p buffer and return their count.
+static int
+format_digits (unsigned long long n, int min_digits, char *buffer)
+{
+  char reversed[24];
+  int count = 0;
+  do
+    {
+      reversed[count++] = (char)('0' + n % 10);
+      n /= 10;
+    }
+  while (n != 0 || count < min_digits);
+
+  for (int i = 0; i < count; ++i)
+    buffer[i] = reversed[count - 1 - i];
+  return count;
+}
+
+// Try to represent @p value as an integer scaled by a small power of ten. Most
+// numbers occurring in scripts have a short decimal representation and do not
+// need the general algorithm. Returns 0 if this is not possible.
+static int
+format_scaled_integer (double value, char *buffer)
+{
+  const double magnitude = value < 0 ? -value : value;
+  for (int digits = 0; digits <= MAX_FAST_FRACTION_DIGITS; ++digits)
+    {
+      const double scaled = magnitude * powers_of_ten[digits];
+      // Stay well below 2^53 so the rounding below is exact.
+      if (scaled >= MAX_EXACT_INTEGER / 4)
+        return 0;
+
+      const unsigned long long mantissa = (unsigned long long)(scaled + 0.5);
+      // Both operands are exact, so the division is correctly rounded and
+      // checks whether the decimal reads back as the same double.
+      if ((double)mantissa / powers_of_ten[digits] != magnitude)
+        continue;
+
+      int length = 0;
+      if (value < 0)
+        buffer[length++] = '-';
+
+      const unsigned long long scale
+          = (unsigned long long)powers_of_ten[digits];
+      length += format_digits (mantissa / scale, 1, buffer + length);
+      if (digits > 0)
+        {
+          buffer[length++] = '.';
+          length += format_digits (mantissa % scale, digits, buffer + length);
+        }
+      buffer[length] = '\0';
+      return length;
+    }
+  return 0;
+}
+
+// The general algorithm: the shortest precision for which printf produces a
+// round trip. Any decimal with at most DBL_DIG (15) digits is recovered when
+// rounding to 15 digits, so there is no need to try fewer digits.
+static int
+format_general (double value, char *buffer)
+{
+  int length = 0;
+  for (int precision = 15; precision <= 17; ++precision)
+    {
+      length = snprintf (buffer, LOX_NUMBER_BUFFER_SIZE, "%.*g", precision,
+                         value);
+      if (strtod (buffer, NULL) == value)
+        break;
+    }
+
+  // Undo the influence of a locale set by an embedding application.
+  const char decimal_point = localeconv ()->decimal_point[0];
+  if (decimal_point != '.')
+    {
+      for (int i = 0; i < length; ++i)
+        if (buffer[i] == decimal_point)
+          buffer[i] = '.';
+    }
+  return length;
+}
+
+int
+lox_format_number (double value, char *buffer)
+{
+  if (isnan (value))
+    return snprintf (buffer, LOX_NUMBER_BUFFER_SIZE, "nan");
+  if (isinf (value))
+    return snprintf (buffer, LOX_NUMBER_BUFFER_SIZE,
+                     value < 0 ? "-inf" : "inf");
+  if (value == 0)
+    return snprintf (buffer, LOX_NUMBER_BUFFER_SIZE,
+                     signbit (value) ? "-0" : "0");
+
+  int length = format_scaled_integer (value, buffer);
+  if (length == 0)
+    length = format_general (value, buffer);
+  return length;
+}
+
+// Hand the literal to strtod(), which rounds correctly in all cases, but
+// needs a null-terminated copy that uses the decimal point of the locale.
+static double
+parse_with_strtod (const char *text, size_t length)
+{
+  const char *decimal_point = localeconv ()->decimal_point;
+  const size_t point_length = strlen (decimal_point);
+
+  char small[64];
+  const size_t size = length + point_length + 1;
+  char *copy = size <= sizeof (small) ? small : malloc (size);
+  if (copy == NULL)
+    return NAN;
+
+  size_t n = 0;
+  for (size_t i = 0; i < length; ++i)
+    {
+      if (text[i] == '.')
+        {
+          memcpy (copy + n, decimal_point, point_length);
+          n += point_length;
+        }
+      else
+        copy[n++] = text[i];
+    }
+  copy[n] = '\0';
+
+  double value = strtod (copy, NULL);
+  if (copy != small)
+    free (copy);
+  return value;
+}
+
+double
+lox_parse_number (const char *text, size_t length)
+{
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool in_fraction = false;
+
+  for (size_t i = 0; i < length; ++i)
+    {
+      const char c = text[i];
+      if (c == '.')
+        {
+          in_fraction = true;
+          continue;
+        }
+      if (in_fraction)
+        --exponent;
+      // Leading zeros are not significant.
+      if (mantissa == 0 && c == '0')
+        continue;
+      if (digits == MAX_PARSED_DIGITS)
+        return parse_with_strtod (text, length);
+      mantissa = mantissa * 10 + (uint64_t)(c - '0');
+      ++digits;
+    }
+
+  // Clinger's fast path: both the mantissa and the power of ten are exact
+  // doubles, so the single division rounds correctly. Integer literals with
+  // up to 15 digits always take this path.
+  if (mantissa <= (uint64_t)MAX_EXACT_INTEGER
+      && -exponent <= MAX_EXACT_POWER_OF_TEN)
+    return (double)mantissa / powers_of_ten[-exponent];
+
+  return parse_with_strtod (text, length);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Buffer size which is large enough for every number formatted by
+ * lox_format_number(), including the null-terminator.
+ */
+#define LOX_NUMBER_BUFFER_SIZE 32
+
+/**
+ * Format @p value into @p buffer with the shortest representation that reads
+ * back as the same double. Integral values are printed without a fractional
+ * part. The result is independent of the current locale and no memory is
+ * allocated.
+ *
+ * @p buffer must hold at least LOX_NUMBER_BUFFER_SIZE characters. Returns the
+ * number of characters written, not including the null-terminator.
+ */
+int lox_format_number (double value, char *buffer);
+
+/**
+ * Parse a Lox number literal, i.e. digits with an optional fractional part,
+ * from the @p length characters at @p text. The text does not need to be
+ * null-terminated. The result is correctly rounded and independent of the
+ * current locale.
+ */
+double lox_parse_number (const char *text, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,267 @@
+#include "lox_scan.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LOX_SCAN_X86
+#include <immintrin.h>
+#endif
+
+// -1 selects the best supported level.
+static int requested_level = -1;
+
+LoxScanLevel
+lox_scan_supported_level (void)
+{
+#ifdef LOX_SCAN_X86
+  if (__builtin_cpu_supports ("avx2"))
+    return LOX_SCAN_AVX2;
+  if (__builtin_cpu_supports ("sse2"))
+    return LOX_SCAN_SSE2;
+#endif
+  return LOX_SCAN_SCALAR;
+}
+
+void
+lox_scan_set_level (LoxScanLevel level)
+{
+  LoxScanLevel supported = lox_scan_supported_level ();
+  requested_level = (int)(level < supported ? level : supported);
+}
+
+LoxScanLevel
+lox_scan_level (void)
+{
+  if (requested_level < 0)
+    return lox_scan_supported_level ();
+  return (LoxScanLevel)requested_level;
+}
+
+static bool
+is_whitespace (char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// --- scalar fallbacks --- //
+
+static const char *
+skip_line_scalar (const char *p, const char *end)
+{
+  while (p < end && *p != '\n')
+    ++p;
+  return p;
+}
+
+static const char *
+skip_string_scalar (const char *p, const char *end, int *line)
+{
+  for (; p < end && *p != '"'; ++p)
+    {
+      if (*p == '\n')
+        ++*line;
+    }
+  return p;
+}
+
+static const char *
+skip_whitespace_scalar (const char *p, const char *end, int *line)
+{
+  for (; p < end && is_whitespace (*p); ++p)
+    {
+      if (*p == '\n')
+        ++*line;
+    }
+  return p;
+}
+
+#ifdef LOX_SCAN_X86
+
+// Every vector loop below works on whole blocks and leaves the remaining
+// bytes to the scalar fallbacks. A block is searched with byte-wise compares
+// whose results are condensed into a bit mask with one bit per byte.
+
+// --- SSE2 --- //
+
+#define SSE2_MASK(block, c)                                                   \
+  ((uint32_t)_mm_movemask_epi8 (_mm_cmpeq_epi8 ((block), _mm_set1_epi8 (c))))
+
+__attribute__ ((target ("sse2"))) static const char *
+skip_line_sse2 (const char *p, const char *end)
+{
+  for (; end - p >= 16; p += 16)
+    {
+      __m128i block = _mm_loadu_si128 ((const __m128i *)p);
+      uint32_t newlines = SSE2_MASK (block, '\n');
+      if (newlines)
+        return p + __builtin_ctz (newlines);
+    }
+  return skip_line_scalar (p, end);
+}
+
+__attribute__ ((target ("sse2"))) static const char *
+skip_string_sse2 (const char *p, const char *end, int *line)
+{
+  for (; end - p >= 16; p += 16)
+    {
+      __m128i block = _mm_loadu_si128 ((const __m128i *)p);
+      uint32_t quotes = SSE2_MASK (block, '"');
+      uint32_t newlines = SSE2_MASK (block, '\n');
+      if (quotes)
+        {
+          int offset = __builtin_ctz (quotes);
+          *line += __builtin_popcount (newlines & ((1u << offset) - 1));
+          return p + offset;
+        }
+      *line += __builtin_popcount (newlines);
+    }
+  return skip_string_scalar (p, end, line);
+}
+
+__attribute__ ((target ("sse2"))) static const char *
+skip_whitespace_sse2 (const char *p, const char *end, int *line)
+{
+  for (; end - p >= 16; p += 16)
+    {
+      __m128i block = _mm_loadu_si128 ((const __m128i *)p);
+      uint32_t newlines = SSE2_MASK (block, '\n');
+      uint32_t whitespace = newlines | SSE2_MASK (block, ' ')
+                            | SSE2_MASK (block, '\t')
+                            | SSE2_MASK (block, '\r');
+      uint32_t other = ~whitespace & 0xffffu;
+      if (other)
+        {
+          int offset = __builtin_ctz (other);
+          *line += __builtin_popcount (newlines & ((1u << offset) - 1));
+          return p + offset;
+        }
+      *line += __builtin_popcount (newlines);
+    }
+  return skip_whitespace_scalar (p, end, line);
+}
+
+#undef SSE2_MASK
+
+// --- AVX2 --- //
+
+#define AVX2_MASK(block, c)                                                   \
+  ((uint32_t)_mm256_movemask_epi8 (                                          \
+      _mm256_cmpeq_epi8 ((block), _mm256_set1_epi8 (c))))
+
+__attribute__ ((target ("avx2"))) static const char *
+skip_line_avx2 (const char *p, const char *end)
+{
+  for (; end - p >= 32; p += 32)
+    {
+      __m256i block = _mm256_loadu_si256 ((const __m256i *)p);
+      uint32_t newlines = AVX2_MASK (block, '\n');
+      if (newlines)
+        return p + __builtin_ctz (newlines);
+    }
+  return skip_line_sse2 (p, end);
+}
+
+__attribute__ ((target ("avx2"))) static const char *
+skip_string_avx2 (const char *p, const char *end, int *line)
+{
+  for (; end - p >= 32; p += 32)
+    {
+      __m256i block = _mm256_loadu_si256 ((const __m256i *)p);
+      uint32_t quotes = AVX2_MASK (block, '"');
+      uint32_t newlines = AVX2_MASK (block, '\n');
+      if (quotes)
+        {
+          int offset = __builtin_ctz (quotes);
+          *line += __builtin_popcount (newlines & ((1u << offset) - 1));
+          return p + offset;
+        }
+      *line += __builtin_popcount (newlines);
+    }
+  return skip_string_sse2 (p, end, line);
+}
+
+__attribute__ ((target ("avx2"))) static const char *
+skip_whitespace_avx2 (const char *p, const char *end, int *line)
+{
+  for (; end - p >= 32; p += 32)
+    {
+      __m256i block = _mm256_loadu_si256 ((const __m256i *)p);
+      uint32_t newlines = AVX2_MASK (block, '\n');
+      uint32_t whitespace = newlines | AVX2_MASK (block, ' ')
+                            | AVX2_MASK (block, '\t')
+                            | AVX2_MASK (block, '\r');
+      uint32_t other = ~whitespace;
+      if (other)
+        {
+          int offset = __builtin_ctz (other);
+          *line += __builtin_popcount (newlines & ((1u << offset) - 1));
+          return p + offset;
+        }
+      *line += __builtin_popcount (newlines);
+    }
+  return skip_whitespace_sse2 (p, end, line);
+}
+
+#undef AVX2_MASK
+
+#endif
+
+const char *
+lox_skip_line (const char *begin, const char *end)
+{
+  switch (lox_scan_level ())
+    {
+#ifdef LOX_SCAN_X86
+    case LOX_SCAN_AVX2:
+      return skip_line_avx2 (begin, end);
+    case LOX_SCAN_SSE2:
+      return skip_line_sse2 (begin, end);
+#endif
+    default:
+      return skip_line_scalar (begin, end);
+    }
+}
+
+const char *
+lox_skip_string (const char *begin, const char *end, int *line)
+{
+  switch (lox_scan_level ())
+    {
+#ifdef LOX_SCAN_X86
+    case LOX_SCAN_AVX2:
+      return skip_string_avx2 (begin, end, line);
+    case LOX_SCAN_SSE2:
+      return skip_string_sse2 (begin, end, line);
+#endif
+    default:
+      return skip_string_scalar (begin, end, line);
+    }
+}
+
+const char *
+lox_skip_whitespace (const char *begin, const char *end, int *line)
+{
+  if (begin == end || !is_whitespace (*begin))
+    return begin;
+  // Most runs of whitespace are a single space between two tokens, which is
+  // not worth loading a whole block for.
+  if (begin + 1 == end || !is_whitespace (begin[1]))
+    {
+      if (*begin == '\n')
+        ++*line;
+      return begin + 1;
+    }
+
+  switch (lox_scan_level ())
+    {
+#ifdef LOX_SCAN_X86
+    case LOX_SCAN_AVX2:
+      return skip_whitespace_avx2 (begin, end, line);
+    case LOX_SCAN_SSE2:
+      return skip_whitespace_sse2 (begin, end, line);
+#endif
+    default:
+      return skip_whitespace_scalar (begin, end, line);
+    }
+}
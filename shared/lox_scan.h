@@ -0,0 +1,59 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * The instruction sets the skip functions below may use. Each level includes
+ * the previous ones.
+ */
+typedef enum
+{
+  LOX_SCAN_SCALAR,
+  LOX_SCAN_SSE2,
+  LOX_SCAN_AVX2,
+} LoxScanLevel;
+
+/**
+ * The best level supported by this CPU.
+ */
+LoxScanLevel lox_scan_supported_level (void);
+
+/**
+ * Restrict the skip functions to @p level, e.g., to compare implementations.
+ * Levels above lox_scan_supported_level() are clamped. By default, the best
+ * supported level is used.
+ */
+void lox_scan_set_level (LoxScanLevel level);
+
+/**
+ * The level currently used by the skip functions.
+ */
+LoxScanLevel lox_scan_level (void);
+
+/**
+ * Return the first newline in [@p begin, @p end) or @p end. This finds the
+ * end of a line comment.
+ */
+const char *lox_skip_line (const char *begin, const char *end);
+
+/**
+ * Return the first double quote in [@p begin, @p end) or @p end, and add the
+ * number of newlines before it to @p line. This finds the end of a string
+ * literal.
+ */
+const char *lox_skip_string (const char *begin, const char *end, int *line);
+
+/**
+ * Return the first character in [@p begin, @p end) which is not a space, tab,
+ * carriage return or newline, or @p end. The number of skipped newlines is
+ * added to @p line.
+ */
+const char *lox_skip_whitespace (const char *begin, const char *end,
+                                 int *line);
+
+#ifdef __cplusplus
+}
+#endif
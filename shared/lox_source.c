@@ -0,0 +1,119 @@
+#include "lox_source.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool
+read_stream (LoxSource *source, int fd)
+{
+  size_t capacity = 64 * 1024;
+  size_t length = 0;
+  char *buffer = malloc (capacity);
+  if (buffer == NULL)
+    return false;
+
+  for (;;)
+    {
+      if (length == capacity)
+        {
+          capacity *= 2;
+          char *grown = realloc (buffer, capacity);
+          if (grown == NULL)
+            {
+              free (buffer);
+              errno = ENOMEM;
+              return false;
+            }
+          buffer = grown;
+        }
+
+      ssize_t count = read (fd, buffer + length, capacity - length);
+      if (count == 0)
+        break;
+      if (count < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          int error = errno;
+          free (buffer);
+          errno = error;
+          return false;
+        }
+      length += (size_t)count;
+    }
+
+  source->buffer = buffer;
+  source->data = buffer;
+  source->length = length;
+  return true;
+}
+
+static bool
+map_file (LoxSource *source, int fd, size_t length)
+{
+  // An empty mapping is not allowed, but an empty source is fine.
+  if (length == 0)
+    {
+      source->data = "";
+      source->length = 0;
+      return true;
+    }
+
+  void *mapping = mmap (NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED)
+    return false;
+  // The scanners walk the source front to back exactly once.
+  madvise (mapping, length, MADV_SEQUENTIAL);
+
+  source->mapping = mapping;
+  source->data = mapping;
+  source->length = length;
+  return true;
+}
+
+bool
+lox_source_open (LoxSource *source, const char *path)
+{
+  source->data = NULL;
+  source->length = 0;
+  source->mapping = NULL;
+  source->buffer = NULL;
+
+  const bool from_stdin = strcmp (path, "-") == 0;
+  int fd = from_stdin ? STDIN_FILENO : open (path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  bool ok = false;
+  if (fstat (fd, &info) == 0 && S_ISREG (info.st_mode))
+    ok = map_file (source, fd, (size_t)info.st_size);
+  // Fall back to reading for pipes, terminals and failed mappings.
+  if (!ok)
+    ok = read_stream (source, fd);
+
+  if (!from_stdin)
+    {
+      int error = errno;
+      close (fd);
+      errno = error;
+    }
+  return ok;
+}
+
+void
+lox_source_close (LoxSource *source)
+{
+  if (source->mapping != NULL)
+    munmap (source->mapping, source->length);
+  free (source->buffer);
+  source->data = NULL;
+  source->length = 0;
+  source->mapping = NULL;
+  source->buffer = NULL;
+}
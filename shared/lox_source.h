@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * The contents of a source file as a pointer and a length. The data is not
+ * null-terminated. Regular files are mapped into memory, so even huge scripts
+ * are never copied. Pipes and other streams are read into a heap buffer.
+ */
+typedef struct
+{
+  const char *data;
+  size_t length;
+
+  //! Start of the memory mapping, or NULL if the data lives on the heap.
+  void *mapping;
+  //! Heap buffer for sources which could not be mapped.
+  char *buffer;
+} LoxSource;
+
+/**
+ * Load the file at @p path into @p source. The path "-" denotes standard
+ * input. Returns false and sets errno if the file cannot be read.
+ */
+bool lox_source_open (LoxSource *source, const char *path);
+
+/**
+ * Release all resources held by @p source.
+ */
+void lox_source_close (LoxSource *source);
+
+#ifdef __cplusplus
+}
+#endif
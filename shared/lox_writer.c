@@ -0,0 +1,118 @@
+#include "lox_writer.h"
+#include "lox_number.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+lox_writer_init (LoxWriter *writer, FILE *sink)
+{
+  writer->sink = sink;
+  writer->length = 0;
+}
+
+static void
+drain (LoxWriter *writer)
+{
+  fwrite (writer->buffer, 1, writer->length, writer->sink);
+  writer->length = 0;
+}
+
+void
+lox_writer_write (LoxWriter *writer, const char *data, size_t length)
+{
+  if (writer->length + length > LOX_WRITER_BUFFER_SIZE)
+    {
+      drain (writer);
+      // Large chunks do not need to take the detour through the buffer.
+      if (length > LOX_WRITER_BUFFER_SIZE)
+        {
+          fwrite (data, 1, length, writer->sink);
+          return;
+        }
+    }
+  memcpy (writer->buffer + writer->length, data, length);
+  writer->length += length;
+}
+
+void
+lox_writer_puts (LoxWriter *writer, const char *string)
+{
+  lox_writer_write (writer, string, strlen (string));
+}
+
+void
+lox_writer_putc (LoxWriter *writer, char c)
+{
+  if (writer->length == LOX_WRITER_BUFFER_SIZE)
+    drain (writer);
+  writer->buffer[writer->length++] = c;
+}
+
+void
+lox_writer_printf (LoxWriter *writer, const char *format, ...)
+{
+  va_list args;
+  for (int attempt = 0; attempt < 2; ++attempt)
+    {
+      const size_t available = LOX_WRITER_BUFFER_SIZE - writer->length;
+      va_start (args, format);
+      int length = vsnprintf (writer->buffer + writer->length, available,
+                              format, args);
+      va_end (args);
+      if (length < 0)
+        return;
+      // vsnprintf needs room for the null-terminator which we do not keep.
+      if ((size_t)length < available)
+        {
+          writer->length += length;
+          return;
+        }
+      drain (writer);
+    }
+
+  // Does not even fit into the empty buffer.
+  va_start (args, format);
+  vfprintf (writer->sink, format, args);
+  va_end (args);
+}
+
+void
+lox_writer_number (LoxWriter *writer, double value)
+{
+  char formatted[LOX_NUMBER_BUFFER_SIZE];
+  int length = lox_format_number (value, formatted);
+  lox_writer_write (writer, formatted, length);
+}
+
+void
+lox_writer_flush (LoxWriter *writer)
+{
+  drain (writer);
+  fflush (writer->sink);
+}
+
+static LoxWriter stdout_writer;
+static pthread_once_t stdout_writer_once = PTHREAD_ONCE_INIT;
+
+static void
+flush_stdout_writer (void)
+{
+  lox_writer_flush (&stdout_writer);
+}
+
+static void
+init_stdout_writer (void)
+{
+  lox_writer_init (&stdout_writer, stdout);
+  atexit (flush_stdout_writer);
+}
+
+LoxWriter *
+lox_stdout (void)
+{
+  pthread_once (&stdout_writer_once, init_stdout_writer);
+  return &stdout_writer;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define LOX_WRITER_BUFFER_SIZE (64 * 1024)
+
+/**
+ * A large output buffer in front of a FILE. The buffer is only handed to the
+ * FILE when it is full or when lox_writer_flush() is called explicitly, e.g.
+ * before an error message is written to another stream.
+ */
+typedef struct
+{
+  FILE *sink;
+  size_t length;
+  char buffer[LOX_WRITER_BUFFER_SIZE];
+} LoxWriter;
+
+void lox_writer_init (LoxWriter *writer, FILE *sink);
+
+void lox_writer_write (LoxWriter *writer, const char *data, size_t length);
+
+void lox_writer_puts (LoxWriter *writer, const char *string);
+
+void lox_writer_putc (LoxWriter *writer, char c);
+
+void lox_writer_printf (LoxWriter *writer, const char *format, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+/**
+ * Write @p value formatted with lox_format_number().
+ */
+void lox_writer_number (LoxWriter *writer, double value);
+
+/**
+ * Pass all buffered output on to the sink and flush it.
+ */
+void lox_writer_flush (LoxWriter *writer);
+
+/**
+ * The writer for standard output. It is flushed automatically at exit. Any
+ * thread may ask for the writer, but only one thread may write to it.
+ */
+LoxWriter *lox_stdout (void);
+
+#ifdef __cplusplus
+}
+#endif